@@ -137,6 +137,35 @@ static void Vertex(double th,double ph)
    glVertex3d(x,y,z);
 }
 
+/*
+ *  Unit ball with bands inc degrees apart
+ *     Compiled into a display list the first time and again when inc
+ *     changes, so drawing a ball does no trig
+ */
+static int UnitBall(int inc)
+{
+   static int list=0;  //  Display list
+   static int step=0;  //  Increment of the list
+   int th,ph;
+   if (list && step==inc) return list;
+   if (!list) list = glGenLists(1);
+   step = inc;
+   glNewList(list,GL_COMPILE);
+   //  Bands of latitude
+   for (ph=-90;ph<90;ph+=inc)
+   {
+      glBegin(GL_QUAD_STRIP);
+      for (th=0;th<=360;th+=2*inc)
+      {
+         Vertex(th,ph);
+         Vertex(th,ph+inc);
+      }
+      glEnd();
+   }
+   glEndList();
+   return list;
+}
+
 /*
  *  Draw a ball
  *     at (x,y,z)
@@ -144,7 +173,6 @@ static void Vertex(double th,double ph)
  */
 static void ball(double x,double y,double z,double r)
 {
-   int th,ph;
    float yellow[] = {1.0,1.0,0.0,1.0};
    float Emission[]  = {0.0,0.0,0.01*emission,1.0};
    //  Save transformation
@@ -157,17 +185,7 @@ static void ball(double x,double y,double z,double r)
    glMaterialf(GL_FRONT,GL_SHININESS,shiny);
    glMaterialfv(GL_FRONT,GL_SPECULAR,yellow);
    glMaterialfv(GL_FRONT,GL_EMISSION,Emission);
-   //  Bands of latitude
-   for (ph=-90;ph<90;ph+=inc)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (th=0;th<=360;th+=2*inc)
-      {
-         Vertex(th,ph);
-         Vertex(th,ph+inc);
-      }
-      glEnd();
-   }
+   glCallList(UnitBall(inc));
    //  Undo transofrmations
    glPopMatrix();
 }
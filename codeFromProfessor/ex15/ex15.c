@@ -132,6 +132,22 @@ static void cube(double x,double y,double z,
    glDisable(GL_TEXTURE_2D);
 }
 
+/*
+ *  Unit ball
+ *     glutSolidSphere works out its sines and cosines on every call, so it
+ *     is compiled into a display list the first time
+ */
+static int UnitBall(void)
+{
+   static int list=0;  //  Display list
+   if (list) return list;
+   list = glGenLists(1);
+   glNewList(list,GL_COMPILE);
+   glutSolidSphere(1.0,16,16);
+   glEndList();
+   return list;
+}
+
 /*
  *  Draw a ball
  *     at (x,y,z)
@@ -146,7 +162,7 @@ static void ball(double x,double y,double z,double r)
    glScaled(r,r,r);
    //  White ball
    glColor3f(1,1,1);
-   glutSolidSphere(1.0,16,16);
+   glCallList(UnitBall());
    //  Undo transofrmations
    glPopMatrix();
 }
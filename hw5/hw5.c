@@ -208,20 +208,18 @@ static void cube_color(double x,double y,double z,
 }
 
 /*
- *  Draw a sphere
- *     at (x,y,z)
- *     radius (r)
+ *  Unit sphere with 5 degree steps
+ *     Compiled into a display list the first time, so drawing a sphere
+ *     does no trig
  */
-static void sphere(double x,double y,double z,double r)
+static int UnitSphere(void)
 {
    const int d=5;
+   static int list=0;  //  Display list
    int th,ph;
-
-   //  Save transformation
-   glPushMatrix();
-   //  Offset and scale
-   glTranslated(x,y,z);
-   glScaled(r,r,r);
+   if (list) return list;
+   list = glGenLists(1);
+   glNewList(list,GL_COMPILE);
 
    //  South pole cap
    glBegin(GL_TRIANGLE_FAN);
@@ -253,6 +251,23 @@ static void sphere(double x,double y,double z,double r)
    }
    glEnd();
 
+   glEndList();
+   return list;
+}
+
+/*
+ *  Draw a sphere
+ *     at (x,y,z)
+ *     radius (r)
+ */
+static void sphere(double x,double y,double z,double r)
+{
+   //  Save transformation
+   glPushMatrix();
+   //  Offset and scale
+   glTranslated(x,y,z);
+   glScaled(r,r,r);
+   glCallList(UnitSphere());
    //  Undo transformations
    glPopMatrix();
 }
@@ -653,6 +668,35 @@ static void background()
 }
 
 
+/*
+ *  Unit ball with bands inc degrees apart
+ *     Compiled into a display list the first time and again when inc
+ *     changes, so drawing a ball does no trig
+ */
+static int UnitBall(int inc)
+{
+   static int list=0;  //  Display list
+   static int step=0;  //  Increment of the list
+   int th,ph;
+   if (list && step==inc) return list;
+   if (!list) list = glGenLists(1);
+   step = inc;
+   glNewList(list,GL_COMPILE);
+   //  Bands of latitude
+   for (ph=-90;ph<90;ph+=inc)
+   {
+      glBegin(GL_QUAD_STRIP);
+      for (th=0;th<=360;th+=2*inc)
+      {
+         Vertex(th,ph);
+         Vertex(th,ph+inc);
+      }
+      glEnd();
+   }
+   glEndList();
+   return list;
+}
+
 /*
  *  Draw a ball
  *     at (x,y,z)
@@ -660,7 +704,6 @@ static void background()
  */
 static void ball(double x,double y,double z,double r)
 {
-   int th,ph;
    float yellow[] = {1.0,1.0,0.0,1.0};
    float Emission[]  = {0.0,0.0,0.01*emission,1.0};
    //  Save transformation
@@ -673,17 +716,7 @@ static void ball(double x,double y,double z,double r)
    glMaterialf(GL_FRONT,GL_SHININESS,shiny);
    glMaterialfv(GL_FRONT,GL_SPECULAR,yellow);
    glMaterialfv(GL_FRONT,GL_EMISSION,Emission);
-   //  Bands of latitude
-   for (ph=-90;ph<90;ph+=inc)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (th=0;th<=360;th+=2*inc)
-      {
-         Vertex(th,ph);
-         Vertex(th,ph+inc);
-      }
-      glEnd();
-   }
+   glCallList(UnitBall(inc));
    //  Undo transofrmations
    glPopMatrix();
 }
@@ -17,6 +17,46 @@
 #include <GL/glut.h>
 #endif
 
+//  Mipmap filters
+#define MIP_NONE    0
+#define MIP_BOX     1
+#define MIP_KAISER  2
+#define MIP_LANCZOS 3
+#define MAXMIP     32  //  Maximum number of mipmap levels
+#define IMGERR    256  //  Size of image decoder error messages
+
+//  Block compression encoders
+#define BC_NONE     0
+#define BC_RANGE    1
+#define BC_CLUSTER  2
+
+//  Mesh cache (.cmesh) flags (bits 8-15 hold the crease angle of generated normals)
+#define CMESH_OPTIMIZED   1
+#define CMESH_NORMALS     2
+#define CMESH_NORMALS_ALL 4
+
+//  Generated normals and tangents (OBJNormals)
+#define OBJ_NORMALS     1  //  Faces without normals or with broken ones
+#define OBJ_NORMALS_ALL 2  //  Every face
+#define OBJ_TANGENTS    4  //  Tangents of meshes
+
+//  Most threads run by Parallel
+#define MAXTHREADS 32
+
+//  Pixel conversion kernels (PixKernel)
+#define PIX_BEST   -1
+#define PIX_C       0
+#define PIX_SSSE3   1
+#define PIX_AVX2    2
+
+//  Texture container (.ctex) pixel formats and codecs
+#define CTEX_RGB8   1
+#define CTEX_RGBA8  2
+#define CTEX_BC1    3
+#define CTEX_BC3    4
+#define CTEX_RAW    0
+#define CTEX_LZ4    1
+
 #define Cos(th) cos(3.1415926/180*(th))
 #define Sin(th) sin(3.1415926/180*(th))
 
@@ -24,12 +64,343 @@
 extern "C" {
 #endif
 
+//  Texture cache counters
+typedef struct
+{
+   unsigned long hits;    //  Lookups served from the cache
+   unsigned long misses;  //  Lookups that had to load the file
+   unsigned long bytes;   //  Texture bytes resident
+   int           count;   //  Number of cached textures
+   unsigned long evictions;  //  Textures released to stay within budget
+   unsigned long reloads;    //  Evicted textures loaded again
+} texstats_t;
+
+//  Image in memory
+typedef struct
+{
+   int dx,dy;            //  Image dimensions
+   int n;                //  Bytes per pixel (3=RGB 4=RGBA)
+   unsigned char* data;  //  Pixels (rows tightly packed, bottom row first)
+} image_t;
+
+//  Texture atlas
+typedef struct
+{
+   int n;                //  Number of images
+   int npage;            //  Number of pages
+   unsigned int* page;   //  Texture name of each page
+   int*   index;         //  Page holding each image
+   float  (*uv)[4];      //  Texture coordinates of each image (s0,t0,s1,t1)
+} atlas_t;
+
+//  Material
+typedef struct
+{
+   char* name;                 //  Material name
+   float Ka[4],Kd[4],Ks[4],Ns; //  Colors and shininess
+   float d;                    //  Transparency
+   unsigned int map;           //  Texture
+   char* file;                 //  Texture file (NULL if none)
+} material_t;
+
+//  Mesh vertex attributes (positions are always present)
+#define MESH_NORMAL  1
+#define MESH_TEXTURE 2
+#define MESH_TANGENT 4
+
+//  Mesh vertex buffer formats
+#define MESH_FLOAT 0  //  Floats (32 bytes per vertex)
+#define MESH_QUANT 1  //  16 bit positions, 8 bit normals and half float texture coordinates
+
+//  Bounding box and sphere
+typedef struct
+{
+   float min[3],max[3];  //  Axis aligned box
+   float center[3];      //  Sphere center
+   float radius;         //  Sphere radius
+} bounds_t;
+
+//  Indexes drawn with one material
+typedef struct
+{
+   int mtl;              //  Material (-1 leaves the current material)
+   int first;            //  First index
+   int count;            //  Number of indexes
+} meshrange_t;
+
+//  Simplified level of detail of a mesh
+typedef struct
+{
+   int    nind;          //  Number of indexes
+   unsigned int* ind;    //  Triangle indexes into the vertexes of the full mesh
+   int    nrange;        //  Number of draw ranges
+   meshrange_t* range;   //  Draw ranges
+   float  error;         //  Distance from the full mesh (object units)
+} meshlod_t;
+
+//  Triangle mesh
+typedef struct
+{
+   int    nvert;         //  Number of vertexes
+   int    ncorner;       //  Number of face corners (vertexes before welding)
+   float* vert;          //  Vertexes: position, normal and texture coordinates (8 floats)
+   int    nind;          //  Number of indexes
+   unsigned int* ind;    //  Triangle indexes
+   int    nrange;        //  Number of draw ranges
+   meshrange_t* range;   //  Draw ranges
+   int    nmtl;          //  Number of materials
+   material_t* mtl;      //  Materials
+   int    attr;          //  Attributes present (MESH_NORMAL, MESH_TEXTURE)
+   unsigned int vbo;     //  Vertex buffer
+   unsigned int ibo;     //  Index buffer
+   int    isize;         //  Bytes per index in the index buffer (2 or 4)
+   float  min[3],max[3]; //  Bounding box
+   float  center[3];     //  Bounding sphere center
+   float  radius;        //  Bounding sphere radius
+   bounds_t* bound;      //  Bounds of each draw range
+   int    nlod;          //  Number of simplified levels
+   meshlod_t* lod;       //  Simplified levels, coarser at each level
+   float* tan;           //  Tangent and handedness of each vertex (4 floats, NULL if not built)
+   int    format;        //  Format of the vertex buffer (MESH_FLOAT or MESH_QUANT)
+   float  decode[16];    //  Matrix from quantized to object coordinates (MESH_QUANT)
+} mesh_t;
+
+//  Node of a bounding volume hierarchy
+//    The left child of an inner node follows it in the array
+typedef struct
+{
+   float min[3],max[3];  //  Box around the triangles below the node
+   int   first;          //  First triangle of a leaf, or right child of an inner node
+   int   count;          //  Triangles in a leaf (0 for inner nodes)
+} bvhnode_t;
+
+//  Bounding volume hierarchy over the triangles of a mesh
+typedef struct
+{
+   int    nnode;         //  Number of nodes
+   bvhnode_t* node;      //  Nodes depth first (the root is node 0)
+   int    ntri;          //  Number of triangles
+   int*   tri;           //  Mesh triangle at each leaf position
+   float* pos;           //  Corners of the triangle at each leaf position (9 floats)
+} bvh_t;
+
+//  Ray hit found by BVHRay
+typedef struct
+{
+   float t;              //  Distance along the ray in lengths of its direction
+   int   tri;            //  Mesh triangle (indexes 3*tri to 3*tri+2)
+   float u,v;            //  Barycentric coordinates of the hit
+} bvhhit_t;
+
+//  Vertex cache misses measured by OptimizeMesh
+typedef struct
+{
+   double acmr[4];       //  Misses per triangle as loaded and after each step
+   double atvr[4];       //  Misses per vertex as loaded and after each step
+} meshopt_t;
+
+//  Largest meshlets
+#define MESHLET_VERTS 64
+#define MESHLET_TRIS  124
+
+//  Cluster of nearby triangles of one draw range
+typedef struct
+{
+   int   first;          //  First index in the mesh indexes
+   int   count;          //  Number of indexes
+   int   range;          //  Draw range
+   int   nvert;          //  Number of vertexes
+   float center[3];      //  Bounding sphere center
+   float radius;         //  Bounding sphere radius
+   float axis[3];        //  Axis of the cone around the face normals
+   float cosine;         //  Cosine of the half angle of the cone (0 if too wide to cull)
+} meshlet_t;
+
+//  Meshlets of a mesh and the draw list made by CullMeshlets
+typedef struct
+{
+   int    nmeshlet;      //  Number of meshlets
+   meshlet_t* meshlet;   //  Meshlets in index order
+   int    ndraw;         //  Number of draws in the list
+   meshrange_t* draw;    //  Runs of indexes to draw
+   int    ntri;          //  Triangles in the draw list
+   int    nout;          //  Meshlets outside the frustum
+   int    nback;         //  Meshlets facing away
+} meshlets_t;
+
+//  Largest errors of the compact vertex format measured by QuantizeMesh
+typedef struct
+{
+   float  pos;           //  Position error (object units)
+   float  normal;        //  Normal error (degrees)
+   float  uv;            //  Texture coordinate error
+   int    stride[2];     //  Bytes per vertex as floats and quantized
+} meshquant_t;
+
+//  OBJ loader counters
+typedef struct
+{
+   unsigned long materials;  //  Materials read from MTL files
+   unsigned long usemtl;     //  Material changes in the OBJ files (usemtl)
+   unsigned long binds;      //  Materials set per draw once faces are grouped
+   unsigned long pages;      //  Attribute pages read by StreamOBJ
+   unsigned long peak;       //  Memory used by the last StreamOBJ (bytes)
+} objstats_t;
+
+//  Memory of the last OBJ file parsed
+typedef struct
+{
+   unsigned long names;      //  Names allocated from the arena
+   unsigned long chunks;     //  Arena chunks allocated for them
+   unsigned long arena;      //  Bytes of arena chunks
+   unsigned long arrays;     //  Bytes of coordinate, face and corner arrays
+} objmem_t;
+
+//  Arena (bump) allocator
+typedef struct arenachunk arenachunk_t;
+typedef struct
+{
+   arenachunk_t* head;       //  Current chunk, followed by the others
+   unsigned long allocs;     //  Blocks handed out
+   unsigned long chunks;     //  Chunks allocated
+   unsigned long bytes;      //  Bytes of chunks
+} arena_t;
+
+//  OBJ material statement
+#define OBJ_USEMTL 0
+#define OBJ_MTLLIB 1
+typedef struct
+{
+   int   face;           //  Number of faces before the statement
+   int   type;           //  OBJ_USEMTL or OBJ_MTLLIB
+   char* name;           //  Material or file name
+} objop_t;
+
+//  OBJ file in memory
+typedef struct
+{
+   int    nv,nt,nn;      //  Number of vertexes, texture coordinates and normals
+   float  *V,*T,*N;      //  Vertexes (xyz), texture coordinates (st) and normals (xyz)
+   int    nf;            //  Number of faces
+   int*   face;          //  First corner of each face (nf+1 entries)
+   int    nc;            //  Number of face corners
+   int*   corner;        //  Vertex, texture and normal index of each corner (1 based, 0=none)
+   int    nop;           //  Number of material statements
+   objop_t* op;          //  Material statements in file order
+   arena_t arena;        //  Names of the material statements
+   unsigned long bytes;  //  File size
+} obj_t;
+
 void Print(const char* format , ...);
 void Fatal(const char* format , ...);
 unsigned int LoadTexBMP(const char* file);
+unsigned int LoadTexBMPAsync(const char* file,void (*callback)(const char* file,unsigned int tex));
+int  TexUploadPending(unsigned long budget);
+void ReadBMP(const char* file,image_t* img);
+void ReadPNG(const char* file,image_t* img);
+void ReadImage(const char* file,image_t* img);
+int  DecodeBMP(const char* file,image_t* img,char* err);
+int  DecodePNG(const char* file,image_t* img,char* err);
+int  DecodeImage(const char* file,image_t* img,char* err);
+int  ImageError(char* err,const char* format,...);
+unsigned int LoadTexPNG(const char* file);
+long Inflate(unsigned char* dst,size_t cap,const unsigned char* src,size_t n);
+unsigned int TexImage(const char* file,const image_t* img,unsigned int texture,unsigned long* bytes);
+unsigned int TexImageMip(const char* file,const image_t levels[],int n,unsigned int texture,unsigned long* bytes);
+unsigned int TexImageMipBGR(const char* file,const image_t levels[],int n,int align,unsigned int texture,unsigned long* bytes);
+unsigned int TexImageBC(const char* file,const image_t levels[],int n,unsigned int texture,unsigned long* bytes);
+int  TexHasBC(void);
+void TexCompress(int mode);
+int  TexCompressMode(void);
+unsigned long BCSize(int dx,int dy,int n);
+unsigned long EncodeBC(const image_t* img,int quality,unsigned char* out);
+void DecodeBC(const unsigned char* blocks,image_t* img);
+double ImagePSNR(const image_t* a,const image_t* b);
+void TexMipmap(int filter);
+int  TexMipmapFilter(void);
+int  BuildMipmaps(const image_t* img,int filter,image_t levels[]);
+void FreeMipmaps(image_t levels[],int n);
+unsigned int  LoadTexCTEX(const char* file);
+unsigned long WriteCTEX(const char* file,const image_t levels[],int n,int format,int codec,int quality,int filter);
+unsigned int  LoadTexBC(const char* file,unsigned int texture,unsigned long* bytes);
+unsigned int  TexImageCTEX(const char* file,unsigned int texture,unsigned long* bytes);
+int  LZ4Compress(unsigned char* dst,int cap,const unsigned char* src,int n);
+int  LZ4Decompress(unsigned char* dst,int cap,const unsigned char* src,int n);
+int  BuildAtlas(atlas_t* atlas,const char* files[],int n,int size,int pad);
+void AtlasBind(const atlas_t* atlas,int k);
+void AtlasUnbind(void);
+void FreeAtlas(atlas_t* atlas);
+unsigned int TexCacheFind(const char* file);
+unsigned int TexCachePeek(const char* file);
+void TexCacheAdd(const char* file,unsigned int tex,unsigned long bytes);
+int  TexCacheEvict(const char* file);
+void TexCacheFlush(void);
+int  TexCacheRevalidate(void);
+void TexCacheStats(texstats_t* stats);
+void TexBind(unsigned int tex);
+void TexBindName(unsigned int tex);
+void TexBindReset(void);
+void TexNewList(unsigned int list);
+void TexEndList(void);
+void TexBudget(unsigned long bytes);
 void Project(double fov,double asp,double dim);
 void ErrCheck(const char* where);
 int  LoadOBJ(const char* file);
+void ParseOBJ(const char* file,obj_t* obj);
+void OBJThreads(int n);
+void LoadOBJMesh(const char* file,mesh_t* mesh);
+void BuildMesh(const obj_t* obj,const int use[],mesh_t* mesh);
+void UploadMesh(mesh_t* mesh);
+void DrawMesh(const mesh_t* mesh);
+void FreeMesh(mesh_t* mesh);
+void OptimizeMesh(mesh_t* mesh,meshopt_t* stats);
+void MeshCacheMiss(const mesh_t* mesh,int cache,double* acmr,double* atvr);
+void OBJOptimize(int on);
+void OBJStats(objstats_t* stats);
+void OBJMemory(objmem_t* mem);
+void OBJLOD(int n);
+void OBJNormals(int mode,float crease);
+void BuildNormals(obj_t* obj,float crease,int all);
+void BuildTangents(mesh_t* mesh);
+void MeshBounds(mesh_t* mesh);
+void QuantizeMesh(mesh_t* mesh,meshquant_t* err);
+int  MeshStride(const mesh_t* mesh);
+void PackMesh(const mesh_t* mesh,void* buf);
+void OBJQuantize(int on);
+int  OBJBounds(int list,bounds_t* bounds);
+void BuildBVH(const mesh_t* mesh,bvh_t* bvh);
+void FreeBVH(bvh_t* bvh);
+int  BVHRay(const bvh_t* bvh,const float org[3],const float dir[3],float tmax,bvhhit_t* hit);
+int  BVHOverlap(const bvh_t* bvh,const float min[3],const float max[3],int tri[],int n);
+void BuildMeshLOD(mesh_t* mesh,int n,const float ratio[]);
+int  MeshLOD(const mesh_t* mesh,float pixels);
+void DrawMeshLOD(const mesh_t* mesh,int level);
+void DrawMeshRanges(const mesh_t* mesh,int nrange,const meshrange_t* range,size_t base);
+void BuildMeshlets(mesh_t* mesh,meshlets_t* ml);
+int  CullMeshlets(const mesh_t* mesh,meshlets_t* ml,const float M[16],const float P[16],int back);
+void DrawMeshlets(const mesh_t* mesh,meshlets_t* ml);
+void FreeMeshlets(meshlets_t* ml);
+const mesh_t* SphereMesh(int dth,int dph,int tex);
+void DrawSphere(double x,double y,double z,double r,int dth,int dph,int tex);
+unsigned long WriteCMESH(const char* file,const mesh_t* mesh,int flags,const char* src[],int nsrc);
+unsigned long WriteCMESHFiles(const char* file,const mesh_t* mesh,int flags,const char* src[],int nsrc,FILE* vert,FILE* ind);
+unsigned long StreamOBJ(const char* file,const char* out,unsigned long limit);
+int  LoadCMESH(const char* file,int flags,mesh_t* mesh);
+void ApplyMaterial(const material_t* m);
+void FreeOBJ(obj_t* obj);
+void* ArenaAlloc(arena_t* arena,size_t n);
+char* ArenaString(arena_t* arena,const char* s,size_t n);
+void  ArenaJoin(arena_t* a,arena_t* b);
+void  ArenaFree(arena_t* arena);
+const void* MapFile(const char* file,size_t* size);
+void UnmapFile(const void* data,size_t size);
+void PixBGRtoRGB(unsigned char* dst,const unsigned char* src,int n);
+void PixBGRtoRGBA(unsigned char* dst,const unsigned char* src,int n,unsigned char alpha);
+void PixFlipRows(unsigned char* img,int rowbytes,int rows);
+int  PixKernel(int kernel);
+int  Processors(void);
+int  Threads(long long n,long long min);
+void Parallel(void* (*fn)(void*),void* job,size_t size,int n);
 
 #ifdef __cplusplus
 }
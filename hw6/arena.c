@@ -0,0 +1,99 @@
+/*
+ *  Arena (bump) allocator
+ *
+ *  Many small blocks that are all released together, such as the names of
+ *  the material statements of an OBJ file, are carved out of large chunks
+ *  instead of being allocated one at a time.  Freeing the arena releases
+ *  every chunk at once.
+ */
+#include "CSCIx229.h"
+
+#define ARENA_CHUNK (64<<10)  //  Usual size of a chunk
+#define ARENA_ALIGN 8         //  Alignment of blocks
+
+//  Chunk of an arena (the blocks follow it)
+struct arenachunk
+{
+   struct arenachunk* next;  //  Next chunk
+   size_t size;              //  Bytes for blocks
+   size_t used;              //  Bytes handed out
+};
+
+//  Size of the chunk header rounded up to the alignment
+#define HEADER ((sizeof(arenachunk_t)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+
+/*
+ *  Allocate n bytes from an arena
+ *    The block lives until the arena is freed
+ */
+void* ArenaAlloc(arena_t* arena,size_t n)
+{
+   arenachunk_t* c = arena->head;
+   n = (n+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+   //  Start a new chunk (a block larger than a chunk gets its own)
+   if (!c || c->size-c->used<n)
+   {
+      size_t size = n>ARENA_CHUNK ? n : ARENA_CHUNK;
+      c = (arenachunk_t*)malloc(HEADER+size);
+      if (!c) Fatal("Cannot allocate %lu bytes for arena\n",(unsigned long)(HEADER+size));
+      c->next = arena->head;
+      c->size = size;
+      c->used = 0;
+      arena->head = c;
+      arena->chunks++;
+      arena->bytes += HEADER+size;
+   }
+   c->used += n;
+   arena->allocs++;
+   return (char*)c+HEADER+c->used-n;
+}
+
+/*
+ *  Copy n characters to an arena as a string
+ */
+char* ArenaString(arena_t* arena,const char* s,size_t n)
+{
+   char* str = (char*)ArenaAlloc(arena,n+1);
+   memcpy(str,s,n);
+   str[n] = 0;
+   return str;
+}
+
+/*
+ *  Move the blocks of arena b to arena a
+ *    New blocks still come from the current chunk of a
+ */
+void ArenaJoin(arena_t* a,arena_t* b)
+{
+   arenachunk_t* c = b->head;
+   if (!c) return;
+   //  Link the chunks of b after the current chunk of a
+   if (a->head)
+   {
+      while (c->next)
+         c = c->next;
+      c->next = a->head->next;
+      a->head->next = b->head;
+   }
+   else
+      a->head = b->head;
+   a->allocs += b->allocs;
+   a->chunks += b->chunks;
+   a->bytes  += b->bytes;
+   memset(b,0,sizeof(arena_t));
+}
+
+/*
+ *  Free every block of an arena
+ *    The arena is empty and may be used again
+ */
+void ArenaFree(arena_t* arena)
+{
+   while (arena->head)
+   {
+      arenachunk_t* c = arena->head;
+      arena->head = c->next;
+      free(c);
+   }
+   memset(arena,0,sizeof(arena_t));
+}
@@ -0,0 +1,276 @@
+/*
+ *  Texture atlas
+ *
+ *  Packs a set of BMP and PNG images into one or more large textures (pages)
+ *  so that switching between them needs no texture bind.  Images are placed
+ *  with a skyline bottom-left packer.  Each image is surrounded by a border of
+ *  copies of its edge pixels so linear filtering does not bleed in colors
+ *  from its neighbors.  Each mipmap level halves the border, so pages only
+ *  get the levels whose texels stay inside it.
+ *
+ *  AtlasBind() binds the page holding an image and loads the texture matrix
+ *  so that texture coordinates 0 to 1 cover just that image.  This lets
+ *  existing drawing code use an atlas without changing its texture
+ *  coordinates, as long as they stay within 0 to 1 (no repeats).
+ */
+#include "CSCIx229.h"
+
+//  Skyline segment
+typedef struct
+{
+   int x,y,w;  //  Start, height and width of segment
+} skyline_t;
+
+//  Page being packed
+typedef struct
+{
+   skyline_t* sky;  //  Skyline
+   int nsky;        //  Number of segments
+} page_t;
+
+//
+//  Find position for a w x h rectangle starting at segment i
+//    Returns the y coordinate or -1 if it does not fit
+//
+static int Fit(const page_t* page,int i,int w,int h,int size)
+{
+   int x = page->sky[i].x;
+   int y = 0;
+   if (x+w>size) return -1;
+   //  Rectangle rests on the highest segment it spans
+   while (w>0)
+   {
+      if (i>=page->nsky) return -1;
+      if (page->sky[i].y>y) y = page->sky[i].y;
+      if (y+h>size) return -1;
+      w -= page->sky[i].w;
+      i++;
+   }
+   return y;
+}
+
+//
+//  Place a rectangle on the page
+//    Returns 1 and sets x,y if the rectangle fits
+//
+static int Place(page_t* page,int w,int h,int size,int* x,int* y)
+{
+   int i,k;
+   int best=-1,besty=size,bestw=size;
+   //  Lowest position, ties broken by narrowest segment
+   for (i=0;i<page->nsky;i++)
+   {
+      int yy = Fit(page,i,w,h,size);
+      if (yy>=0 && (yy<besty || (yy==besty && page->sky[i].w<bestw)))
+      {
+         best = i;
+         besty = yy;
+         bestw = page->sky[i].w;
+      }
+   }
+   if (best<0) return 0;
+   *x = page->sky[best].x;
+   *y = besty;
+
+   //  Insert new segment
+   page->sky = (skyline_t*)realloc(page->sky,(page->nsky+1)*sizeof(skyline_t));
+   if (!page->sky) Fatal("Cannot allocate memory for atlas\n");
+   memmove(page->sky+best+1,page->sky+best,(page->nsky-best)*sizeof(skyline_t));
+   page->sky[best].x = *x;
+   page->sky[best].y = besty+h;
+   page->sky[best].w = w;
+   page->nsky++;
+   //  Trim segments now covered by the new one
+   for (i=best+1;i<page->nsky;)
+   {
+      int end = page->sky[best].x+page->sky[best].w;
+      int cut = end-page->sky[i].x;
+      if (cut<=0) break;
+      if (cut<page->sky[i].w)
+      {
+         page->sky[i].x += cut;
+         page->sky[i].w -= cut;
+         break;
+      }
+      memmove(page->sky+i,page->sky+i+1,(page->nsky-i-1)*sizeof(skyline_t));
+      page->nsky--;
+   }
+   //  Merge neighbors at the same height
+   for (k=0;k<page->nsky-1;)
+      if (page->sky[k].y==page->sky[k+1].y)
+      {
+         page->sky[k].w += page->sky[k+1].w;
+         memmove(page->sky+k+1,page->sky+k+2,(page->nsky-k-2)*sizeof(skyline_t));
+         page->nsky--;
+      }
+      else
+         k++;
+   return 1;
+}
+
+//
+//  Copy image into page with a border of replicated edge pixels
+//    Images without alpha are opaque on RGBA pages
+//
+static void Blit(image_t* page,const image_t* img,int x0,int y0,int pad)
+{
+   int i,j;
+   for (j=-pad;j<img->dy+pad;j++)
+   {
+      int y = j<0 ? 0 : j>=img->dy ? img->dy-1 : j;
+      unsigned char* out = page->data + page->n*((size_t)(y0+j)*page->dx + x0);
+      const unsigned char* row = img->data + img->n*(size_t)y*img->dx;
+      for (i=-pad;i<img->dx+pad;i++)
+      {
+         int x = i<0 ? 0 : i>=img->dx ? img->dx-1 : i;
+         const unsigned char* p = row + img->n*x;
+         memcpy(out+page->n*i,p,3);
+         if (page->n==4) out[page->n*i+3] = img->n==4 ? p[3] : 255;
+      }
+   }
+}
+
+/*
+ *  Build atlas from image files
+ *    files is the list of n BMP or PNG files
+ *    Pages are RGBA if any image has alpha
+ *    size is the width and height of each page
+ *    pad is the number of border pixels around each image, which also
+ *    limits mipmaps to levels 0 to floor(log2(pad))
+ *    Returns the number of pages
+ */
+int BuildAtlas(atlas_t* atlas,const char* files[],int n,int size,int pad)
+{
+   int i,k;
+   int bpp=3;
+   int nmip;
+   int* order;
+   int* x;
+   int* y;
+   page_t*  pages=NULL;
+   image_t* img;
+
+   //  Read images
+   img = (image_t*)malloc(n*sizeof(image_t));
+   order = (int*)malloc(3*n*sizeof(int));
+   atlas->page = (unsigned int*)malloc(n*sizeof(unsigned int));
+   atlas->index = (int*)malloc(n*sizeof(int));
+   atlas->uv = (float(*)[4])malloc(n*sizeof(float[4]));
+   if (!img || !order || !atlas->page || !atlas->index || !atlas->uv) Fatal("Cannot allocate memory for atlas\n");
+   x = order+n;
+   y = order+2*n;
+   for (k=0;k<n;k++)
+   {
+      ReadImage(files[k],img+k);
+      if (img[k].n==4) bpp = 4;
+      if (img[k].dx+2*pad>size || img[k].dy+2*pad>size)
+         Fatal("%s %dx%d does not fit in %dx%d atlas\n",files[k],img[k].dx,img[k].dy,size,size);
+   }
+   //  Place tallest images first
+   for (k=0;k<n;k++)
+      order[k] = k;
+   for (k=1;k<n;k++)
+      for (i=k;i>0 && img[order[i]].dy>img[order[i-1]].dy;i--)
+      {
+         int t = order[i];
+         order[i] = order[i-1];
+         order[i-1] = t;
+      }
+   //  Pack images onto pages, opening a new page when none has room
+   atlas->n = n;
+   atlas->npage = 0;
+   for (i=0;i<n;i++)
+   {
+      k = order[i];
+      for (atlas->index[k]=0;atlas->index[k]<atlas->npage;atlas->index[k]++)
+         if (Place(pages+atlas->index[k],img[k].dx+2*pad,img[k].dy+2*pad,size,x+k,y+k)) break;
+      if (atlas->index[k]==atlas->npage)
+      {
+         page_t* p;
+         pages = (page_t*)realloc(pages,(atlas->npage+1)*sizeof(page_t));
+         if (!pages) Fatal("Cannot allocate memory for atlas\n");
+         p = pages+atlas->npage++;
+         p->sky = (skyline_t*)malloc(sizeof(skyline_t));
+         if (!p->sky) Fatal("Cannot allocate memory for atlas\n");
+         p->sky[0].x = p->sky[0].y = 0;
+         p->sky[0].w = size;
+         p->nsky = 1;
+         Place(p,img[k].dx+2*pad,img[k].dy+2*pad,size,x+k,y+k);
+      }
+      //  Texture coordinates of the image proper
+      atlas->uv[k][0] = (float)(x[k]+pad)/size;
+      atlas->uv[k][1] = (float)(y[k]+pad)/size;
+      atlas->uv[k][2] = (float)(x[k]+pad+img[k].dx)/size;
+      atlas->uv[k][3] = (float)(y[k]+pad+img[k].dy)/size;
+   }
+   //  Mipmap levels up to floor(log2(pad)) keep the border at least one
+   //  texel wide
+   for (nmip=1;(1<<nmip)<=pad && nmip<MAXMIP;nmip++);
+   //  Copy images to pages and create textures
+   for (i=0;i<atlas->npage;i++)
+   {
+      image_t page;
+      image_t levels[MAXMIP];
+      int nlev=1;
+      page.dx = page.dy = size;
+      page.n = bpp;
+      page.data = (unsigned char*)calloc((size_t)bpp*size*size,1);
+      if (!page.data) Fatal("Cannot allocate memory for atlas\n");
+      for (k=0;k<n;k++)
+         if (atlas->index[k]==i) Blit(&page,img+k,x[k]+pad,y[k]+pad,pad);
+      if (TexMipmapFilter()!=MIP_NONE)
+         nlev = BuildMipmaps(&page,TexMipmapFilter(),levels);
+      else
+         levels[0] = page;
+      atlas->page[i] = TexImageMip("atlas",levels,nlev<nmip?nlev:nmip,0,NULL);
+      FreeMipmaps(levels,nlev);
+      free(page.data);
+      free(pages[i].sky);
+   }
+   //  Done with images
+   for (k=0;k<n;k++)
+      free(img[k].data);
+   free(img);
+   free(order);
+   free(pages);
+   return atlas->npage;
+}
+
+/*
+ *  Bind atlas image k
+ *    Binds the page holding the image (if not already bound) and sets the
+ *    texture matrix to map texture coordinates 0 to 1 onto the image
+ */
+void AtlasBind(const atlas_t* atlas,int k)
+{
+   const float* uv = atlas->uv[k];
+   TexBindName(atlas->page[atlas->index[k]]);
+   glMatrixMode(GL_TEXTURE);
+   glLoadIdentity();
+   glTranslatef(uv[0],uv[1],0);
+   glScalef(uv[2]-uv[0],uv[3]-uv[1],1);
+   glMatrixMode(GL_MODELVIEW);
+}
+
+/*
+ *  Reset the texture matrix after drawing with an atlas
+ */
+void AtlasUnbind(void)
+{
+   glMatrixMode(GL_TEXTURE);
+   glLoadIdentity();
+   glMatrixMode(GL_MODELVIEW);
+}
+
+/*
+ *  Delete atlas textures and free memory
+ */
+void FreeAtlas(atlas_t* atlas)
+{
+   glDeleteTextures(atlas->npage,atlas->page);
+   TexBindReset();
+   free(atlas->page);
+   free(atlas->index);
+   free(atlas->uv);
+   atlas->n = atlas->npage = 0;
+}
@@ -0,0 +1,553 @@
+/*
+ *  BC1 and BC3 (DXT1 and DXT5) block compression
+ *
+ *  RGB images are encoded as BC1 (8 bytes per 4x4 block) and RGBA images as
+ *  BC3 (16 bytes per block), cutting texture memory to 1/6 and 1/4 of RGB
+ *  and RGBA.  Two encoders are offered:
+ *    BC_RANGE    fits the endpoints to the extent of the block along its
+ *                principal axis.  Fast, and index selection uses SSE2.
+ *    BC_CLUSTER  tries every ordered split of the block into four clusters
+ *                and solves for the best endpoints of each split.  Slower,
+ *                but noticeably better on blocks with gradients.
+ *  Large images are encoded on several threads, each taking a band of block
+ *  rows.  The decoder follows the same palette arithmetic as the encoder, so
+ *  images can be checked on the CPU with ImagePSNR().
+ *
+ *  Nothing here calls OpenGL, so images may be encoded on loader threads.
+ */
+#include "CSCIx229.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MAXENCODERS 8  //  Maximum number of encoder threads
+
+//  Encoder selected with TexCompress
+static int bcmode=BC_NONE;
+
+/*
+ *  Select block compression used when creating textures
+ *    BC_NONE uploads uncompressed images (the default)
+ */
+void TexCompress(int mode)
+{
+   bcmode = mode;
+}
+
+/*
+ *  Block compression used when creating textures
+ */
+int TexCompressMode(void)
+{
+   return bcmode;
+}
+
+/*
+ *  Size of an image encoded as BC1 (n=3) or BC3 (n=4)
+ */
+unsigned long BCSize(int dx,int dy,int n)
+{
+   return (unsigned long)((dx+3)/4)*((dy+3)/4)*(n==4 ? 16 : 8);
+}
+
+//
+//  Copy 4x4 block as RGBA, repeating edge pixels past the image
+//
+static void Fetch(const image_t* img,int bx,int by,unsigned char px[16][4])
+{
+   int i,j;
+   for (j=0;j<4;j++)
+   {
+      int y = 4*by+j < img->dy ? 4*by+j : img->dy-1;
+      for (i=0;i<4;i++)
+      {
+         int x = 4*bx+i < img->dx ? 4*bx+i : img->dx-1;
+         const unsigned char* p = img->data + img->n*((size_t)y*img->dx+x);
+         px[4*j+i][0] = p[0];
+         px[4*j+i][1] = p[1];
+         px[4*j+i][2] = p[2];
+         px[4*j+i][3] = img->n==4 ? p[3] : 255;
+      }
+   }
+}
+
+//
+//  565 color conversion
+//
+static void Expand565(unsigned int c,int rgb[3])
+{
+   int r = (c>>11)&31;
+   int g = (c>>5)&63;
+   int b = c&31;
+   rgb[0] = (r<<3) | (r>>2);
+   rgb[1] = (g<<2) | (g>>4);
+   rgb[2] = (b<<3) | (b>>2);
+}
+static unsigned int Pack565(const float rgb[3])
+{
+   int r = (int)(rgb[0]*31/255+0.5);
+   int g = (int)(rgb[1]*63/255+0.5);
+   int b = (int)(rgb[2]*31/255+0.5);
+   r = r<0 ? 0 : r>31 ? 31 : r;
+   g = g<0 ? 0 : g>63 ? 63 : g;
+   b = b<0 ? 0 : b>31 ? 31 : b;
+   return (r<<11) | (g<<5) | b;
+}
+
+//
+//  Color palette of a block
+//    Four colors when c0>c1, otherwise three and black (BC1 only)
+//
+static void ColorPalette(unsigned int c0,unsigned int c1,int pal[4][3])
+{
+   int k;
+   Expand565(c0,pal[0]);
+   Expand565(c1,pal[1]);
+   for (k=0;k<3;k++)
+      if (c0>c1)
+      {
+         pal[2][k] = (2*pal[0][k]+pal[1][k])/3;
+         pal[3][k] = (pal[0][k]+2*pal[1][k])/3;
+      }
+      else
+      {
+         pal[2][k] = (pal[0][k]+pal[1][k])/2;
+         pal[3][k] = 0;
+      }
+}
+
+//
+//  Alpha palette of a block
+//    Eight values when a0>a1, otherwise six plus 0 and 255
+//
+static void AlphaPalette(int a0,int a1,int pal[8])
+{
+   int k;
+   pal[0] = a0;
+   pal[1] = a1;
+   if (a0>a1)
+      for (k=1;k<7;k++)
+         pal[k+1] = ((7-k)*a0+k*a1)/7;
+   else
+   {
+      for (k=1;k<5;k++)
+         pal[k+1] = ((5-k)*a0+k*a1)/5;
+      pal[6] = 0;
+      pal[7] = 255;
+   }
+}
+
+//
+//  Pick the nearest palette color for each pixel
+//    Returns the 32 bits of 2 bit indices
+//
+static unsigned int ColorIndices(const unsigned char px[16][4],const int pal[4][3])
+{
+   unsigned int bits=0;
+   int i,j,k;
+#if defined(__SSE2__)
+   //  Four pixels at a time, one float lane per pixel
+   for (i=0;i<16;i+=4)
+   {
+      __m128 c[3];
+      __m128i best = _mm_setzero_si128();
+      __m128  dmin = _mm_set1_ps(1e30f);
+      int idx[4];
+      for (k=0;k<3;k++)
+         c[k] = _mm_setr_ps(px[i][k],px[i+1][k],px[i+2][k],px[i+3][k]);
+      for (j=0;j<4;j++)
+      {
+         __m128 dr = _mm_sub_ps(c[0],_mm_set1_ps(pal[j][0]));
+         __m128 dg = _mm_sub_ps(c[1],_mm_set1_ps(pal[j][1]));
+         __m128 db = _mm_sub_ps(c[2],_mm_set1_ps(pal[j][2]));
+         __m128 d  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr,dr),_mm_mul_ps(dg,dg)),_mm_mul_ps(db,db));
+         __m128i m = _mm_castps_si128(_mm_cmplt_ps(d,dmin));
+         dmin = _mm_min_ps(d,dmin);
+         best = _mm_or_si128(_mm_and_si128(m,_mm_set1_epi32(j)),_mm_andnot_si128(m,best));
+      }
+      _mm_storeu_si128((__m128i*)idx,best);
+      for (k=0;k<4;k++)
+         bits |= idx[k] << (2*(i+k));
+   }
+#else
+   for (i=0;i<16;i++)
+   {
+      int best=0,dmin=1<<30;
+      for (j=0;j<4;j++)
+      {
+         int d=0;
+         for (k=0;k<3;k++)
+            d += (px[i][k]-pal[j][k])*(px[i][k]-pal[j][k]);
+         if (d<dmin)
+         {
+            dmin = d;
+            best = j;
+         }
+      }
+      bits |= best << (2*i);
+   }
+#endif
+   return bits;
+}
+
+//
+//  Write 8 byte color block for the given endpoints
+//    Endpoints are ordered for four color mode
+//
+static void EmitColor(const unsigned char px[16][4],unsigned int c0,unsigned int c1,unsigned char* out)
+{
+   int pal[4][3];
+   unsigned int bits=0;
+   if (c0<c1)
+   {
+      unsigned int t = c0;
+      c0 = c1;
+      c1 = t;
+   }
+   //  Equal endpoints would select three color mode, so use index 0 only
+   if (c0!=c1)
+   {
+      ColorPalette(c0,c1,pal);
+      bits = ColorIndices(px,pal);
+   }
+   out[0] = c0;
+   out[1] = c0>>8;
+   out[2] = c1;
+   out[3] = c1>>8;
+   out[4] = bits;
+   out[5] = bits>>8;
+   out[6] = bits>>16;
+   out[7] = bits>>24;
+}
+
+//
+//  Mean and principal axis of the block colors
+//
+static void Axis(const unsigned char px[16][4],float mean[3],float axis[3])
+{
+   float cov[6]={0,0,0,0,0,0};
+   int i,k;
+   for (k=0;k<3;k++)
+   {
+      mean[k] = 0;
+      for (i=0;i<16;i++)
+         mean[k] += px[i][k];
+      mean[k] /= 16;
+   }
+   for (i=0;i<16;i++)
+   {
+      float r = px[i][0]-mean[0];
+      float g = px[i][1]-mean[1];
+      float b = px[i][2]-mean[2];
+      cov[0] += r*r;
+      cov[1] += r*g;
+      cov[2] += r*b;
+      cov[3] += g*g;
+      cov[4] += g*b;
+      cov[5] += b*b;
+   }
+   //  Power iteration starting from the column of the channel that varies most
+   k = (cov[0]>=cov[3] && cov[0]>=cov[5]) ? 0 : cov[3]>=cov[5] ? 1 : 2;
+   axis[0] = k==0 ? cov[0] : k==1 ? cov[1] : cov[2];
+   axis[1] = k==0 ? cov[1] : k==1 ? cov[3] : cov[4];
+   axis[2] = k==0 ? cov[2] : k==1 ? cov[4] : cov[5];
+   if (cov[0]+cov[3]+cov[5]<1e-6) axis[0] = axis[1] = axis[2] = 1;
+   for (k=0;k<8;k++)
+   {
+      float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+      float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+      float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+      float m = fabs(x)>fabs(y) ? fabs(x) : fabs(y);
+      if (fabs(z)>m) m = fabs(z);
+      if (m<1e-6) break;
+      axis[0] = x/m;
+      axis[1] = y/m;
+      axis[2] = z/m;
+   }
+}
+
+//
+//  Range fit
+//    Endpoints at the extremes of the block along its principal axis
+//
+static void RangeFit(const unsigned char px[16][4],unsigned char* out)
+{
+   float mean[3],axis[3],e0[3],e1[3];
+   float tmin=1e30,tmax=-1e30,len;
+   int i,k;
+   Axis(px,mean,axis);
+   len = axis[0]*axis[0]+axis[1]*axis[1]+axis[2]*axis[2];
+   for (i=0;i<16;i++)
+   {
+      float t = ((px[i][0]-mean[0])*axis[0] + (px[i][1]-mean[1])*axis[1] + (px[i][2]-mean[2])*axis[2])/len;
+      if (t<tmin) tmin = t;
+      if (t>tmax) tmax = t;
+   }
+   for (k=0;k<3;k++)
+   {
+      e0[k] = mean[k] + tmax*axis[k];
+      e1[k] = mean[k] + tmin*axis[k];
+   }
+   EmitColor(px,Pack565(e0),Pack565(e1),out);
+}
+
+//
+//  Cluster fit
+//    Pixels are sorted along the principal axis.  For every split of the
+//    sorted pixels into four runs (weights 1, 2/3, 1/3, 0 on the first
+//    endpoint) the least squares endpoints are found, snapped to 565 and
+//    scored.  The best pair is kept.
+//
+static void ClusterFit(const unsigned char px[16][4],unsigned char* out)
+{
+   float mean[3],axis[3],t[16];
+   float sum[17][3];     //  Prefix sums of sorted colors
+   int order[16];
+   int i,j,k,c0,c1,c2;
+   float besterr=1e30;
+   unsigned int best0=0,best1=0;
+
+   //  Sort along axis
+   Axis(px,mean,axis);
+   for (i=0;i<16;i++)
+   {
+      t[i] = px[i][0]*axis[0] + px[i][1]*axis[1] + px[i][2]*axis[2];
+      for (j=i;j>0 && t[order[j-1]]<t[i];j--)
+         order[j] = order[j-1];
+      order[j] = i;
+   }
+   for (k=0;k<3;k++)
+      sum[0][k] = 0;
+   for (i=0;i<16;i++)
+      for (k=0;k<3;k++)
+         sum[i+1][k] = sum[i][k] + px[order[i]][k];
+
+   //  Runs are [0,c0) [c0,c1) [c1,c2) [c2,16)
+   for (c0=0;c0<=16;c0++)
+      for (c1=c0;c1<=16;c1++)
+         for (c2=c1;c2<=16;c2++)
+         {
+            float n1 = c1-c0, n2 = c2-c1;
+            float aa = c0 + n1*4/9 + n2/9;
+            float bb = (16-c2) + n1/9 + n2*4/9;
+            float ab = (n1+n2)*2/9;
+            float det = aa*bb - ab*ab;
+            float ax[3],bx[3],a[3],b[3],err=0;
+            unsigned int q0,q1;
+            int ea[3],eb[3];
+            if (det<1e-6) continue;
+            for (k=0;k<3;k++)
+            {
+               float s0 = sum[c0][k];
+               float s1 = sum[c1][k]-sum[c0][k];
+               float s2 = sum[c2][k]-sum[c1][k];
+               float s3 = sum[16][k]-sum[c2][k];
+               ax[k] = s0 + s1*2/3 + s2/3;
+               bx[k] = s3 + s1/3 + s2*2/3;
+               a[k] = (ax[k]*bb - bx[k]*ab)/det;
+               b[k] = (bx[k]*aa - ax[k]*ab)/det;
+            }
+            //  Score the endpoints as they will be stored
+            q0 = Pack565(a);
+            q1 = Pack565(b);
+            Expand565(q0,ea);
+            Expand565(q1,eb);
+            for (k=0;k<3;k++)
+               err += ea[k]*ea[k]*aa + eb[k]*eb[k]*bb + 2*ea[k]*eb[k]*ab - 2*ea[k]*ax[k] - 2*eb[k]*bx[k];
+            if (err<besterr)
+            {
+               besterr = err;
+               best0 = q0;
+               best1 = q1;
+            }
+         }
+   EmitColor(px,best0,best1,out);
+}
+
+//
+//  Alpha block
+//    Range fit uses the eight value mode between the extremes.  Cluster
+//    quality also tries the six value mode with explicit 0 and 255, which
+//    wins when the block mixes opaque and transparent pixels.
+//
+static void AlphaBlock(const unsigned char px[16][4],int quality,unsigned char* out)
+{
+   int mode,i,j;
+   int besterr=1<<30;
+   for (mode=0;mode<(quality==BC_CLUSTER ? 2 : 1);mode++)
+   {
+      int a0=0,a1=255,pal[8],err=0;
+      unsigned long long bits=0;
+      //  Extremes (six value mode ignores 0 and 255)
+      for (i=0;i<16;i++)
+      {
+         int a = px[i][3];
+         if (mode && (a==0 || a==255)) continue;
+         if (a>a0) a0 = a;
+         if (a<a1) a1 = a;
+      }
+      if (a0<a1) a0 = a1 = px[0][3];
+      //  Eight value mode needs a0>a1, six value mode a0<=a1
+      if (mode)
+      {
+         int t = a0;
+         a0 = a1;
+         a1 = t;
+      }
+      AlphaPalette(a0,a1,pal);
+      for (i=0;i<16;i++)
+      {
+         int best=0,dmin=1<<30;
+         for (j=0;j<8;j++)
+         {
+            int d = abs(px[i][3]-pal[j]);
+            if (d<dmin)
+            {
+               dmin = d;
+               best = j;
+            }
+         }
+         err += dmin*dmin;
+         bits |= (unsigned long long)best << (3*i);
+      }
+      if (err<besterr)
+      {
+         besterr = err;
+         out[0] = a0;
+         out[1] = a1;
+         for (i=0;i<6;i++)
+            out[2+i] = bits>>(8*i);
+      }
+   }
+}
+
+//  Encoder thread arguments
+typedef struct
+{
+   const image_t* img;
+   int quality;
+   int y0,y1;           //  Block rows to encode
+   unsigned char* out;  //  Output for the whole image
+} bcjob_t;
+
+//
+//  Encode a band of block rows
+//
+static void* EncodeRows(void* arg)
+{
+   bcjob_t* job = (bcjob_t*)arg;
+   const image_t* img = job->img;
+   int bw = (img->dx+3)/4;
+   int size = img->n==4 ? 16 : 8;
+   int bx,by;
+   for (by=job->y0;by<job->y1;by++)
+      for (bx=0;bx<bw;bx++)
+      {
+         unsigned char px[16][4];
+         unsigned char* out = job->out + ((size_t)by*bw+bx)*size;
+         Fetch(img,bx,by,px);
+         if (img->n==4)
+         {
+            AlphaBlock(px,job->quality,out);
+            out += 8;
+         }
+         if (job->quality==BC_CLUSTER)
+            ClusterFit(px,out);
+         else
+            RangeFit(px,out);
+      }
+   return NULL;
+}
+
+/*
+ *  Encode image as BC1 (RGB) or BC3 (RGBA)
+ *    quality is BC_RANGE or BC_CLUSTER
+ *    out must have room for BCSize(img->dx,img->dy,img->n) bytes
+ *    Returns the number of bytes written
+ */
+unsigned long EncodeBC(const image_t* img,int quality,unsigned char* out)
+{
+   bcjob_t   job[MAXENCODERS];
+   int bh = (img->dy+3)/4;
+   int bw = (img->dx+3)/4;
+   int n=1,k;
+   //  Threads only pay off for large images
+   if (bw*bh>=1024) n = Processors();
+   if (n>MAXENCODERS) n = MAXENCODERS;
+   if (n>bh) n = bh;
+   if (n<1) n = 1;
+   for (k=0;k<n;k++)
+   {
+      job[k].img = img;
+      job[k].quality = quality;
+      job[k].y0 = k*bh/n;
+      job[k].y1 = (k+1)*bh/n;
+      job[k].out = out;
+   }
+   Parallel(EncodeRows,job,sizeof(bcjob_t),n);
+   return BCSize(img->dx,img->dy,img->n);
+}
+
+/*
+ *  Decode BC1 (n=3) or BC3 (n=4) blocks
+ *    img has the dimensions and n set and room for the pixels
+ */
+void DecodeBC(const unsigned char* in,image_t* img)
+{
+   int bw = (img->dx+3)/4;
+   int bh = (img->dy+3)/4;
+   int bx,by,i;
+   for (by=0;by<bh;by++)
+      for (bx=0;bx<bw;bx++)
+      {
+         const unsigned char* blk = in + ((size_t)by*bw+bx)*(img->n==4 ? 16 : 8);
+         int alpha[16];
+         int pal[4][3];
+         unsigned int bits;
+         //  Alpha
+         for (i=0;i<16;i++)
+            alpha[i] = 255;
+         if (img->n==4)
+         {
+            int apal[8];
+            unsigned long long abits=0;
+            AlphaPalette(blk[0],blk[1],apal);
+            for (i=0;i<6;i++)
+               abits |= (unsigned long long)blk[2+i] << (8*i);
+            for (i=0;i<16;i++)
+               alpha[i] = apal[(abits>>(3*i))&7];
+            blk += 8;
+         }
+         //  Color
+         ColorPalette(blk[0]|(blk[1]<<8),blk[2]|(blk[3]<<8),pal);
+         bits = blk[4] | (blk[5]<<8) | (blk[6]<<16) | ((unsigned int)blk[7]<<24);
+         for (i=0;i<16;i++)
+         {
+            int x = 4*bx+(i&3);
+            int y = 4*by+(i>>2);
+            if (x<img->dx && y<img->dy)
+            {
+               unsigned char* p = img->data + img->n*((size_t)y*img->dx+x);
+               const int* c = pal[(bits>>(2*i))&3];
+               p[0] = c[0];
+               p[1] = c[1];
+               p[2] = c[2];
+               if (img->n==4) p[3] = alpha[i];
+            }
+         }
+      }
+}
+
+/*
+ *  Peak signal to noise ratio between two images of the same size in dB
+ */
+double ImagePSNR(const image_t* a,const image_t* b)
+{
+   size_t k,n = (size_t)a->dx*a->dy*a->n;
+   double err=0;
+   for (k=0;k<n;k++)
+      err += (double)(a->data[k]-b->data[k])*(a->data[k]-b->data[k]);
+   if (err==0) return 99;
+   return 10*log10(255.0*255.0*n/err);
+}
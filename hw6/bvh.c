@@ -0,0 +1,477 @@
+/*
+ *  Bounding volume hierarchy over the triangles of a mesh
+ *
+ *  The tree is built top down.  Each node is split where the surface area
+ *  heuristic is lowest, trying 16 bins of triangle centers along each axis,
+ *  and the two halves of large nodes are built on separate threads.  Nodes
+ *  are stored depth first in one array of 32 byte records: the left child
+ *  of an inner node follows it and only the right child is linked, so a
+ *  query mostly walks forward through memory.  The corners of the
+ *  triangles are copied in leaf order so a leaf reads one run of floats.
+ */
+#include "CSCIx229.h"
+
+#define BINS 16              //  Bins per axis for the surface area heuristic
+#define MAXLEAF 4            //  Most triangles in a leaf unless they cannot be split
+#define MAXDEPTH 64          //  Deepest node (and size of the query stack)
+#define MINPARALLEL 16384    //  Fewest triangles worth a thread
+
+//  Box
+typedef struct
+{
+   float min[3],max[3];
+} box_t;
+
+//  Triangles being sorted into the tree
+typedef struct
+{
+   const box_t* box;    //  Box of each triangle
+   const float* cen;    //  Center of each triangle box
+   int*  tri;           //  Triangles in tree order
+} tris_t;
+
+//  Nodes built by one thread
+typedef struct
+{
+   int n,M;             //  Nodes used and allocated
+   bvhnode_t* node;     //  Nodes
+} nodes_t;
+
+//  Subtree built on a thread
+typedef struct
+{
+   const tris_t* t;
+   nodes_t out;
+   int first,count,depth,threads;
+} subtree_t;
+
+//
+//  Empty box
+//
+static void Empty(box_t* b)
+{
+   int k;
+   for (k=0;k<3;k++)
+   {
+      b->min[k] = 1e30;
+      b->max[k] = -1e30;
+   }
+}
+
+//
+//  Grow box a to hold box b
+//
+static void Union(box_t* a,const box_t* b)
+{
+   int k;
+   for (k=0;k<3;k++)
+   {
+      if (b->min[k]<a->min[k]) a->min[k] = b->min[k];
+      if (b->max[k]>a->max[k]) a->max[k] = b->max[k];
+   }
+}
+
+//
+//  Half the surface area of a box
+//
+static float Area(const box_t* b)
+{
+   float dx = b->max[0]-b->min[0];
+   float dy = b->max[1]-b->min[1];
+   float dz = b->max[2]-b->min[2];
+   return dx<0 ? 0 : dx*dy+dy*dz+dz*dx;
+}
+
+//
+//  Add a node
+//
+static int AddNode(nodes_t* out)
+{
+   if (out->n==out->M)
+   {
+      out->M = out->M ? 2*out->M : 256;
+      out->node = (bvhnode_t*)realloc(out->node,out->M*sizeof(bvhnode_t));
+      if (!out->node) Fatal("Cannot allocate memory for BVH\n");
+   }
+   return out->n++;
+}
+
+//
+//  Append the nodes of a subtree
+//    Links to right children are moved by the offset of the subtree
+//
+static void AppendNodes(nodes_t* out,const nodes_t* sub)
+{
+   int k,off=out->n;
+   for (k=0;k<sub->n;k++)
+   {
+      int i = AddNode(out);
+      out->node[i] = sub->node[k];
+      if (!out->node[i].count) out->node[i].first += off;
+   }
+}
+
+static void* BuildThread(void* arg);
+
+//
+//  Build the subtree of count triangles from first
+//    threads is how many threads may work on it
+//    Returns the index of its root
+//
+static int Build(const tris_t* t,nodes_t* out,int first,int count,int depth,int threads)
+{
+   box_t box,cbox;
+   box_t bin[BINS],left[BINS];
+   int   nbin[BINS],nleft[BINS];
+   float best=1e30;
+   int   axis=-1,split=0;
+   int   i,k,a,mid;
+   int   idx = AddNode(out);
+
+   //  Bounds of the triangles and of their centers
+   Empty(&box);
+   Empty(&cbox);
+   for (i=first;i<first+count;i++)
+   {
+      const float* c = t->cen+3*t->tri[i];
+      box_t p = {{c[0],c[1],c[2]},{c[0],c[1],c[2]}};
+      Union(&box,t->box+t->tri[i]);
+      Union(&cbox,&p);
+   }
+   memcpy(out->node[idx].min,box.min,sizeof(box.min));
+   memcpy(out->node[idx].max,box.max,sizeof(box.max));
+   out->node[idx].first = first;
+   out->node[idx].count = count;
+   if (count<=2 || depth>=MAXDEPTH-1) return idx;
+
+   //  Cheapest split over the bins of each axis
+   for (a=0;a<3;a++)
+   {
+      float lo = cbox.min[a];
+      float ext = cbox.max[a]-lo;
+      box_t right;
+      int nright=0;
+      if (ext<=0) continue;
+      for (k=0;k<BINS;k++)
+      {
+         Empty(bin+k);
+         nbin[k] = 0;
+      }
+      for (i=first;i<first+count;i++)
+      {
+         int b = BINS*(t->cen[3*t->tri[i]+a]-lo)/ext;
+         if (b>=BINS) b = BINS-1;
+         Union(bin+b,t->box+t->tri[i]);
+         nbin[b]++;
+      }
+      //  Sweep from the left, then from the right pricing each split
+      Empty(left);
+      for (k=0;k<BINS-1;k++)
+      {
+         if (k) left[k] = left[k-1];
+         Union(left+k,bin+k);
+         nleft[k] = (k ? nleft[k-1] : 0) + nbin[k];
+      }
+      Empty(&right);
+      for (k=BINS-1;k>0;k--)
+      {
+         float cost;
+         Union(&right,bin+k);
+         nright += nbin[k];
+         if (!nleft[k-1] || !nright) continue;
+         cost = nleft[k-1]*Area(left+k-1) + nright*Area(&right);
+         if (cost<best)
+         {
+            best = cost;
+            axis = a;
+            split = k;
+         }
+      }
+   }
+   //  Keep small nodes whole when splitting does not pay
+   if (axis<0 || (count<=MAXLEAF && best>=(count-1)*Area(&box))) return idx;
+
+   //  Partition the triangles
+   for (i=first,mid=first+count;i<mid;)
+   {
+      float lo = cbox.min[axis];
+      int b = BINS*(t->cen[3*t->tri[i]+axis]-lo)/(cbox.max[axis]-lo);
+      if (b>=BINS) b = BINS-1;
+      if (b<split)
+         i++;
+      else
+      {
+         int x = t->tri[i];
+         t->tri[i] = t->tri[--mid];
+         t->tri[mid] = x;
+      }
+   }
+   out->node[idx].count = 0;
+
+   //  Build the halves on two threads
+   if (threads>1 && count>=2*MINPARALLEL)
+   {
+      subtree_t sub[2] = {{t,{0,0,NULL},first,mid-first,depth+1,threads/2},
+                          {t,{0,0,NULL},mid,first+count-mid,depth+1,threads-threads/2}};
+      Parallel(BuildThread,sub,sizeof(subtree_t),2);
+      AppendNodes(out,&sub[0].out);
+      out->node[idx].first = out->n;
+      AppendNodes(out,&sub[1].out);
+      free(sub[0].out.node);
+      free(sub[1].out.node);
+   }
+   //  Left child follows this node
+   else
+   {
+      Build(t,out,first,mid-first,depth+1,1);
+      k = Build(t,out,mid,first+count-mid,depth+1,1);
+      out->node[idx].first = k;
+   }
+   return idx;
+}
+
+//
+//  Build a subtree into its own nodes (thread)
+//
+static void* BuildThread(void* arg)
+{
+   subtree_t* sub = (subtree_t*)arg;
+   Build(sub->t,&sub->out,sub->first,sub->count,sub->depth,sub->threads);
+   return NULL;
+}
+
+/*
+ *  Build a bounding volume hierarchy over the triangles of a mesh
+ *    Triangle k is the one drawn by indexes 3k to 3k+2 of the full mesh
+ *    The tree keeps its own copy of the triangles, so it stays valid if
+ *    the mesh is freed
+ */
+void BuildBVH(const mesh_t* mesh,bvh_t* bvh)
+{
+   int i,k,n;
+   int threads;
+   box_t*  box;
+   float*  cen;
+   tris_t  t;
+   nodes_t out = {0,0,NULL};
+
+   memset(bvh,0,sizeof(bvh_t));
+   n = mesh->nind/3;
+   if (!n) return;
+   box = (box_t*)malloc(n*sizeof(box_t));
+   cen = (float*)malloc(3*sizeof(float)*n);
+   bvh->tri = (int*)malloc(n*sizeof(int));
+   bvh->pos = (float*)malloc(9*sizeof(float)*n);
+   if (!box || !cen || !bvh->tri || !bvh->pos) Fatal("Cannot allocate memory for BVH\n");
+   //  Box and center of each triangle
+   for (i=0;i<n;i++)
+   {
+      Empty(box+i);
+      for (k=0;k<3;k++)
+      {
+         const float* p = mesh->vert+8*mesh->ind[3*i+k];
+         box_t b = {{p[0],p[1],p[2]},{p[0],p[1],p[2]}};
+         Union(box+i,&b);
+      }
+      for (k=0;k<3;k++)
+         cen[3*i+k] = 0.5*(box[i].min[k]+box[i].max[k]);
+      bvh->tri[i] = i;
+   }
+   //  Build tree
+   threads = Processors();
+   if (threads>MAXTHREADS) threads = MAXTHREADS;
+   t.box = box;
+   t.cen = cen;
+   t.tri = bvh->tri;
+   Build(&t,&out,0,n,0,threads);
+   bvh->nnode = out.n;
+   bvh->node  = (bvhnode_t*)realloc(out.node,out.n*sizeof(bvhnode_t));
+   bvh->ntri  = n;
+   //  Copy triangle corners in leaf order
+   for (i=0;i<n;i++)
+      for (k=0;k<3;k++)
+         memcpy(bvh->pos+9*i+3*k,mesh->vert+8*mesh->ind[3*bvh->tri[i]+k],3*sizeof(float));
+   free(box);
+   free(cen);
+}
+
+/*
+ *  Free bounding volume hierarchy
+ */
+void FreeBVH(bvh_t* bvh)
+{
+   free(bvh->node);
+   free(bvh->tri);
+   free(bvh->pos);
+   memset(bvh,0,sizeof(bvh_t));
+}
+
+//
+//  Distance along a ray to a box
+//    inv is one over the direction
+//    Returns 0 if the ray misses the box before tmax
+//
+static int Slab(const bvhnode_t* n,const float org[3],const float inv[3],float tmax,float* t)
+{
+   float t0=0,t1=tmax;
+   int k;
+   for (k=0;k<3;k++)
+   {
+      float a = (n->min[k]-org[k])*inv[k];
+      float b = (n->max[k]-org[k])*inv[k];
+      if (a>b)
+      {
+         float x = a;
+         a = b;
+         b = x;
+      }
+      if (a>t0) t0 = a;
+      if (b<t1) t1 = b;
+      if (t0>t1) return 0;
+   }
+   *t = t0;
+   return 1;
+}
+
+//
+//  Intersect a ray and a triangle (Moller-Trumbore, both sides)
+//    Returns 1 and sets t, u and v if the hit is closer than *t
+//
+static int RayTriangle(const float* p,const float org[3],const float dir[3],float* t,float* u,float* v)
+{
+   float e1[3],e2[3],s[3],q[3],h[3];
+   float a,f,uu,vv,tt;
+   int k;
+   for (k=0;k<3;k++)
+   {
+      e1[k] = p[3+k]-p[k];
+      e2[k] = p[6+k]-p[k];
+      s[k]  = org[k]-p[k];
+   }
+   h[0] = dir[1]*e2[2]-dir[2]*e2[1];
+   h[1] = dir[2]*e2[0]-dir[0]*e2[2];
+   h[2] = dir[0]*e2[1]-dir[1]*e2[0];
+   a = e1[0]*h[0]+e1[1]*h[1]+e1[2]*h[2];
+   if (fabs(a)<1e-20) return 0;
+   f = 1/a;
+   uu = f*(s[0]*h[0]+s[1]*h[1]+s[2]*h[2]);
+   if (uu<0 || uu>1) return 0;
+   q[0] = s[1]*e1[2]-s[2]*e1[1];
+   q[1] = s[2]*e1[0]-s[0]*e1[2];
+   q[2] = s[0]*e1[1]-s[1]*e1[0];
+   vv = f*(dir[0]*q[0]+dir[1]*q[1]+dir[2]*q[2]);
+   if (vv<0 || uu+vv>1) return 0;
+   tt = f*(e2[0]*q[0]+e2[1]*q[1]+e2[2]*q[2]);
+   if (tt<0 || tt>=*t) return 0;
+   *t = tt;
+   *u = uu;
+   *v = vv;
+   return 1;
+}
+
+/*
+ *  Find the nearest triangle hit by a ray
+ *    The ray starts at org and goes along dir up to tmax times dir
+ *    Returns 1 and fills hit if a triangle is hit
+ */
+int BVHRay(const bvh_t* bvh,const float org[3],const float dir[3],float tmax,bvhhit_t* hit)
+{
+   int stack[MAXDEPTH];
+   int sp=0,n=0,found=0;
+   float inv[3],t;
+   int k;
+   if (!bvh->nnode) return 0;
+   for (k=0;k<3;k++)
+      inv[k] = dir[k] ? 1/dir[k] : (dir[k]<0 ? -1e30 : 1e30);
+   hit->t = tmax;
+   if (!Slab(bvh->node,org,inv,hit->t,&t)) return 0;
+   for (;;)
+   {
+      const bvhnode_t* node = bvh->node+n;
+      //  Leaf
+      if (node->count)
+      {
+         for (k=node->first;k<node->first+node->count;k++)
+            if (RayTriangle(bvh->pos+9*k,org,dir,&hit->t,&hit->u,&hit->v))
+            {
+               hit->tri = bvh->tri[k];
+               found = 1;
+            }
+      }
+      //  Visit the nearer child first
+      else
+      {
+         float tl,tr;
+         int l = n+1;
+         int r = node->first;
+         int hl = Slab(bvh->node+l,org,inv,hit->t,&tl);
+         int hr = Slab(bvh->node+r,org,inv,hit->t,&tr);
+         if (hl && hr)
+         {
+            stack[sp++] = tl<tr ? r : l;
+            n = tl<tr ? l : r;
+            continue;
+         }
+         else if (hl || hr)
+         {
+            n = hl ? l : r;
+            continue;
+         }
+      }
+      if (!sp) break;
+      n = stack[--sp];
+   }
+   return found;
+}
+
+//
+//  Check whether a node or triangle box overlaps a box
+//
+static int Overlap(const float* min,const float* max,const float lo[3],const float hi[3])
+{
+   return min[0]<=hi[0] && max[0]>=lo[0] &&
+          min[1]<=hi[1] && max[1]>=lo[1] &&
+          min[2]<=hi[2] && max[2]>=lo[2];
+}
+
+/*
+ *  Find the triangles whose bounding boxes overlap a box
+ *    Up to n triangles are stored in tri
+ *    Returns how many triangles there are, which may be more than n
+ */
+int BVHOverlap(const bvh_t* bvh,const float min[3],const float max[3],int tri[],int n)
+{
+   int stack[MAXDEPTH];
+   int sp=0,found=0;
+   if (!bvh->nnode) return 0;
+   stack[sp++] = 0;
+   while (sp)
+   {
+      const bvhnode_t* node = bvh->node+stack[--sp];
+      int k;
+      if (!Overlap(node->min,node->max,min,max)) continue;
+      //  Inner node
+      if (!node->count)
+      {
+         stack[sp++] = node->first;
+         stack[sp++] = node-bvh->node+1;
+         continue;
+      }
+      //  Leaf
+      for (k=node->first;k<node->first+node->count;k++)
+      {
+         const float* p = bvh->pos+9*k;
+         float lo[3],hi[3];
+         int i;
+         for (i=0;i<3;i++)
+         {
+            lo[i] = fmin(p[i],fmin(p[3+i],p[6+i]));
+            hi[i] = fmax(p[i],fmax(p[3+i],p[6+i]));
+         }
+         if (!Overlap(lo,hi,min,max)) continue;
+         if (found<n) tri[found] = bvh->tri[k];
+         found++;
+      }
+   }
+   return found;
+}
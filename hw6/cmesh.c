@@ -0,0 +1,512 @@
+/*
+ *  Binary mesh cache (.cmesh)
+ *
+ *  A .cmesh file holds a mesh built from an OBJ file with the vertexes and
+ *  indexes laid out as they are sent to OpenGL, so loading one costs little
+ *  more than mapping the file and handing the blocks to glBufferData.  The
+ *  OBJ loaders keep one next to each OBJ file (model.obj.cmesh) and use it
+ *  while the OBJ and MTL files it was built from keep their size and
+ *  modification time.  Integers are little endian.  Floats are IEEE single
+ *  precision in the byte order of the machine, which is little endian on
+ *  every machine this runs on.
+ *
+ *    offset  size  contents
+ *         0     4  magic "CMSH"
+ *         4     2  version (1)
+ *         6     2  flags (CMESH_OPTIMIZED, CMESH_NORMALS or CMESH_NORMALS_ALL,
+ *                  and the crease angle of the normals in bits 8-15)
+ *         8     2  attributes (MESH_NORMAL, MESH_TEXTURE)
+ *        10     2  bytes per index (2 or 4)
+ *        12     4  number of vertexes
+ *        16     4  number of indexes
+ *        20     4  number of face corners
+ *        24     4  number of draw ranges
+ *        28     4  number of materials
+ *        32     4  number of source files
+ *        36    24  bounding box (minimum then maximum xyz)
+ *        60     4  offset of vertexes
+ *        64     4  offset of indexes (meshes whose indexes would start past
+ *                  4 GB are not cached)
+ *        68        source files: size (8), modification time (8), name
+ *                  draw ranges: material, first index, number of indexes (4 each)
+ *                  materials: name, Ka, Kd, Ks (4 floats each), Ns, d, texture file
+ *
+ *  Names are a 2 byte length followed by the characters.  Vertexes (8
+ *  floats: position, normal and texture coordinates) and indexes start on
+ *  16 byte boundaries.
+ */
+#include "CSCIx229.h"
+#include <sys/stat.h>
+
+#define CMESH_VERSION 1
+#define CMESH_HEADER 68  //  Size of fixed part of header
+#define CMESH_ALIGN  16  //  Alignment of vertexes and indexes
+#define STRIDE (8*sizeof(float))  //  Bytes per vertex
+
+//  Growing buffer for the header
+typedef struct
+{
+   unsigned char* data;
+   size_t n,size;
+} buf_t;
+
+//
+//  Read little endian values from memory
+//
+static unsigned int Get16(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8);
+}
+static unsigned int Get32(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+static float GetF(const unsigned char* p)
+{
+   float f;
+   unsigned int u = Get32(p);
+   memcpy(&f,&u,4);
+   return f;
+}
+
+//
+//  Write little endian values to memory
+//
+static void Put16(unsigned char* p,unsigned int v)
+{
+   p[0] = v;
+   p[1] = v>>8;
+}
+static void Put32(unsigned char* p,unsigned int v)
+{
+   p[0] = v;
+   p[1] = v>>8;
+   p[2] = v>>16;
+   p[3] = v>>24;
+}
+static void PutF(unsigned char* p,float f)
+{
+   unsigned int u;
+   memcpy(&u,&f,4);
+   Put32(p,u);
+}
+
+//
+//  Make room for n more bytes at the end of a buffer
+//
+static unsigned char* Add(buf_t* buf,size_t n)
+{
+   if (buf->n+n>buf->size)
+   {
+      buf->size = 2*(buf->n+n);
+      buf->data = (unsigned char*)realloc(buf->data,buf->size);
+      if (!buf->data) Fatal("Cannot allocate memory for mesh cache\n");
+   }
+   buf->n += n;
+   return buf->data+buf->n-n;
+}
+
+//
+//  Append values to a buffer
+//
+static void Add32(buf_t* buf,unsigned int v)
+{
+   Put32(Add(buf,4),v);
+}
+static void AddF(buf_t* buf,const float* f,int n)
+{
+   int k;
+   for (k=0;k<n;k++)
+      PutF(Add(buf,4),f[k]);
+}
+static void AddStr(buf_t* buf,const char* s)
+{
+   size_t n = s ? strlen(s) : 0;
+   if (n>0xFFFF) n = 0xFFFF;
+   Put16(Add(buf,2),n);
+   memcpy(Add(buf,n),s,n);
+}
+
+//
+//  Read values from a mapping, checking that they are in the file
+//    Returns NULL if the file ends first
+//
+static const unsigned char* Take(const unsigned char** p,const unsigned char* end,size_t n)
+{
+   const unsigned char* q = *p;
+   if ((size_t)(end-q)<n) return NULL;
+   *p += n;
+   return q;
+}
+static char* TakeStr(const unsigned char** p,const unsigned char* end)
+{
+   const unsigned char* s = Take(p,end,2);
+   int n = s ? Get16(s) : 0;
+   char* str;
+   if (!s || !(s=Take(p,end,n))) return NULL;
+   str = (char*)malloc(n+1);
+   if (!str) Fatal("Cannot allocate memory for mesh cache\n");
+   memcpy(str,s,n);
+   str[n] = 0;
+   return str;
+}
+
+//
+//  Write padding to alignment
+//
+static unsigned long Pad(FILE* f,unsigned long pos)
+{
+   while (pos && pos%CMESH_ALIGN)
+      pos = fputc(0,f)==EOF ? 0 : pos+1;
+   return pos;
+}
+
+//
+//  Build the header of a .cmesh file
+//    Records the offsets the vertexes and indexes will be written at
+//    Returns the bytes per index, or 0 if the indexes would start past the
+//    4 GB the offsets can hold
+//
+static int Header(buf_t* hdr,const mesh_t* mesh,int flags,const char* src[],int nsrc)
+{
+   int k;
+   unsigned long long pos;
+   int isize = mesh->nvert<=65536 ? 2 : 4;
+
+   //  Fixed header
+   memset(Add(hdr,CMESH_HEADER),0,CMESH_HEADER);
+   memcpy(hdr->data,"CMSH",4);
+   Put16(hdr->data+4,CMESH_VERSION);
+   Put16(hdr->data+6,flags);
+   Put16(hdr->data+8,mesh->attr & ~MESH_TANGENT);  //  Tangents are not stored
+   Put16(hdr->data+10,isize);
+   Put32(hdr->data+12,mesh->nvert);
+   Put32(hdr->data+16,mesh->nind);
+   Put32(hdr->data+20,mesh->ncorner);
+   Put32(hdr->data+24,mesh->nrange);
+   Put32(hdr->data+28,mesh->nmtl);
+   Put32(hdr->data+32,nsrc);
+   for (k=0;k<3;k++)
+   {
+      PutF(hdr->data+36+4*k,mesh->min[k]);
+      PutF(hdr->data+48+4*k,mesh->max[k]);
+   }
+   //  Source files
+   for (k=0;k<nsrc;k++)
+   {
+      //  Missing files are recorded with zero size and time
+      struct stat st;
+      unsigned long long size=0,time=0;
+      if (!stat(src[k],&st))
+      {
+         size = st.st_size;
+         time = st.st_mtime;
+      }
+      Add32(hdr,size);
+      Add32(hdr,size>>32);
+      Add32(hdr,time);
+      Add32(hdr,time>>32);
+      AddStr(hdr,src[k]);
+   }
+   //  Draw ranges
+   for (k=0;k<mesh->nrange;k++)
+   {
+      Add32(hdr,mesh->range[k].mtl);
+      Add32(hdr,mesh->range[k].first);
+      Add32(hdr,mesh->range[k].count);
+   }
+   //  Materials
+   for (k=0;k<mesh->nmtl;k++)
+   {
+      const material_t* m = mesh->mtl+k;
+      AddStr(hdr,m->name);
+      AddF(hdr,m->Ka,4);
+      AddF(hdr,m->Kd,4);
+      AddF(hdr,m->Ks,4);
+      AddF(hdr,&m->Ns,1);
+      AddF(hdr,&m->d,1);
+      AddStr(hdr,m->file);
+   }
+   //  Offsets of vertexes and indexes
+   pos = (hdr->n+CMESH_ALIGN-1) & ~(CMESH_ALIGN-1);
+   Put32(hdr->data+60,pos);
+   pos = (pos+(unsigned long long)STRIDE*mesh->nvert+CMESH_ALIGN-1) & ~(CMESH_ALIGN-1);
+   if (pos>0xFFFFFFFF) return 0;
+   Put32(hdr->data+64,pos);
+   return isize;
+}
+
+//
+//  Write n indexes with isize bytes each
+//    pos is the file position so far (0 after an error)
+//
+static unsigned long WriteIndexes(FILE* f,unsigned long pos,const unsigned int ind[],int n,int isize)
+{
+   int k;
+   for (k=0;k<n && pos;k++)
+   {
+      unsigned char i[4];
+      if (isize==2)
+         Put16(i,ind[k]);
+      else
+         Put32(i,ind[k]);
+      if (fwrite(i,isize,1,f)!=1) pos = 0;
+   }
+   return pos ? pos+(unsigned long)isize*n : 0;
+}
+
+//
+//  Close a .cmesh file, removing it if it is incomplete
+//
+static unsigned long Close(FILE* f,const char* file,unsigned long pos)
+{
+   if (fclose(f) || !pos)
+   {
+      remove(file);
+      pos = 0;
+   }
+   return pos;
+}
+
+/*
+ *  Write mesh to a .cmesh file
+ *    flags are stored with the mesh and must match when it is loaded
+ *    src are the files the mesh was built from, which must be unchanged
+ *    when it is loaded
+ *    Returns the size of the file, or 0 if it could not be written (a
+ *    partial file is removed) or the mesh is too large for the format
+ */
+unsigned long WriteCMESH(const char* file,const mesh_t* mesh,int flags,const char* src[],int nsrc)
+{
+   unsigned long pos;
+   buf_t hdr = {NULL,0,0};
+   int isize = Header(&hdr,mesh,flags,src,nsrc);
+
+   //  Write header, vertexes and indexes
+   FILE* f = isize ? fopen(file,"wb") : NULL;
+   if (!f)
+   {
+      free(hdr.data);
+      return 0;
+   }
+   pos = fwrite(hdr.data,hdr.n,1,f)==1 ? hdr.n : 0;
+   pos = Pad(f,pos);
+   if (pos && mesh->nvert && fwrite(mesh->vert,STRIDE*mesh->nvert,1,f)!=1) pos = 0;
+   if (pos) pos += STRIDE*mesh->nvert;
+   pos = Pad(f,pos);
+   pos = WriteIndexes(f,pos,mesh->ind,mesh->nind,isize);
+   free(hdr.data);
+   return Close(f,file,pos);
+}
+
+/*
+ *  Write mesh to a .cmesh file with the vertexes and indexes read from files
+ *    The counts, ranges, materials and bounding box come from mesh, and
+ *    vert and ind hold mesh->nvert vertexes (8 floats) and mesh->nind
+ *    indexes (unsigned int) from their start
+ *    They are copied a block at a time, so a mesh larger than memory can
+ *    be written
+ *    Returns the size of the file, or 0 if it could not be written or the
+ *    mesh is too large for the format
+ */
+unsigned long WriteCMESHFiles(const char* file,const mesh_t* mesh,int flags,const char* src[],int nsrc,FILE* vert,FILE* ind)
+{
+   int n;
+   unsigned long pos;
+   float v[8*1024];
+   unsigned int i[4096];
+   buf_t hdr = {NULL,0,0};
+   int isize = Header(&hdr,mesh,flags,src,nsrc);
+
+   FILE* f = isize ? fopen(file,"wb") : NULL;
+   if (!f)
+   {
+      free(hdr.data);
+      return 0;
+   }
+   pos = fwrite(hdr.data,hdr.n,1,f)==1 ? hdr.n : 0;
+   pos = Pad(f,pos);
+   //  Vertexes
+   rewind(vert);
+   for (n=0;n<mesh->nvert && pos;)
+   {
+      int k = mesh->nvert-n<1024 ? mesh->nvert-n : 1024;
+      if (fread(v,STRIDE,k,vert)!=(size_t)k || fwrite(v,STRIDE,k,f)!=(size_t)k)
+         pos = 0;
+      else
+         pos += STRIDE*k;
+      n += k;
+   }
+   pos = Pad(f,pos);
+   //  Indexes
+   rewind(ind);
+   for (n=0;n<mesh->nind && pos;)
+   {
+      int k = mesh->nind-n<4096 ? mesh->nind-n : 4096;
+      pos = fread(i,sizeof(unsigned int),k,ind)==(size_t)k ? WriteIndexes(f,pos,i,k,isize) : 0;
+      n += k;
+   }
+   free(hdr.data);
+   return Close(f,file,pos);
+}
+
+//
+//  Check that the source files are unchanged
+//
+//    A file cut short is not valid either
+//
+static int SourcesValid(const unsigned char** p,const unsigned char* end,int nsrc)
+{
+   int k,ok=1;
+   for (k=0;k<nsrc && ok;k++)
+   {
+      struct stat st;
+      unsigned long long size,time;
+      const unsigned char* e = Take(p,end,16);
+      char* name = e ? TakeStr(p,end) : NULL;
+      if (!name) return 0;
+      size = Get32(e) | (unsigned long long)Get32(e+4)<<32;
+      time = Get32(e+8) | (unsigned long long)Get32(e+12)<<32;
+      //  A file that was missing must still be missing
+      if (stat(name,&st))
+         st.st_size = st.st_mtime = 0;
+      if ((unsigned long long)st.st_size!=size || (unsigned long long)st.st_mtime!=time) ok = 0;
+      free(name);
+   }
+   return ok;
+}
+
+//
+//  Give up on a stale or damaged file so the mesh is built again
+//
+static int Reject(mesh_t* mesh,const unsigned char* map,size_t len)
+{
+   FreeMesh(mesh);
+   UnmapFile(map,len);
+   return 0;
+}
+
+/*
+ *  Load mesh from a .cmesh file
+ *    Returns 0 if the file cannot be opened, is from another version, is
+ *    incomplete or damaged, its flags differ or a source file has changed
+ *    The vertex and index buffers are filled straight from the file mapping
+ *    Material textures are loaded with LoadTexBMP
+ */
+int LoadCMESH(const char* file,int flags,mesh_t* mesh)
+{
+   const unsigned char* map;   //  File contents
+   const unsigned char* end;   //  End of file
+   const unsigned char* p;     //  Current position
+   size_t len;                 //  File size
+   unsigned int voff,ioff;     //  Offsets of vertexes and indexes
+   int k,isize,nmtl;
+
+   //  Map file and check header
+   map = (const unsigned char*)MapFile(file,&len);
+   if (!map) return 0;
+   memset(mesh,0,sizeof(mesh_t));
+   if (len<CMESH_HEADER || memcmp(map,"CMSH",4) || Get16(map+4)!=CMESH_VERSION)
+      return Reject(mesh,map,len);
+   end = map+len;
+   p = map+CMESH_HEADER;
+   if ((int)Get16(map+6)!=flags || !SourcesValid(&p,end,Get32(map+32)))
+      return Reject(mesh,map,len);
+
+   //  Counts and bounding box
+   mesh->attr    = Get16(map+8);
+   isize         = Get16(map+10);
+   mesh->nvert   = Get32(map+12);
+   mesh->nind    = Get32(map+16);
+   mesh->ncorner = Get32(map+20);
+   mesh->nrange  = Get32(map+24);
+   nmtl          = Get32(map+28);
+   for (k=0;k<3;k++)
+   {
+      mesh->min[k] = GetF(map+36+4*k);
+      mesh->max[k] = GetF(map+48+4*k);
+   }
+   voff = Get32(map+60);
+   ioff = Get32(map+64);
+   //  A file cut short while it was written is built again
+   if ((isize!=2 && isize!=4) || mesh->nvert<0 || mesh->nind<0 || mesh->nrange<0 || nmtl<0 ||
+       voff>len || (len-voff)/STRIDE<(size_t)mesh->nvert || ioff>len || (len-ioff)/isize<(size_t)mesh->nind ||
+       (size_t)(end-p)/12<(size_t)mesh->nrange)
+      return Reject(mesh,map,len);
+
+   //  Draw ranges
+   mesh->range = (meshrange_t*)malloc(sizeof(meshrange_t)*(mesh->nrange+1));
+   if (!mesh->range) Fatal("Cannot allocate memory for mesh\n");
+   for (k=0;k<mesh->nrange;k++)
+   {
+      const unsigned char* r = Take(&p,end,12);
+      mesh->range[k].mtl   = (int)Get32(r);
+      mesh->range[k].first = Get32(r+4);
+      mesh->range[k].count = Get32(r+8);
+      if (mesh->range[k].mtl<-1 || mesh->range[k].mtl>=nmtl || mesh->range[k].first<0 || mesh->range[k].count<0 ||
+          mesh->range[k].first>mesh->nind-mesh->range[k].count)
+         return Reject(mesh,map,len);
+   }
+   //  Materials (counted as they are read so a damaged file frees just those)
+   mesh->mtl = (material_t*)calloc(nmtl+1,sizeof(material_t));
+   if (!mesh->mtl) Fatal("Cannot allocate memory for mesh\n");
+   for (k=0;k<nmtl;k++)
+   {
+      material_t* m = mesh->mtl+k;
+      const unsigned char* c;
+      int i;
+      m->name = TakeStr(&p,end);
+      mesh->nmtl++;
+      c = m->name ? Take(&p,end,56) : NULL;
+      m->file = c ? TakeStr(&p,end) : NULL;
+      if (!m->file) return Reject(mesh,map,len);
+      for (i=0;i<4;i++)
+      {
+         m->Ka[i] = GetF(c+4*i);
+         m->Kd[i] = GetF(c+16+4*i);
+         m->Ks[i] = GetF(c+32+4*i);
+      }
+      m->Ns = GetF(c+48);
+      m->d  = GetF(c+52);
+      if (*m->file)
+         m->map = LoadTexBMP(m->file);
+      else
+      {
+         free(m->file);
+         m->file = NULL;
+         m->map  = 0;
+      }
+   }
+
+   //  Copy vertexes and indexes to memory
+   mesh->vert = (float*)malloc(STRIDE*((size_t)mesh->nvert+1));
+   mesh->ind  = (unsigned int*)malloc(sizeof(unsigned int)*((size_t)mesh->nind+1));
+   if (!mesh->vert || !mesh->ind) Fatal("Cannot allocate memory for mesh\n");
+   memcpy(mesh->vert,map+voff,STRIDE*mesh->nvert);
+   for (k=0;k<mesh->nind;k++)
+   {
+      mesh->ind[k] = isize==2 ? Get16(map+ioff+2*k) : Get32(map+ioff+4*k);
+      if (mesh->ind[k]>=(unsigned int)mesh->nvert) return Reject(mesh,map,len);
+   }
+   MeshBounds(mesh);
+
+   //  Fill buffers from the mapping
+   ErrCheck("LoadCMESH");
+   if (mesh->nvert && mesh->nind)
+   {
+      glGenBuffers(1,&mesh->vbo);
+      glBindBuffer(GL_ARRAY_BUFFER,mesh->vbo);
+      glBufferData(GL_ARRAY_BUFFER,STRIDE*mesh->nvert,map+voff,GL_STATIC_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER,0);
+      glGenBuffers(1,&mesh->ibo);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh->ibo);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER,(size_t)isize*mesh->nind,map+ioff,GL_STATIC_DRAW);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+      mesh->isize = isize;
+   }
+   ErrCheck("LoadCMESH");
+
+   //  Release file
+   UnmapFile(map,len);
+   return 1;
+}
@@ -0,0 +1,382 @@
+/*
+ *  Pre-baked texture container (.ctex)
+ *
+ *  A .ctex file holds an image and its mipmap chain ready for upload, so
+ *  loading one costs little more than reading its bytes.  All values are
+ *  little endian.
+ *
+ *    offset  size  contents
+ *         0     4  magic "CTEX"
+ *         4     2  version (2)
+ *         6     2  pixel format (CTEX_RGB8, CTEX_RGBA8, CTEX_BC1 or CTEX_BC3)
+ *         8     4  width of level 0
+ *        12     4  height of level 0
+ *        16     2  number of levels n
+ *        18     2  codec of compressed levels (CTEX_RAW or CTEX_LZ4)
+ *        20     2  BC encoder quality (BC_RANGE or BC_CLUSTER, else BC_NONE)
+ *        22     2  mipmap filter of levels 1 and up (MIP_NONE for one level)
+ *        24  12*n  level table: offset, stored size and raw size
+ *
+ *  Version 1 files lack the quality and filter, so their level table starts
+ *  at offset 20.
+ *
+ *  Level data follows the table, each level starting on a 16 byte boundary.
+ *  Rows are tightly packed, bottom row first, as in image_t.  BC1 and BC3
+ *  levels hold 4x4 blocks in the same order.  A level whose stored size
+ *  equals its raw size is not LZ4 compressed and is uploaded straight from
+ *  the file mapping.
+ *
+ *  LoadTexBC() uses .ctex files as a disk cache for textures encoded as BC1
+ *  or BC3, since encoding costs far more than loading.
+ */
+#include "CSCIx229.h"
+#include <sys/stat.h>
+
+#define CTEX_VERSION 2
+#define CTEX_HEADER 24  //  Size of fixed part of header (20 in version 1)
+#define CTEX_ALIGN  16  //  Alignment of level data
+
+//
+//  Read little endian values from memory
+//
+static unsigned int Get16(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8);
+}
+static unsigned int Get32(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+
+//
+//  Write little endian values to memory
+//
+static void Put16(unsigned char* p,unsigned int v)
+{
+   p[0] = v;
+   p[1] = v>>8;
+}
+static void Put32(unsigned char* p,unsigned int v)
+{
+   p[0] = v;
+   p[1] = v>>8;
+   p[2] = v>>16;
+   p[3] = v>>24;
+}
+
+//
+//  Size of level data in a format
+//
+static unsigned long LevelSize(const image_t* img,int format)
+{
+   if (format==CTEX_BC1 || format==CTEX_BC3)
+      return BCSize(img->dx,img->dy,img->n);
+   return (unsigned long)img->n*img->dx*img->dy;
+}
+
+//
+//  Write mipmap chain to an open file
+//    Returns the size of the file or 0 on error
+//
+static unsigned long Write(FILE* f,const image_t levels[],int n,int format,int codec,int quality,int filter)
+{
+   int k;
+   unsigned char* hdr;        //  Header and level table
+   unsigned char* buf=NULL;   //  Compressed level
+   unsigned long  pos;        //  Current file position
+   int hlen = CTEX_HEADER+12*n;
+
+   hdr = (unsigned char*)calloc(hlen,1);
+   if (!hdr) return 0;
+   //  Fixed header
+   memcpy(hdr,"CTEX",4);
+   Put16(hdr+4,CTEX_VERSION);
+   Put16(hdr+6,format);
+   Put32(hdr+8,levels[0].dx);
+   Put32(hdr+12,levels[0].dy);
+   Put16(hdr+16,n);
+   Put16(hdr+18,codec);
+   Put16(hdr+20,quality);
+   Put16(hdr+22,n>1 ? filter : MIP_NONE);
+
+   //  Level data (table is written last)
+   pos = (hlen+CTEX_ALIGN-1) & ~(CTEX_ALIGN-1);
+   if (fseek(f,pos,SEEK_SET)) pos = 0;
+   for (k=0;k<n && pos;k++)
+   {
+      const unsigned char* data = levels[k].data;
+      int raw = LevelSize(levels+k,format);
+      int size = raw;
+      //  Keep compressed data only if it is smaller
+      if (codec==CTEX_LZ4)
+      {
+         buf = (unsigned char*)realloc(buf,raw);
+         if (!buf) Fatal("Cannot allocate memory for texture container\n");
+         size = LZ4Compress(buf,raw-1,data,raw);
+         if (size>0)
+            data = buf;
+         else
+            size = raw;
+      }
+      Put32(hdr+CTEX_HEADER+12*k,pos);
+      Put32(hdr+CTEX_HEADER+12*k+4,size);
+      Put32(hdr+CTEX_HEADER+12*k+8,raw);
+      if (fwrite(data,size,1,f)!=1) pos = 0;
+      pos += size;
+      //  Pad to alignment
+      while (pos && pos%CTEX_ALIGN)
+         pos = fputc(0,f)==EOF ? 0 : pos+1;
+   }
+   //  Header and level table
+   if (pos && (fseek(f,0,SEEK_SET) || fwrite(hdr,hlen,1,f)!=1)) pos = 0;
+   free(hdr);
+   free(buf);
+   return pos;
+}
+
+/*
+ *  Write mipmap chain to a .ctex file
+ *    levels are the images for levels 0 to n-1
+ *    format is CTEX_RGB8 or CTEX_RGBA8 for pixels, or CTEX_BC1 or CTEX_BC3
+ *    for blocks from EncodeBC (levels[k].n must still be 3 or 4)
+ *    codec is CTEX_RAW or CTEX_LZ4 (levels that do not shrink are stored raw)
+ *    quality is the EncodeBC quality of blocks (BC_NONE for pixels) and
+ *    filter the one that built the mipmaps, which are kept to tell how the
+ *    file was made
+ *    Returns the size of the file
+ */
+unsigned long WriteCTEX(const char* file,const image_t levels[],int n,int format,int codec,int quality,int filter)
+{
+   FILE* f;
+   unsigned long size;
+   if (n<1 || n>MAXMIP) Fatal("%s invalid number of levels %d\n",file,n);
+   if (levels[0].n!=((format==CTEX_RGBA8 || format==CTEX_BC3) ? 4 : 3))
+      Fatal("%s pixel size %d does not match format %d\n",file,levels[0].n,format);
+   f = fopen(file,"wb");
+   if (!f) Fatal("Cannot create file %s\n",file);
+   size = Write(f,levels,n,format,codec,quality,filter);
+   if (fclose(f) || !size) Fatal("Error writing %s\n",file);
+   return size;
+}
+
+//
+//  Size of the fixed header of a .ctex file
+//
+static size_t HeaderSize(const unsigned char* map)
+{
+   return Get16(map+4)==1 ? 20 : CTEX_HEADER;
+}
+
+//
+//  Check the header and level table of a mapped .ctex file
+//    Sets the size of each level (not its data)
+//    Returns the number of levels, or 0 with the reason in err
+//
+static int CheckCTEX(const char* file,const unsigned char* map,size_t len,image_t levels[],char* err)
+{
+   unsigned int dx,dy;
+   int k,n,fmt,codec,ver;
+   size_t hlen;
+   if (len<20 || memcmp(map,"CTEX",4)) return ImageError(err,"Image magic not CTEX in %s\n",file);
+   ver = Get16(map+4);
+   if (ver<1 || ver>CTEX_VERSION) return ImageError(err,"%s unsupported CTEX version %d\n",file,ver);
+   hlen  = HeaderSize(map);
+   fmt   = Get16(map+6);
+   dx    = Get32(map+8);
+   dy    = Get32(map+12);
+   n     = Get16(map+16);
+   codec = Get16(map+18);
+   if (fmt<CTEX_RGB8 || fmt>CTEX_BC3) return ImageError(err,"%s unsupported CTEX format %d\n",file,fmt);
+   if (dx<1 || dx>0x7FFFFFF/4 || dy<1 || dy>0x7FFFFFF/dx) return ImageError(err,"%s image size %ux%u out of range\n",file,dx,dy);
+   if (n<1 || n>MAXMIP || len<hlen+12*(size_t)n) return ImageError(err,"%s invalid number of levels %d\n",file,n);
+   if (codec!=CTEX_RAW && codec!=CTEX_LZ4) return ImageError(err,"%s unsupported CTEX codec %d\n",file,codec);
+   for (k=0;k<n;k++)
+   {
+      const unsigned char* e = map+hlen+12*k;
+      unsigned int off  = Get32(e);
+      unsigned int size = Get32(e+4);
+      unsigned int raw  = Get32(e+8);
+      levels[k].dx = k ? (levels[k-1].dx>1 ? levels[k-1].dx/2 : 1) : (int)dx;
+      levels[k].dy = k ? (levels[k-1].dy>1 ? levels[k-1].dy/2 : 1) : (int)dy;
+      levels[k].n  = (fmt==CTEX_RGBA8 || fmt==CTEX_BC3) ? 4 : 3;
+      if (raw!=LevelSize(levels+k,fmt) || off>len || size>len-off || size>raw || (size<raw && codec!=CTEX_LZ4))
+         return ImageError(err,"%s level %d is damaged\n",file,k);
+   }
+   return n;
+}
+
+/*
+ *  Copy .ctex file to texture
+ *    Arguments and return value as for TexImage
+ */
+unsigned int TexImageCTEX(const char* file,unsigned int texture,unsigned long* bytes)
+{
+   const unsigned char* map;   //  File contents
+   size_t         len;         //  File size
+   size_t         hlen;        //  Header size
+   image_t        levels[MAXMIP];
+   unsigned char* buf=NULL;    //  Decompressed levels
+   size_t         nbuf=0;      //  Size of buf
+   int            n,fmt;
+   int            k;
+   char           err[IMGERR]; //  Error message
+
+   //  Map file and check it
+   map = (const unsigned char*)MapFile(file,&len);
+   if (!map) Fatal("Cannot open file %s\n",file);
+   n = CheckCTEX(file,map,len,levels,err);
+   if (!n) Fatal("%s",err);
+   hlen = HeaderSize(map);
+   fmt  = Get16(map+6);
+
+   //  Size the buffer for compressed levels
+   for (k=0;k<n;k++)
+   {
+      const unsigned char* e = map+hlen+12*k;
+      if (Get32(e+4)<Get32(e+8)) nbuf += Get32(e+8);
+   }
+   if (nbuf)
+   {
+      buf = (unsigned char*)malloc(nbuf);
+      if (!buf) Fatal("Cannot allocate %lu bytes of memory for image %s\n",(unsigned long)nbuf,file);
+   }
+   //  Point levels at the mapping or decompress them
+   nbuf = 0;
+   for (k=0;k<n;k++)
+   {
+      const unsigned char* e = map+hlen+12*k;
+      unsigned int off  = Get32(e);
+      unsigned int size = Get32(e+4);
+      unsigned int raw  = Get32(e+8);
+      if (size==raw)
+         levels[k].data = (unsigned char*)(map+off);
+      else
+      {
+         levels[k].data = buf+nbuf;
+         if (LZ4Decompress(levels[k].data,raw,map+off,size)!=(int)raw) Fatal("%s level %d is damaged\n",file,k);
+         nbuf += raw;
+      }
+   }
+
+   //  Blocks go to OpenGL as they are
+   if (fmt==CTEX_BC1 || fmt==CTEX_BC3)
+      texture = TexImageBC(file,levels,n,texture,bytes);
+   //  A single level still gets mipmaps if they are selected
+   else if (n==1)
+      texture = TexImage(file,levels,texture,bytes);
+   else
+      texture = TexImageMip(file,levels,n,texture,bytes);
+
+   //  Release file
+   free(buf);
+   UnmapFile(map,len);
+   return texture;
+}
+
+/*
+ *  Load texture from a .ctex file
+ *    Uncompressed levels go to OpenGL straight from the file mapping
+ *    Textures already loaded are returned from the texture cache
+ */
+unsigned int LoadTexCTEX(const char* file)
+{
+   unsigned int  texture;  // Texture name
+   unsigned long bytes;    // Texture size
+
+   //  Return cached texture if the file was loaded before
+   texture = TexCacheFind(file);
+   if (texture) return texture;
+   texture = TexImageCTEX(file,0,&bytes);
+   //  Remember texture
+   TexCacheAdd(file,texture,bytes);
+   return texture;
+}
+
+//
+//  Check that a disk cache file is usable for an image file
+//    It must be newer than the image, undamaged, and encoded with the
+//    quality and mipmap filter now selected
+//    Damaged files (say from a crash while writing) are encoded again
+//
+static int CacheValid(const char* file,const char* cache,int quality)
+{
+   struct stat sf,sc;
+   const unsigned char* map;
+   image_t levels[MAXMIP];
+   char err[IMGERR];
+   size_t len;
+   int n,ok;
+   int filter = TexMipmapFilter();
+   if (stat(file,&sf) || stat(cache,&sc) || sc.st_mtime<sf.st_mtime) return 0;
+   map = (const unsigned char*)MapFile(cache,&len);
+   if (!map) return 0;
+   n  = CheckCTEX(cache,map,len,levels,err);
+   ok = n && Get16(map+4)==CTEX_VERSION && (Get16(map+6)==CTEX_BC1 || Get16(map+6)==CTEX_BC3) &&
+        (int)Get16(map+20)==quality;
+   //  One level without mipmaps, otherwise a full chain from the same filter
+   if (ok && filter==MIP_NONE)
+      ok = n==1;
+   else if (ok)
+      ok = levels[n-1].dx==1 && levels[n-1].dy==1 && (int)Get16(map+22)==(n>1 ? filter : MIP_NONE);
+   UnmapFile(map,len);
+   return ok;
+}
+
+/*
+ *  Load texture from a BMP or PNG file encoded as BC1 or BC3
+ *    Used by the loaders when selected with TexCompress.  The encoded
+ *    texture is kept in file.ctex next to the file and used instead of
+ *    encoding the file again while it is up to date.
+ *    texture and bytes as for TexImage (the texture cache is not used)
+ */
+unsigned int LoadTexBC(const char* file,unsigned int texture,unsigned long* bytes)
+{
+   image_t img;
+   image_t levels[MAXMIP];
+   image_t bc[MAXMIP];
+   unsigned char* buf;
+   unsigned long size=0;
+   int k,n;
+   int quality = TexCompressMode()==BC_NONE ? BC_RANGE : TexCompressMode();
+   FILE* f;
+   char* cache = (char*)malloc(strlen(file)+6);
+   if (!cache) Fatal("Cannot allocate memory for %s\n",file);
+   sprintf(cache,"%s.ctex",file);
+
+   //  Use the cached copy
+   if (CacheValid(file,cache,quality))
+   {
+      texture = TexImageCTEX(cache,texture,bytes);
+      free(cache);
+      return texture;
+   }
+
+   //  Decode image, build mipmaps and encode
+   ReadImage(file,&img);
+   n = TexMipmapFilter()==MIP_NONE ? 1 : BuildMipmaps(&img,TexMipmapFilter(),levels);
+   if (n==1) levels[0] = img;
+   for (k=0;k<n;k++)
+      size += BCSize(levels[k].dx,levels[k].dy,levels[k].n);
+   buf = (unsigned char*)malloc(size);
+   if (!buf) Fatal("Cannot allocate memory for image %s\n",file);
+   for (size=0,k=0;k<n;k++)
+   {
+      bc[k] = levels[k];
+      bc[k].data = buf+size;
+      size += EncodeBC(levels+k,quality,bc[k].data);
+   }
+   FreeMipmaps(levels,n);
+   free(img.data);
+
+   //  Save for next time (failing to do so only costs time)
+   f = fopen(cache,"wb");
+   if (f)
+   {
+      size = Write(f,bc,n,img.n==4 ? CTEX_BC3 : CTEX_BC1,CTEX_RAW,quality,TexMipmapFilter());
+      if (fclose(f) || !size) remove(cache);
+   }
+   texture = TexImageBC(file,bc,n,texture,bytes);
+   free(buf);
+   free(cache);
+   return texture;
+}
@@ -0,0 +1,171 @@
+/*
+ *  Convert BMP and PNG images to pre-baked texture containers (.ctex)
+ *
+ *  Usage: ctexconv [-z] [-c range|cluster] [-m none|box|kaiser|lanczos] [-o dir] file|dir ...
+ *    -z  compress levels with LZ4
+ *    -c  encode levels as BC1 (RGB) or BC3 (RGBA) with the range fit or the
+ *        slower, better cluster fit; reports PSNR and encoding speed
+ *    -m  mipmap filter (default box)
+ *    -o  write output to dir (default next to each input)
+ *  Directories are searched for .bmp and .png files.  Each input foo.bmp or
+ *  foo.png is written as foo.ctex.
+ */
+#include "CSCIx229.h"
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <ctype.h>
+
+//  Conversion options
+static int   codec=CTEX_RAW;
+static int   bc=BC_NONE;
+static int   filter=MIP_BOX;
+static char* outdir=NULL;
+
+//
+//  Check file name extension (ignoring case)
+//
+static int HasExt(const char* file,const char* ext)
+{
+   int n = strlen(file);
+   int m = strlen(ext);
+   int k;
+   if (n<m) return 0;
+   for (k=0;k<m;k++)
+      if (tolower((unsigned char)file[n-m+k])!=ext[k]) return 0;
+   return 1;
+}
+
+//
+//  Convert one file
+//
+static void Convert(const char* file)
+{
+   image_t levels[MAXMIP];
+   const char* base;
+   char* out;
+   int n;
+   unsigned long size;
+
+   //  Output name: input name (or its base name in outdir) with .ctex
+   base = outdir ? strrchr(file,'/') : NULL;
+   base = base ? base+1 : file;
+   out = (char*)malloc((outdir ? strlen(outdir)+1 : 0) + strlen(base) + 6);
+   if (!out) Fatal("Cannot allocate memory for %s\n",file);
+   if (outdir)
+      sprintf(out,"%s/%s",outdir,base);
+   else
+      strcpy(out,base);
+   if (strrchr(out,'.') && strrchr(out,'.')>strrchr(out,'/'))
+      *strrchr(out,'.') = 0;
+   strcat(out,".ctex");
+
+   //  Read image and build mipmaps
+   ReadImage(file,levels);
+   n = filter==MIP_NONE ? 1 : BuildMipmaps(levels,filter,levels);
+   if (bc==BC_NONE)
+      size = WriteCTEX(out,levels,n,levels[0].n==4 ? CTEX_RGBA8 : CTEX_RGB8,codec,BC_NONE,filter);
+   else
+   {
+      image_t blocks[MAXMIP];
+      image_t dec;
+      unsigned char* buf;
+      unsigned long  len=0,pix=0;  //  Bytes out and in
+      struct timeval t0,t1;
+      double t;
+      int k;
+      for (k=0;k<n;k++)
+         len += BCSize(levels[k].dx,levels[k].dy,levels[k].n);
+      buf = (unsigned char*)malloc(len);
+      dec = levels[0];
+      dec.data = (unsigned char*)malloc(dec.n*dec.dx*dec.dy);
+      if (!buf || !dec.data) Fatal("Cannot allocate memory for %s\n",file);
+      //  Encode all levels
+      gettimeofday(&t0,NULL);
+      for (len=0,k=0;k<n;k++)
+      {
+         blocks[k] = levels[k];
+         blocks[k].data = buf+len;
+         len += EncodeBC(levels+k,bc,blocks[k].data);
+         pix += levels[k].n*levels[k].dx*levels[k].dy;
+      }
+      gettimeofday(&t1,NULL);
+      t = t1.tv_sec-t0.tv_sec + 1e-6*(t1.tv_usec-t0.tv_usec);
+      size = WriteCTEX(out,blocks,n,levels[0].n==4 ? CTEX_BC3 : CTEX_BC1,codec,bc,filter);
+      //  Quality of level 0
+      DecodeBC(blocks[0].data,&dec);
+      printf("%s BC%d PSNR %.2f dB, %.1f MB/s\n",file,levels[0].n==4 ? 3 : 1,ImagePSNR(levels,&dec),t>0 ? 1e-6*pix/t : 0);
+      free(dec.data);
+      free(buf);
+   }
+   printf("%s -> %s %dx%d %d levels %lu bytes\n",file,out,levels[0].dx,levels[0].dy,n,size);
+   FreeMipmaps(levels,n);
+   free(levels[0].data);
+   free(out);
+}
+
+//
+//  Convert a file or all BMP and PNG files in a directory
+//
+static void ConvertPath(const char* path)
+{
+   struct stat st;
+   DIR* dir;
+   struct dirent* ent;
+
+   if (stat(path,&st)) Fatal("Cannot open %s\n",path);
+   if (!S_ISDIR(st.st_mode))
+   {
+      Convert(path);
+      return;
+   }
+   dir = opendir(path);
+   if (!dir) Fatal("Cannot open directory %s\n",path);
+   while ((ent = readdir(dir)))
+      if (HasExt(ent->d_name,".bmp") || HasExt(ent->d_name,".png"))
+      {
+         char* file = (char*)malloc(strlen(path)+strlen(ent->d_name)+2);
+         if (!file) Fatal("Cannot allocate memory for %s\n",path);
+         sprintf(file,"%s/%s",path,ent->d_name);
+         Convert(file);
+         free(file);
+      }
+   closedir(dir);
+}
+
+//
+//  Main program
+//
+int main(int argc,char* argv[])
+{
+   int k;
+   for (k=1;k<argc && argv[k][0]=='-';k++)
+   {
+      if (!strcmp(argv[k],"-z"))
+         codec = CTEX_LZ4;
+      else if (!strcmp(argv[k],"-c") && k+1<argc)
+      {
+         const char* c = argv[++k];
+         if (!strcmp(c,"range"))        bc = BC_RANGE;
+         else if (!strcmp(c,"cluster")) bc = BC_CLUSTER;
+         else Fatal("Unknown block compression %s\n",c);
+      }
+      else if (!strcmp(argv[k],"-m") && k+1<argc)
+      {
+         const char* m = argv[++k];
+         if (!strcmp(m,"none"))         filter = MIP_NONE;
+         else if (!strcmp(m,"box"))     filter = MIP_BOX;
+         else if (!strcmp(m,"kaiser"))  filter = MIP_KAISER;
+         else if (!strcmp(m,"lanczos")) filter = MIP_LANCZOS;
+         else Fatal("Unknown mipmap filter %s\n",m);
+      }
+      else if (!strcmp(argv[k],"-o") && k+1<argc)
+         outdir = argv[++k];
+      else
+         Fatal("Unknown option %s\n",argv[k]);
+   }
+   if (k==argc) Fatal("Usage: %s [-z] [-c range|cluster] [-m none|box|kaiser|lanczos] [-o dir] file|dir ...\n",argv[0]);
+   for (;k<argc;k++)
+      ConvertPath(argv[k]);
+   return 0;
+}
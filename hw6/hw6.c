@@ -126,20 +126,6 @@ void ErrCheck(const char* where)
    if (err) fprintf(stderr,"ERROR: %s [%s]\n",gluErrorString(err),where);
 }
 
-/*
- *  Draw vertex in polar coordinates
- */
-static void Vertex(double th,double ph)
-{
-   double x = Sin(th)*Cos(ph);
-   double y = Cos(th)*Cos(ph);
-   double z =         Sin(ph);
-   //  For a sphere at the origin, the position
-   //  and normal vectors are the same
-   glNormal3d(x,y,z);
-   glVertex3d(x,y,z);
-}
-
 /*
  *  Draw a cube with color space 0 ~ 255 from (r, g, b) and texture
  *     at (x,y,z)
@@ -173,7 +159,7 @@ static void cube_color_texture(double x,double y,double z,
    glEnable(GL_TEXTURE_2D);
    glTexEnvi(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,texture_mode?GL_REPLACE:GL_MODULATE);
    glColor3f(1,1,1);
-   glBindTexture(GL_TEXTURE_2D,texture);
+   TexBind(texture);
 
    //scale color into 255 color space
    double sr = r / 255, sg = g / 255, sb = b / 255;
@@ -181,7 +167,7 @@ static void cube_color_texture(double x,double y,double z,
    // glBegin(GL_QUADS);
    //  Front
    glColor3d(sr, sg, sb);
-   if (ntex) glBindTexture(GL_TEXTURE_2D,texture);
+   if (ntex) TexBind(texture);
    glBegin(GL_QUADS);
    glNormal3f( 0, 0, 1);
    glTexCoord2f(0,0); glVertex3f(-1,-1, 1);
@@ -191,7 +177,7 @@ static void cube_color_texture(double x,double y,double z,
    glEnd();
    //  Back
    glColor3d(sr, sg, sb);
-   if (ntex) glBindTexture(GL_TEXTURE_2D,texture);
+   if (ntex) TexBind(texture);
    glBegin(GL_QUADS);
    glNormal3f( 0, 0, -1);
    glTexCoord2f(0,0); glVertex3f(+1,-1,-1);
@@ -201,7 +187,7 @@ static void cube_color_texture(double x,double y,double z,
    glEnd();
    //  Right
    glColor3d(sr, sg, sb);
-   if (ntex) glBindTexture(GL_TEXTURE_2D,texture);
+   if (ntex) TexBind(texture);
    glBegin(GL_QUADS);
    glNormal3f( 1, 0, 0);
    glTexCoord2f(0,0); glVertex3f(+1,-1,+1);
@@ -211,7 +197,7 @@ static void cube_color_texture(double x,double y,double z,
    glEnd();
    //  Left
    glColor3d(sr, sg, sb);
-   if (ntex) glBindTexture(GL_TEXTURE_2D,texture);
+   if (ntex) TexBind(texture);
    glBegin(GL_QUADS);
    glNormal3f(-1, 0, 0);
    glTexCoord2f(0,0); glVertex3f(-1,-1,-1);
@@ -221,7 +207,7 @@ static void cube_color_texture(double x,double y,double z,
    glEnd();
    //  Top
    glColor3d(sr, sg, sb);
-   if (ntex) glBindTexture(GL_TEXTURE_2D,texture);
+   if (ntex) TexBind(texture);
    glBegin(GL_QUADS);
    glNormal3f( 0, 1, 0);
    glTexCoord2f(0,0); glVertex3f(-1,+1,+1);
@@ -231,7 +217,7 @@ static void cube_color_texture(double x,double y,double z,
    glEnd();
    //  Bottom
    glColor3d(sr, sg, sb);
-   if (ntex) glBindTexture(GL_TEXTURE_2D,texture);
+   if (ntex) TexBind(texture);
    glBegin(GL_QUADS);
    glNormal3f( 0, -1, 0);
    glTexCoord2f(0,0); glVertex3f(-1,-1,-1);
@@ -252,47 +238,7 @@ static void cube_color_texture(double x,double y,double z,
  */
 static void sphere(double x,double y,double z,double r)
 {
-   const int d=5;
-   int th,ph;
-
-   //  Save transformation
-   glPushMatrix();
-   //  Offset and scale
-   glTranslated(x,y,z);
-   glScaled(r,r,r);
-
-   //  South pole cap
-   glBegin(GL_TRIANGLE_FAN);
-   Vertex(0,-90);
-   for (th=0;th<=360;th+=d)
-   {
-      Vertex(th,d-90);
-   }
-   glEnd();
-
-   //  Latitude bands
-   for (ph=d-90;ph<=90-2*d;ph+=d)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (th=0;th<=360;th+=d)
-      {
-         Vertex(th,ph);
-         Vertex(th,ph+d);
-      }
-      glEnd();
-   }
-
-   //  North pole cap
-   glBegin(GL_TRIANGLE_FAN);
-   Vertex(0,90);
-   for (th=0;th<=360;th+=d)
-   {
-      Vertex(th,90-d);
-   }
-   glEnd();
-
-   //  Undo transformations
-   glPopMatrix();
+   DrawSphere(x,y,z,r,5,5,0);
 }
 
 /*
@@ -303,16 +249,18 @@ static void sphere(double x,double y,double z,double r)
  *     rotated theta about the y axis
  *     rotated psi about the z axis
  */
+//  Megaman textures packed into one atlas
+enum {t_metal_blue, t_metal_grey, t_face, t_blue, t_red};
+static const char* body_files[] = {"metal_blue.bmp","metal_grey.bmp","face.bmp","blue.bmp","red.bmp"};
+static atlas_t body_atlas;
+
 static void build_body_texture(double x,double y,double z,
                  double dx,double dy,double dz,
                  double phi, double theta, double psi)
 {
-
-    unsigned int t_metal_blue = LoadTexBMP("metal_blue.bmp"),
-	t_metal_grey = LoadTexBMP("metal_grey.bmp"),
-	t_face = LoadTexBMP("face.bmp"),
-	t_blue = LoadTexBMP("blue.bmp"),
-	t_red = LoadTexBMP("red.bmp");
+   //  Build the atlas the first time through
+   if (!body_atlas.npage)
+      BuildAtlas(&body_atlas,body_files,5,256,4);
    //  Set specular color to white
    float white[] = {1,1,1,1};
    float Emission[]  = {0.0,0.0,0.01*emission,1.0};
@@ -332,11 +280,11 @@ static void build_body_texture(double x,double y,double z,
    glEnable(GL_TEXTURE_2D);
    glTexEnvi(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,texture_mode?GL_REPLACE:GL_MODULATE);
    glColor3f(1,1,1);
-   glBindTexture(GL_TEXTURE_2D,t_face);
+   AtlasBind(&body_atlas,t_face);
 
    //  Head Cube
    //  Front
-   glBindTexture(GL_TEXTURE_2D,t_face);
+   AtlasBind(&body_atlas,t_face);
    glBegin(GL_QUADS);
    glNormal3f( 0, 0, 1);
    glTexCoord2f(0,0); glVertex3f(-1,-1, 1);
@@ -345,7 +293,7 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(0,1); glVertex3f(-1,+1, 1);
    glEnd();
    //  Back
-   glBindTexture(GL_TEXTURE_2D,t_metal_blue);
+   AtlasBind(&body_atlas,t_metal_blue);
    glBegin(GL_QUADS);
    glNormal3f( 0, 0, -1);
    glTexCoord2f(0,0); glVertex3f(+1,-1,-1);
@@ -370,7 +318,7 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(0,1); glVertex3f(-1,+1,-1);
    glEnd();
    //  Top
-   glBindTexture(GL_TEXTURE_2D,t_metal_grey);
+   AtlasBind(&body_atlas,t_metal_grey);
    glBegin(GL_QUADS);
    glNormal3f( 0, 1, 0);
    glTexCoord2f(0,0); glVertex3f(-1,+1,+1);
@@ -379,7 +327,7 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(0,1); glVertex3f(-1,+1,-1);
    glEnd();
    //  Bottom
-   glBindTexture(GL_TEXTURE_2D,t_metal_grey);
+   AtlasBind(&body_atlas,t_metal_grey);
    glBegin(GL_QUADS);
    glNormal3f( 0, -1, 0);
    glTexCoord2f(0,0); glVertex3f(-1,-1,-1);
@@ -392,7 +340,7 @@ static void build_body_texture(double x,double y,double z,
 
    // draw helmet
    //  Left helmet bottom
-   glBindTexture(GL_TEXTURE_2D,t_metal_blue);
+   AtlasBind(&body_atlas,t_metal_blue);
    glBegin(GL_TRIANGLES);
    glNormal3f(-1, -1, 0);
    glTexCoord2f(0,0); glVertex3f(-1,-1,-1);
@@ -420,11 +368,11 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(1,1); glVertex3f(-1,+1,-1);
    glTexCoord2f(0,1); glVertex3f(-2,0,0);
    glEnd();
-   glBindTexture(GL_TEXTURE_2D,t_red);
+   AtlasBind(&body_atlas,t_red);
    sphere(-1.8, 0, 0, 0.2);
 
    //  Right helmet bottom
-   glBindTexture(GL_TEXTURE_2D,t_metal_blue);
+   AtlasBind(&body_atlas,t_metal_blue);
    glBegin(GL_TRIANGLES);
    glNormal3f(1, -1, 0);
    glTexCoord2f(0,0); glVertex3f(1,-1,-1);
@@ -452,12 +400,12 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(1,1); glVertex3f(1,+1,-1);
    glTexCoord2f(0,1); glVertex3f(2,0,0);
    glEnd();
-   glBindTexture(GL_TEXTURE_2D,t_red);
+   AtlasBind(&body_atlas,t_red);
    sphere(1.8, 0, 0, 0.2);
 
    // top helmet
    //  Front
-   glBindTexture(GL_TEXTURE_2D,t_metal_blue);
+   AtlasBind(&body_atlas,t_metal_blue);
    glBegin(GL_QUADS);
    glNormal3f( 0, 0, 1);
    glTexCoord2f(1,1); glVertex3f(+1,+1, 1);
@@ -511,7 +459,7 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(0,1); glVertex3f(0,2.5,-0.01);
    glEnd();
    // top front star
-   glBindTexture(GL_TEXTURE_2D,t_blue);
+   AtlasBind(&body_atlas,t_blue);
    glBegin(GL_TRIANGLES);
    glNormal3f(0, 1, 1);
    glTexCoord2f(1,0); glVertex3f(0,1.5,+1);
@@ -540,7 +488,7 @@ static void build_body_texture(double x,double y,double z,
    
    //body
    //  Front
-   glBindTexture(GL_TEXTURE_2D,t_metal_grey);
+   AtlasBind(&body_atlas,t_metal_grey);
    glBegin(GL_QUADS);
    glNormal3f( 0, 0, 1);
    glTexCoord2f(0,0); glVertex3f(-0.5,-1, 0.5);
@@ -573,7 +521,7 @@ static void build_body_texture(double x,double y,double z,
    glTexCoord2f(0,1); glVertex3f(-0.5,-1, 0.5);
    glEnd();
    //underwear
-   glBindTexture(GL_TEXTURE_2D,t_blue);
+   AtlasBind(&body_atlas,t_blue);
    //underwear front
    glBegin(GL_TRIANGLES);
    glNormal3f( 0, -1, 1);
@@ -604,7 +552,7 @@ static void build_body_texture(double x,double y,double z,
    glEnd();
 
    //left arm
-   glBindTexture(GL_TEXTURE_2D,t_blue);
+   AtlasBind(&body_atlas,t_blue);
    //left front arm
    glBegin(GL_QUADS);
    glNormal3f(0, 0, 1);
@@ -648,7 +596,7 @@ static void build_body_texture(double x,double y,double z,
    sphere(-2, -1.5, 0, 0.3);
 
    //right arm
-   glBindTexture(GL_TEXTURE_2D,t_blue);
+   AtlasBind(&body_atlas,t_blue);
    //right front arm
    glBegin(GL_QUADS);
    glNormal3f(0, 0, 1);
@@ -692,7 +640,7 @@ static void build_body_texture(double x,double y,double z,
    sphere(2, -1.5, 0, 0.3);
 
    //left leg
-   glBindTexture(GL_TEXTURE_2D,t_metal_blue);
+   AtlasBind(&body_atlas,t_metal_blue);
    //left front leg
    glBegin(GL_TRIANGLES);
    glNormal3f(0, 1.75, 1);
@@ -771,6 +719,7 @@ static void build_body_texture(double x,double y,double z,
    //  end of body
    //  Undo transformations
    glPopMatrix();
+   AtlasUnbind();
    glDisable(GL_TEXTURE_2D);
 }
 
@@ -902,32 +851,15 @@ static void background()
  */
 static void ball(double x,double y,double z,double r)
 {
-   int th,ph;
    float yellow[] = {1.0,1.0,0.0,1.0};
    float Emission[]  = {0.0,0.0,0.01*emission,1.0};
-   //  Save transformation
-   glPushMatrix();
-   //  Offset, scale and rotate
-   glTranslated(x,y,z);
-   glScaled(r,r,r);
    //  White ball
    glColor3f(1,1,1);
    glMaterialf(GL_FRONT,GL_SHININESS,shiny);
    glMaterialfv(GL_FRONT,GL_SPECULAR,yellow);
    glMaterialfv(GL_FRONT,GL_EMISSION,Emission);
-   //  Bands of latitude
-   for (ph=-90;ph<90;ph+=inc)
-   {
-      glBegin(GL_QUAD_STRIP);
-      for (th=0;th<=360;th+=2*inc)
-      {
-         Vertex(th,ph);
-         Vertex(th,ph+inc);
-      }
-      glEnd();
-   }
-   //  Undo transofrmations
-   glPopMatrix();
+   //  Bands of latitude inc degrees apart
+   DrawSphere(x,y,z,r,2*inc,inc,0);
 }
 
 
@@ -937,6 +869,8 @@ static void ball(double x,double y,double z,double r)
 void display()
 {
    const double len=1.5;  //  Length of axes
+   //  Upload textures that finished loading (keep drawing until all are in)
+   if (TexUploadPending(256*1024)) glutPostRedisplay();
    //  Erase the window and the depth buffer
    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
    //  Enable Z-buffering in OpenGL
@@ -1232,6 +1166,16 @@ int main(int argc,char* argv[])
    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
    //  Create the window
    glutCreateWindow("Bo Cao CSCI-5229 Computer Graphics Assignment 6");
+#ifdef USEGLEW
+   //  Initialize GLEW for the buffer object entry points
+   if (glewInit()!=GLEW_OK) Fatal("Error initializing GLEW\n");
+#endif
+   //  Build mipmaps so distant textures do not alias
+   TexMipmap(MIP_BOX);
+   //  Load textures in the background
+   LoadTexBMPAsync("metal_grey.bmp",NULL);
+   LoadTexBMPAsync("boulder.bmp",NULL);
+   LoadTexBMPAsync("ground.bmp",NULL);
    //  Tell GLUT to call "idle" when there is nothing else to do
    glutIdleFunc(idle);
    //  Tell GLUT to call "display" when the scene should be drawn
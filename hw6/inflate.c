@@ -0,0 +1,326 @@
+/*
+ *  Inflate (RFC 1951 deflate decompression)
+ *
+ *  Decodes a raw deflate stream into a buffer whose size is known up front,
+ *  as it is for PNG images.  Huffman codes of up to FASTBITS bits are
+ *  decoded with a single table lookup, longer codes with a short search.
+ *  Every length and distance is checked, so damaged data fails cleanly.
+ *
+ *  Nothing here calls OpenGL or keeps state between calls, so it is safe to
+ *  use from loader threads.
+ */
+#include "CSCIx229.h"
+
+#define FASTBITS 9                 //  Bits decoded by table lookup
+#define FASTMASK ((1<<FASTBITS)-1)
+
+//  Huffman decoding table
+typedef struct
+{
+   unsigned short fast[1<<FASTBITS];  //  Length<<9 | symbol for short codes (0 if longer)
+   unsigned short first[17];          //  First code of each length
+   unsigned short firstsym[17];       //  Index of first symbol of each length
+   int            maxcode[17];        //  Codes of each length are below this (left aligned)
+   unsigned char  size[288];          //  Length of each sorted symbol
+   unsigned short value[288];         //  Sorted symbols
+} huff_t;
+
+//  Stream state
+typedef struct
+{
+   const unsigned char* in;   //  Next input byte
+   const unsigned char* end;  //  End of input
+   unsigned long long bits;   //  Bit buffer (next bit is bit 0)
+   int nbits;                 //  Bits in buffer
+   int pad;                   //  Zero bytes added past the end of input
+   unsigned char* out;        //  Next output byte
+   unsigned char* beg;        //  Start of output
+   unsigned char* oend;       //  End of output
+} stream_t;
+
+//  Length and distance codes
+static const unsigned short lbase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const unsigned char lextra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const unsigned short dbase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+static const unsigned char dextra[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+//
+//  Reverse the low n bits
+//
+static int Reverse(int code,int n)
+{
+   int r=0;
+   while (n--)
+   {
+      r = (r<<1) | (code&1);
+      code >>= 1;
+   }
+   return r;
+}
+
+//
+//  Build decoding table from code lengths
+//    Returns 0 on success or -1 if the lengths do not form a valid code
+//
+static int Build(huff_t* h,const unsigned char* len,int n)
+{
+   int i,k,code;
+   int count[17],next[16];
+   memset(h->fast,0,sizeof(h->fast));
+   memset(count,0,sizeof(count));
+   for (i=0;i<n;i++)
+      count[len[i]]++;
+   count[0] = 0;
+   //  First code and symbol of each length
+   code = k = 0;
+   for (i=1;i<16;i++)
+   {
+      next[i] = code;
+      h->first[i] = code;
+      h->firstsym[i] = k;
+      code += count[i];
+      if (count[i] && code>(1<<i)) return -1;
+      h->maxcode[i] = code << (16-i);
+      code <<= 1;
+      k += count[i];
+   }
+   h->maxcode[16] = 0x10000;
+   //  Sort symbols by code and fill lookup table
+   for (i=0;i<n;i++)
+   {
+      int s = len[i];
+      if (s)
+      {
+         int c = next[s] - h->first[s] + h->firstsym[s];
+         h->size[c]  = s;
+         h->value[c] = i;
+         if (s<=FASTBITS)
+         {
+            int j;
+            for (j=Reverse(next[s],s);j<(1<<FASTBITS);j+=(1<<s))
+               h->fast[j] = (s<<9) | i;
+         }
+         next[s]++;
+      }
+   }
+   return 0;
+}
+
+//
+//  Top up the bit buffer
+//    Past the end of input zeros are added, which Inflate treats as an error
+//    once they are actually used
+//
+static void Refill(stream_t* z)
+{
+   while (z->nbits<=56)
+   {
+      if (z->in<z->end)
+         z->bits |= (unsigned long long)*z->in++ << z->nbits;
+      else
+         z->pad++;
+      z->nbits += 8;
+   }
+}
+
+//
+//  Read n bits (n<=32)
+//
+static unsigned int Bits(stream_t* z,int n)
+{
+   unsigned int v;
+   if (z->nbits<n) Refill(z);
+   v = z->bits & ((1ull<<n)-1);
+   z->bits >>= n;
+   z->nbits -= n;
+   return v;
+}
+
+//
+//  Decode one symbol
+//    Returns -1 for codes not in the table
+//
+static int Decode(stream_t* z,const huff_t* h)
+{
+   int b,s,k;
+   if (z->nbits<16) Refill(z);
+   b = h->fast[z->bits & FASTMASK];
+   if (b)
+   {
+      s = b>>9;
+      z->bits >>= s;
+      z->nbits -= s;
+      return b & 511;
+   }
+   //  Longer codes are compared left aligned
+   k = Reverse(z->bits & 0xFFFF,16);
+   for (s=FASTBITS+1;k>=h->maxcode[s];s++);
+   if (s==16) return -1;
+   b = (k>>(16-s)) - h->first[s] + h->firstsym[s];
+   if (b>=288 || h->size[b]!=s) return -1;
+   z->bits >>= s;
+   z->nbits -= s;
+   return h->value[b];
+}
+
+//
+//  Decode a block of Huffman coded data
+//
+static int Codes(stream_t* z,const huff_t* lit,const huff_t* dist)
+{
+   while (1)
+   {
+      int len,d;
+      int sym = Decode(z,lit);
+      if (sym<256)
+      {
+         if (sym<0 || z->out==z->oend) return -1;
+         *z->out++ = sym;
+         continue;
+      }
+      if (sym==256) return z->pad>8 ? -1 : 0;
+      //  Length and distance
+      sym -= 257;
+      if (sym>=29) return -1;
+      len = lbase[sym] + Bits(z,lextra[sym]);
+      sym = Decode(z,dist);
+      if (sym<0 || sym>=30) return -1;
+      d = dbase[sym] + Bits(z,dextra[sym]);
+      if (d>z->out-z->beg || len>z->oend-z->out || z->pad>8) return -1;
+      //  Copy earlier output (overlapping copies repeat the last d bytes)
+      if (d==1)
+         memset(z->out,z->out[-1],len);
+      else if (d>=len)
+         memcpy(z->out,z->out-d,len);
+      else
+      {
+         int k;
+         for (k=0;k<len;k++)
+            z->out[k] = z->out[k-d];
+      }
+      z->out += len;
+   }
+}
+
+//
+//  Stored (uncompressed) block
+//
+static int Stored(stream_t* z)
+{
+   unsigned int len,nlen;
+   //  Skip to byte boundary
+   Bits(z,z->nbits&7);
+   len  = Bits(z,16);
+   nlen = Bits(z,16);
+   if ((len^0xFFFF)!=nlen || len>z->oend-z->out) return -1;
+   //  Hand bytes still in the bit buffer back to the input
+   if (z->pad>z->nbits/8) return -1;
+   z->in -= z->nbits/8 - z->pad;
+   z->bits  = 0;
+   z->nbits = 0;
+   z->pad   = 0;
+   if (len>z->end-z->in) return -1;
+   memcpy(z->out,z->in,len);
+   z->out += len;
+   z->in  += len;
+   return 0;
+}
+
+//
+//  Fixed Huffman codes
+//
+static int Fixed(stream_t* z)
+{
+   huff_t lit,dist;
+   unsigned char len[288];
+   int k;
+   for (k=0;k<144;k++) len[k] = 8;
+   for (;k<256;k++)    len[k] = 9;
+   for (;k<280;k++)    len[k] = 7;
+   for (;k<288;k++)    len[k] = 8;
+   Build(&lit,len,288);
+   for (k=0;k<30;k++) len[k] = 5;
+   Build(&dist,len,30);
+   return Codes(z,&lit,&dist);
+}
+
+//
+//  Dynamic Huffman codes
+//
+static int Dynamic(stream_t* z)
+{
+   static const unsigned char order[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+   huff_t lit,dist,clen;
+   unsigned char len[286+30];
+   unsigned char clens[19];
+   int k,n=0;
+   int hlit  = Bits(z,5)+257;
+   int hdist = Bits(z,5)+1;
+   int hclen = Bits(z,4)+4;
+   if (hlit>286 || hdist>30) return -1;
+   //  Code length code
+   memset(clens,0,sizeof(clens));
+   for (k=0;k<hclen;k++)
+      clens[order[k]] = Bits(z,3);
+   if (Build(&clen,clens,19)) return -1;
+   //  Literal/length and distance code lengths
+   while (n<hlit+hdist)
+   {
+      int c = Decode(z,&clen);
+      int r;
+      unsigned char v=0;
+      if (c<0 || z->pad>8) return -1;
+      if (c<16)
+      {
+         len[n++] = c;
+         continue;
+      }
+      if (c==16)
+      {
+         if (!n) return -1;
+         v = len[n-1];
+         r = Bits(z,2)+3;
+      }
+      else if (c==17)
+         r = Bits(z,3)+3;
+      else
+         r = Bits(z,7)+11;
+      if (n+r>hlit+hdist) return -1;
+      memset(len+n,v,r);
+      n += r;
+   }
+   if (Build(&lit,len,hlit) || Build(&dist,len+hlit,hdist)) return -1;
+   return Codes(z,&lit,&dist);
+}
+
+/*
+ *  Decompress raw deflate data
+ *    src is n bytes of deflate data, dst has room for cap bytes
+ *    Returns the decompressed size or -1 if the data is damaged
+ */
+long Inflate(unsigned char* dst,size_t cap,const unsigned char* src,size_t n)
+{
+   stream_t z;
+   int final;
+   z.in    = src;
+   z.end   = src+n;
+   z.bits  = 0;
+   z.nbits = 0;
+   z.pad   = 0;
+   z.out   = z.beg = dst;
+   z.oend  = dst+cap;
+   do
+   {
+      int err;
+      final = Bits(&z,1);
+      switch (Bits(&z,2))
+      {
+         case 0:  err = Stored(&z);  break;
+         case 1:  err = Fixed(&z);   break;
+         case 2:  err = Dynamic(&z); break;
+         default: err = -1;
+      }
+      if (err) return -1;
+   } while (!final);
+   return z.out-z.beg;
+}
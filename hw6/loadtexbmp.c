@@ -19,85 +19,285 @@ static void Reverse(void* x,const int n)
 }
 
 /*
- *  Load texture from BMP file
+ *  Read little endian values from memory
  */
-unsigned int LoadTexBMP(const char* file)
+static unsigned int Get16(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8);
+}
+static unsigned int Get32(const unsigned char* p)
+{
+   return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+
+/*
+ *  Check image parameters
+ *    Returns 0 and sets err if the image cannot be used
+ */
+static int CheckBMP(const char* file,unsigned int dx,unsigned int dy,
+                    unsigned short nbp,unsigned short bpp,unsigned int k,char* err)
+{
+   if (nbp!=1) return ImageError(err,"%s bit planes is not 1: %d\n",file,nbp);
+   if (bpp!=24 && bpp!=32) return ImageError(err,"%s bits per pixel is not 24 or 32: %d\n",file,bpp);
+   //  Limit the size so the image fits in memory without overflow (no GL
+   //  query since this may run on a worker thread)
+   if (dx<1 || dx>0x7FFFFFF/4) return ImageError(err,"%s image width %u out of range\n",file,dx);
+   if (dy<1 || dy>0x7FFFFFF/dx) return ImageError(err,"%s image height %u out of range\n",file,dy);
+   //  32 bit files may give color masks (BI_BITFIELDS)
+   if (k!=0 && !(k==3 && bpp==32)) return ImageError(err,"%s compressed files not supported\n",file);
+#ifndef GL_VERSION_2_0
+   //  OpenGL 2.0 lifts the restriction that texture size must be a power of two
+   for (k=1;k<dx;k*=2);
+   if (k!=dx) return ImageError(err,"%s image width not a power of two: %d\n",file,dx);
+   for (k=1;k<dy;k*=2);
+   if (k!=dy) return ImageError(err,"%s image height not a power of two: %d\n",file,dy);
+#endif
+   return 1;
+}
+
+/*
+ *  Load texture from a memory mapped BMP file
+ *    The pixel rows are handed to OpenGL straight from the mapping as BGR,
+ *    so the image is never copied or swizzled.  Mipmaps are built from the
+ *    mapping in BGR order too, which needs rows without padding.
+ *    Returns 0 if the file cannot be handled this way
+ */
+static unsigned int LoadTexBMPMap(const char* file,unsigned long* bytes)
 {
    unsigned int   texture;    // Texture name
+   const unsigned char* map;  // File contents
+   size_t         len;        // File size
+   unsigned int   dx,dy;      // Image dimensions
+   unsigned int   off;        // Image offset
+   unsigned int   row;        // Bytes per row including padding
+   image_t        levels[MAXMIP]; // Image and mipmaps
+   int            n=1;        // Number of levels
+   char           err[IMGERR]; // Error message
+
+   //  Map file
+   map = (const unsigned char*)MapFile(file,&len);
+   if (!map) return 0;
+   //  Only little endian BMP files are decoded here
+   if (len<34 || map[0]!='B' || map[1]!='M')
+   {
+      UnmapFile(map,len);
+      return 0;
+   }
+   //  Check header
+   off = Get32(map+10);
+   dx  = Get32(map+18);
+   dy  = Get32(map+22);
+   //  Only bottom up 24 bit images can be used as they are
+   if (Get16(map+28)!=24 || (int)dy<0)
+   {
+      UnmapFile(map,len);
+      return 0;
+   }
+   if (!CheckBMP(file,dx,dy,Get16(map+26),Get16(map+28),Get32(map+30),err)) Fatal("%s",err);
+   //  Rows are padded to a multiple of 4 bytes
+   row = (3*dx+3) & ~3;
+   if (off>len || (len-off)/row<dy-1 || len-off-(size_t)row*(dy-1)<3*dx ||
+       (TexMipmapFilter()!=MIP_NONE && row!=3*dx))
+   {
+      UnmapFile(map,len);
+      return 0;
+   }
+
+   //  Build mipmaps from the file (the filters do not care about the order
+   //  of the colors)
+   levels[0].dx   = dx;
+   levels[0].dy   = dy;
+   levels[0].n    = 3;
+   levels[0].data = (unsigned char*)(map+off);
+   if (TexMipmapFilter()!=MIP_NONE)
+      n = BuildMipmaps(levels,TexMipmapFilter(),levels);
+   //  Copy image straight from the file
+   texture = TexImageMipBGR(file,levels,n,4,0,bytes);
+   FreeMipmaps(levels,n);
+
+   //  Release file
+   UnmapFile(map,len);
+   return texture;
+}
+
+/*
+ *  Decode BMP file into memory as RGB
+ *    32 bit files are read as RGBA if they have an alpha mask
+ *    Handles files written on big endian hardware and top down files
+ *    Returns 0 and sets err (IMGERR bytes) if the file cannot be read
+ *    Makes no OpenGL calls so it may be used from any thread
+ */
+int DecodeBMP(const char* file,image_t* img,char* err)
+{
    FILE*          f;          // File pointer
    unsigned short magic;      // Image magic
-   unsigned int   dx,dy,size; // Image dimensions
+   unsigned int   hsize;      // Header size
+   unsigned int   dx,dy;      // Image dimensions
+   size_t         size;       // Image bytes
    unsigned short nbp,bpp;    // Planes and bits per pixel
+   unsigned int   mask[4]={0x00FF0000,0x0000FF00,0x000000FF,0}; // Color masks (RGBA)
    unsigned char* image;      // Image data
    unsigned int   off;        // Image offset
+   size_t         row;        // Bytes per row including padding
+   int            top=0;      // Rows stored top to bottom
+   int            n=3;        // Bytes per pixel in memory
    unsigned int   k;          // Counter
-   int            max;        // Maximum texture dimensions
 
    //  Open file
    f = fopen(file,"rb");
-   if (!f) Fatal("Cannot open file %s\n",file);
+   if (!f) return ImageError(err,"Cannot open file %s\n",file);
    //  Check image magic
-   if (fread(&magic,2,1,f)!=1) Fatal("Cannot read magic from %s\n",file);
-   if (magic!=0x4D42 && magic!=0x424D) Fatal("Image magic not BMP in %s\n",file);
+   if (fread(&magic,2,1,f)!=1)
+   {
+      fclose(f);
+      return ImageError(err,"Cannot read magic from %s\n",file);
+   }
+   if (magic!=0x4D42 && magic!=0x424D)
+   {
+      fclose(f);
+      return ImageError(err,"Image magic not BMP in %s\n",file);
+   }
    //  Read header
-   if (fseek(f,8,SEEK_CUR) || fread(&off,4,1,f)!=1 ||
-       fseek(f,4,SEEK_CUR) || fread(&dx,4,1,f)!=1 || fread(&dy,4,1,f)!=1 ||
+   if (fseek(f,8,SEEK_CUR) || fread(&off,4,1,f)!=1 || fread(&hsize,4,1,f)!=1 ||
+       fread(&dx,4,1,f)!=1 || fread(&dy,4,1,f)!=1 ||
        fread(&nbp,2,1,f)!=1 || fread(&bpp,2,1,f)!=1 || fread(&k,4,1,f)!=1)
-     Fatal("Cannot read header from %s\n",file);
+   {
+      fclose(f);
+      return ImageError(err,"Cannot read header from %s\n",file);
+   }
    //  Reverse bytes on big endian hardware (detected by backwards magic)
    if (magic==0x424D)
    {
       Reverse(&off,4);
+      Reverse(&hsize,4);
       Reverse(&dx,4);
       Reverse(&dy,4);
       Reverse(&nbp,2);
       Reverse(&bpp,2);
       Reverse(&k,4);
    }
+   //  Negative height means rows are stored top to bottom
+   if ((int)dy<0)
+   {
+      top = 1;
+      dy = -(int)dy;
+   }
    //  Check image parameters
-   glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max);
-   if (dx<1 || dx>max) Fatal("%s image width %d out of range 1-%d\n",file,dx,max);
-   if (dy<1 || dy>max) Fatal("%s image height %d out of range 1-%d\n",file,dy,max);
-   if (nbp!=1)  Fatal("%s bit planes is not 1: %d\n",file,nbp);
-   if (bpp!=24) Fatal("%s bits per pixel is not 24: %d\n",file,bpp);
-   if (k!=0)    Fatal("%s compressed files not supported\n",file);
-#ifndef GL_VERSION_2_0
-   //  OpenGL 2.0 lifts the restriction that texture size must be a power of two
-   for (k=1;k<dx;k*=2);
-   if (k!=dx) Fatal("%s image width not a power of two: %d\n",file,dx);
-   for (k=1;k<dy;k*=2);
-   if (k!=dy) Fatal("%s image height not a power of two: %d\n",file,dy);
-#endif
+   if (!CheckBMP(file,dx,dy,nbp,bpp,k,err))
+   {
+      fclose(f);
+      return 0;
+   }
+   //  Color masks follow the 40 byte header (alpha only in newer headers)
+   if (k==3)
+   {
+      int nmask = hsize>=56 ? 4 : 3;
+      if (fseek(f,54,SEEK_SET) || fread(mask,4,nmask,f)!=nmask)
+      {
+         fclose(f);
+         return ImageError(err,"Cannot read color masks from %s\n",file);
+      }
+      if (magic==0x424D)
+         for (k=0;k<nmask;k++)
+            Reverse(mask+k,4);
+      if (mask[0]!=0x00FF0000 || mask[1]!=0x0000FF00 || mask[2]!=0x000000FF || (mask[3] && mask[3]!=0xFF000000))
+      {
+         fclose(f);
+         return ImageError(err,"%s color masks not supported\n",file);
+      }
+   }
+   if (bpp==32 && mask[3]) n = 4;
 
    //  Allocate image memory
-   size = 3*dx*dy;
+   row  = bpp==32 ? 4*(size_t)dx : (3*(size_t)dx+3) & ~(size_t)3;
+   size = row*dy;
    image = (unsigned char*) malloc(size);
-   if (!image) Fatal("Cannot allocate %d bytes of memory for image %s\n",size,file);
-   //  Seek to and read image
-   if (fseek(f,off,SEEK_SET) || fread(image,size,1,f)!=1) Fatal("Error reading data from image %s\n",file);
+   if (!image) Fatal("Cannot allocate %lu bytes of memory for image %s\n",(unsigned long)size,file);
+   //  Seek to and read image (the last row may lack padding)
+   if (fseek(f,off,SEEK_SET) || fread(image,size-row+bpp/8*dx,1,f)!=1)
+   {
+      fclose(f);
+      free(image);
+      return ImageError(err,"Error reading data from image %s\n",file);
+   }
    fclose(f);
-   //  Reverse colors (BGR -> RGB)
-   for (k=0;k<size;k+=3)
+   if (bpp==32)
+   {
+      //  BGRA -> RGBA, or RGB when there is no alpha
+      for (k=0;k<dx*dy;k++)
+      {
+         unsigned char* p = image+4*k;
+         unsigned char* q = image+n*k;
+         unsigned char b=p[0],g=p[1],r=p[2],a=p[3];
+         q[0] = r;
+         q[1] = g;
+         q[2] = b;
+         if (n==4) q[3] = a;
+      }
+   }
+   else
    {
-      unsigned char temp = image[k];
-      image[k]   = image[k+2];
-      image[k+2] = temp;
+      //  Remove row padding
+      if (row!=3*dx)
+         for (k=1;k<dy;k++)
+            memmove(image+3*dx*k,image+row*k,3*dx);
+      //  Reverse colors (BGR -> RGB)
+      PixBGRtoRGB(image,image,dx*dy);
    }
+   //  Store bottom row first
+   if (top) PixFlipRows(image,n*dx,dy);
+
+   img->dx   = dx;
+   img->dy   = dy;
+   img->n    = n;
+   img->data = image;
+   return 1;
+}
 
-   //  Sanity check
-   ErrCheck("LoadTexBMP");
-   //  Generate 2D texture
-   glGenTextures(1,&texture);
-   glBindTexture(GL_TEXTURE_2D,texture);
-   //  Copy image
-   glTexImage2D(GL_TEXTURE_2D,0,3,dx,dy,0,GL_RGB,GL_UNSIGNED_BYTE,image);
-   if (glGetError()) Fatal("Error in glTexImage2D %s %dx%d\n",file,dx,dy);
-   //  Scale linearly when image size doesn't match
-   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+/*
+ *  Read BMP file into memory as DecodeBMP does, exiting on errors
+ */
+void ReadBMP(const char* file,image_t* img)
+{
+   char err[IMGERR];
+   if (!DecodeBMP(file,img,err)) Fatal("%s",err);
+}
 
-   //  Free image memory
-   free(image);
-   //  Return texture name
+/*
+ *  Load texture from BMP file using stdio
+ */
+static unsigned int LoadTexBMPRead(const char* file,unsigned long* bytes)
+{
+   unsigned int texture;  // Texture name
+   image_t      img;      // Image
+   ReadBMP(file,&img);
+   texture = TexImage(file,&img,0,bytes);
+   free(img.data);
+   return texture;
+}
+
+/*
+ *  Load texture from BMP file
+ *    Textures already loaded are returned from the texture cache
+ */
+unsigned int LoadTexBMP(const char* file)
+{
+   unsigned int  texture;  // Texture name
+   unsigned long bytes;    // Texture size
+
+   //  Return cached texture if the file was loaded before
+   texture = TexCacheFind(file);
+   if (texture) return texture;
+   //  Block compressed textures are encoded once and kept on disk
+   if (TexCompressMode()!=BC_NONE && TexHasBC())
+      texture = LoadTexBC(file,0,&bytes);
+   else
+   {
+      //  Try the memory mapped path first
+      texture = LoadTexBMPMap(file,&bytes);
+      if (!texture) texture = LoadTexBMPRead(file,&bytes);
+   }
+   //  Remember texture
+   TexCacheAdd(file,texture,bytes);
    return texture;
 }
@@ -0,0 +1,178 @@
+/*
+ *  LZ4 block compression
+ *
+ *  Implements the LZ4 block format so texture containers can be compressed
+ *  without an external library.  The compressor is the simple greedy
+ *  variant with a single hash table.  Decompression checks every length and
+ *  offset against the buffers, so a damaged file cannot write out of bounds.
+ */
+#include "CSCIx229.h"
+
+#define MINMATCH     4   //  Shortest match
+#define LASTLITERALS 5   //  The last bytes of a block are always literals
+#define MFLIMIT     12   //  The last match starts at least this far from the end
+#define MAXOFFSET 65535  //  Furthest a match may reach back
+#define HASHLOG     12   //  Hash table has 2^HASHLOG entries
+
+//
+//  Read 4 bytes
+//
+static unsigned int Read32(const unsigned char* p)
+{
+   unsigned int v;
+   memcpy(&v,p,4);
+   return v;
+}
+
+//
+//  Hash of 4 bytes
+//
+static unsigned int Hash(unsigned int v)
+{
+   return (v*2654435761u) >> (32-HASHLOG);
+}
+
+//
+//  Write the remainder of a length as a run of 255s
+//
+static unsigned char* PutLength(unsigned char* op,int len)
+{
+   while (len>=255)
+   {
+      *op++ = 255;
+      len -= 255;
+   }
+   *op++ = len;
+   return op;
+}
+
+//
+//  Write a sequence of literals followed by a match (if len>0)
+//    Returns NULL if it does not fit
+//
+static unsigned char* PutSequence(unsigned char* op,unsigned char* oend,
+                                  const unsigned char* lit,int nlit,int off,int len)
+{
+   unsigned char* token;
+   //  Worst case size of this sequence
+   if (oend-op < 1+nlit+nlit/255+1 + (len ? 2+len/255+1 : 0)) return NULL;
+   token = op++;
+   //  Literals
+   *token = (nlit<15 ? nlit : 15) << 4;
+   if (nlit>=15) op = PutLength(op,nlit-15);
+   memcpy(op,lit,nlit);
+   op += nlit;
+   //  Match
+   if (len)
+   {
+      len -= MINMATCH;
+      *op++ = off & 0xFF;
+      *op++ = off >> 8;
+      *token |= len<15 ? len : 15;
+      if (len>=15) op = PutLength(op,len-15);
+   }
+   return op;
+}
+
+/*
+ *  Compress n bytes from src into dst
+ *    cap is the size of dst
+ *    Returns the compressed size or 0 if it does not fit in cap bytes
+ */
+int LZ4Compress(unsigned char* dst,int cap,const unsigned char* src,int n)
+{
+   int table[1<<HASHLOG];  //  Last position of each hash
+   const unsigned char* ip = src;
+   const unsigned char* anchor = src;
+   const unsigned char* end = src+n;
+   unsigned char* op = dst;
+   unsigned char* oend = dst+cap;
+   int k;
+
+   for (k=0;k<(1<<HASHLOG);k++)
+      table[k] = -1;
+   //  Find matches
+   while (n>MFLIMIT && ip<end-MFLIMIT)
+   {
+      int len,ref;
+      unsigned int h = Hash(Read32(ip));
+      ref = table[h];
+      table[h] = ip-src;
+      if (ref<0 || (ip-src)-ref>MAXOFFSET || Read32(src+ref)!=Read32(ip))
+      {
+         //  Skip faster through data that does not compress
+         ip += 1 + ((ip-anchor)>>6);
+         continue;
+      }
+      //  Extend match (it may not run into the last literals)
+      for (len=MINMATCH;ip+len<end-LASTLITERALS && ip[len]==src[ref+len];len++);
+      op = PutSequence(op,oend,anchor,ip-anchor,(ip-src)-ref,len);
+      if (!op) return 0;
+      ip += len;
+      anchor = ip;
+      //  Remember a position inside the match
+      if (ip<end-MFLIMIT) table[Hash(Read32(ip-2))] = ip-2-src;
+   }
+   //  Remaining literals
+   op = PutSequence(op,oend,anchor,end-anchor,0,0);
+   return op ? op-dst : 0;
+}
+
+//
+//  Read the remainder of a length
+//    Returns -1 if the input runs out
+//
+static int GetLength(const unsigned char** ip,const unsigned char* iend,int len)
+{
+   int b;
+   do
+   {
+      if (*ip>=iend) return -1;
+      b = *(*ip)++;
+      len += b;
+   } while (b==255);
+   return len;
+}
+
+/*
+ *  Decompress n bytes from src into dst
+ *    cap is the size of dst
+ *    Returns the decompressed size or -1 if the data is damaged
+ */
+int LZ4Decompress(unsigned char* dst,int cap,const unsigned char* src,int n)
+{
+   const unsigned char* ip = src;
+   const unsigned char* iend = src+n;
+   unsigned char* op = dst;
+   unsigned char* oend = dst+cap;
+   while (ip<iend)
+   {
+      int off,len;
+      int token = *ip++;
+      //  Literals
+      len = token>>4;
+      if (len==15 && (len = GetLength(&ip,iend,len))<0) return -1;
+      if (len>iend-ip || len>oend-op) return -1;
+      memcpy(op,ip,len);
+      op += len;
+      ip += len;
+      //  The last sequence has no match
+      if (ip==iend) break;
+      //  Match
+      if (iend-ip<2) return -1;
+      off = ip[0] | (ip[1]<<8);
+      ip += 2;
+      len = token&15;
+      if (len==15 && (len = GetLength(&ip,iend,len))<0) return -1;
+      len += MINMATCH;
+      if (off==0 || off>op-dst || len>oend-op) return -1;
+      //  Overlapping matches repeat the last off bytes
+      if (off>=len)
+         memcpy(op,op-off,len);
+      else
+         for (;len;len--,op++)
+            *op = op[-off];
+      op += len;
+   }
+   return op-dst;
+}
@@ -0,0 +1,79 @@
+/*
+ *  Map a file into memory read only
+ *
+ *  Pages are read from disk as they are touched, so a file can be parsed in
+ *  place without copying it into a buffer first.
+ */
+#include "CSCIx229.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ *  Map file
+ *    Returns pointer to the contents or NULL if the file cannot be mapped
+ *    size is set to the size of the file
+ */
+const void* MapFile(const char* file,size_t* size)
+{
+#ifdef _WIN32
+   HANDLE f,m;
+   LARGE_INTEGER len;
+   void* data;
+   *size = 0;
+   f = CreateFileA(file,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+   if (f==INVALID_HANDLE_VALUE) return NULL;
+   if (!GetFileSizeEx(f,&len) || len.QuadPart==0)
+   {
+      CloseHandle(f);
+      return NULL;
+   }
+   m = CreateFileMappingA(f,NULL,PAGE_READONLY,0,0,NULL);
+   CloseHandle(f);
+   if (!m) return NULL;
+   data = MapViewOfFile(m,FILE_MAP_READ,0,0,0);
+   //  The view keeps the mapping alive
+   CloseHandle(m);
+   if (!data) return NULL;
+   *size = (size_t)len.QuadPart;
+   return data;
+#else
+   struct stat st;
+   void* data;
+   int fd;
+   *size = 0;
+   fd = open(file,O_RDONLY);
+   if (fd<0) return NULL;
+   if (fstat(fd,&st) || st.st_size==0)
+   {
+      close(fd);
+      return NULL;
+   }
+   data = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+   //  The mapping keeps the file open
+   close(fd);
+   if (data==MAP_FAILED) return NULL;
+   //  Files are mostly read front to back
+   madvise(data,st.st_size,MADV_SEQUENTIAL);
+   *size = st.st_size;
+   return data;
+#endif
+}
+
+/*
+ *  Unmap file
+ */
+void UnmapFile(const void* data,size_t size)
+{
+   if (!data) return;
+#ifdef _WIN32
+   UnmapViewOfFile(data);
+#else
+   munmap((void*)data,size);
+#endif
+}
@@ -0,0 +1,567 @@
+/*
+ *  Triangle meshes drawn from vertex and index buffers
+ *
+ *  A mesh keeps interleaved vertexes (position, normal, texture coordinates)
+ *  and triangle indexes in memory as well as in buffer objects, so it can be
+ *  processed on the CPU and drawn with a few glDrawElements calls instead of
+ *  one glBegin/glEnd per face.  Indexes are sent as 16 bits when there are
+ *  few enough vertexes.
+ *
+ *  A quantized mesh sends a packed copy of its vertexes to the vertex buffer
+ *  instead (quantize.c).
+ *
+ *  Simplified levels of detail share the vertex buffer, and their indexes
+ *  follow those of the full mesh in the index buffer.
+ *
+ *  OBJ face corners that repeat a vertex/texture/normal triplet are welded
+ *  into one vertex with a hash table, so shared vertexes are stored once and
+ *  the post-transform vertex cache can reuse them.
+ */
+#include "CSCIx229.h"
+
+//  OpenGL 1.1 headers lack half floats
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+
+#define STRIDE (8*sizeof(float))  //  Bytes per vertex
+
+//  Weld table slot
+typedef struct
+{
+   int K[3];  //  Vertex, texture and normal index
+   int v;     //  Mesh vertex (-1 if the slot is empty)
+} weld_t;
+
+/*
+ *  Set material colors and texture
+ */
+void ApplyMaterial(const material_t* m)
+{
+   glMaterialfv(GL_FRONT_AND_BACK,GL_AMBIENT  ,m->Ka);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE  ,m->Kd);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR ,m->Ks);
+   glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&m->Ns);
+   //  Bind texture if specified
+   if (m->map)
+   {
+      glEnable(GL_TEXTURE_2D);
+      TexBind(m->map);
+   }
+   else
+      glDisable(GL_TEXTURE_2D);
+}
+
+//
+//  Hash index triplet
+//
+static unsigned int HashK(const int K[3],unsigned int mask)
+{
+   unsigned int h = (K[0]*73856093u ^ K[1]*19349663u ^ K[2]*83492791u) * 2654435761u;
+   return (h>>7) & mask;
+}
+
+//
+//  Allocate empty weld table
+//
+static weld_t* Table(unsigned int size)
+{
+   unsigned int k;
+   weld_t* table = (weld_t*)malloc(size*sizeof(weld_t));
+   if (!table) Fatal("Cannot allocate memory for mesh\n");
+   for (k=0;k<size;k++)
+      table[k].v = -1;
+   return table;
+}
+
+//
+//  Move weld table entries to a table twice the size
+//
+static weld_t* Rehash(weld_t* old,unsigned int size)
+{
+   unsigned int k,h;
+   weld_t* table = Table(2*size);
+   for (k=0;k<size;k++)
+      if (old[k].v>=0)
+      {
+         for (h=HashK(old[k].K,2*size-1);table[h].v>=0;h=(h+1)&(2*size-1));
+         table[h] = old[k];
+      }
+   free(old);
+   return table;
+}
+
+//
+//  Find or add the vertex for a vertex/texture/normal index triplet
+//    Open addressing with linear probing; empty slots have v=-1
+//
+static int Weld(weld_t* table,unsigned int mask,const int K[3],const obj_t* obj,mesh_t* mesh)
+{
+   unsigned int h;
+   float* v;
+   for (h=HashK(K,mask);table[h].v>=0;h=(h+1)&mask)
+      if (table[h].K[0]==K[0] && table[h].K[1]==K[1] && table[h].K[2]==K[2])
+         return table[h].v;
+   //  New vertex
+   table[h].K[0] = K[0];
+   table[h].K[1] = K[1];
+   table[h].K[2] = K[2];
+   table[h].v = mesh->nvert;
+   v = mesh->vert+8*mesh->nvert;
+   memcpy(v,obj->V+3*(K[0]-1),3*sizeof(float));
+   if (K[2])
+   {
+      memcpy(v+3,obj->N+3*(K[2]-1),3*sizeof(float));
+      mesh->attr |= MESH_NORMAL;
+   }
+   else
+      v[3] = v[4] = v[5] = 0;
+   if (K[1])
+   {
+      memcpy(v+6,obj->T+2*(K[1]-1),2*sizeof(float));
+      mesh->attr |= MESH_TEXTURE;
+   }
+   else
+      v[6] = v[7] = 0;
+   return mesh->nvert++;
+}
+
+//
+//  Group draw ranges by material so each material is set once per draw
+//    Materials keep the order they are first used in, and triangles keep
+//    their order within a material
+//
+static void GroupRanges(mesh_t* mesh)
+{
+   int k,n=0,nm=0;
+   int* rank;            //  Group of each material
+   int* pos;             //  Next index of each group
+   unsigned int* ind;    //  Grouped indexes
+   meshrange_t* range;   //  Grouped ranges
+
+   if (mesh->nrange<2) return;
+   //  Groups in order of first use (the range before any material is first)
+   for (k=0;k<mesh->nrange;k++)
+      if (mesh->range[k].mtl+1>nm) nm = mesh->range[k].mtl+1;
+   rank  = (int*)malloc((nm+1)*sizeof(int));
+   pos   = (int*)malloc((nm+1)*sizeof(int));
+   range = (meshrange_t*)malloc((nm+1)*sizeof(meshrange_t));
+   ind   = (unsigned int*)malloc(sizeof(unsigned int)*((size_t)mesh->nind+1));
+   if (!rank || !pos || !range || !ind) Fatal("Cannot allocate memory for mesh\n");
+   for (k=0;k<=nm;k++)
+      rank[k] = -1;
+   for (k=0;k<mesh->nrange;k++)
+   {
+      int m = mesh->range[k].mtl;
+      if (rank[m+1]<0)
+      {
+         rank[m+1] = n;
+         range[n].mtl = m;
+         range[n++].count = 0;
+      }
+      range[rank[m+1]].count += mesh->range[k].count;
+   }
+   //  Nothing to gain
+   if (n==mesh->nrange)
+   {
+      free(rank);
+      free(pos);
+      free(range);
+      free(ind);
+      return;
+   }
+   //  Copy ranges to their groups
+   for (k=0;k<n;k++)
+      pos[k] = range[k].first = k ? range[k-1].first+range[k-1].count : 0;
+   for (k=0;k<mesh->nrange;k++)
+   {
+      const meshrange_t* r = mesh->range+k;
+      int g = rank[r->mtl+1];
+      memcpy(ind+pos[g],mesh->ind+r->first,r->count*sizeof(unsigned int));
+      pos[g] += r->count;
+   }
+   free(mesh->ind);
+   free(mesh->range);
+   mesh->ind = ind;
+   mesh->range = range;
+   mesh->nrange = n;
+   free(rank);
+   free(pos);
+}
+
+/*
+ *  Build mesh from OBJ file in memory
+ *    use gives the material of each usemtl statement (-1 if unknown), or
+ *    NULL to ignore materials
+ *    Corners with the same vertex/texture/normal indexes share one vertex
+ *    and polygons are split into fans
+ *    Faces are grouped into one draw range per material
+ *    Materials are left for the caller to fill in
+ */
+void BuildMesh(const obj_t* obj,const int use[],mesh_t* mesh)
+{
+   int f,k,op;
+   int cur=-1;          //  Current material
+   unsigned int size;   //  Size of weld table
+   weld_t* table;       //  Vertex for each index triplet
+
+   memset(mesh,0,sizeof(mesh_t));
+   //  Count corners and triangles
+   for (f=0;f<obj->nf;f++)
+   {
+      int n = obj->face[f+1]-obj->face[f];
+      if (n>2) mesh->nind += 3*(n-2);
+   }
+   mesh->vert  = (float*)malloc(8*sizeof(float)*((size_t)obj->nc+1));
+   mesh->ind   = (unsigned int*)malloc(sizeof(unsigned int)*((size_t)mesh->nind+1));
+   mesh->range = (meshrange_t*)malloc(sizeof(meshrange_t)*(obj->nop+1));
+   //  Weld table sized for one vertex per face, which is typical of closed
+   //  meshes, and grown if it gets more than half full
+   for (size=1024;size<2u*obj->nf;size*=2);
+   table = Table(size);
+   if (!mesh->vert || !mesh->ind || !mesh->range) Fatal("Cannot allocate memory for mesh\n");
+   mesh->nind = 0;
+   mesh->range[0].mtl = -1;
+   mesh->range[0].first = 0;
+
+   for (op=f=0;f<obj->nf;f++)
+   {
+      int n=0,v0=0,v1=0;
+      //  Start a new range when the material changes
+      for (;use && op<obj->nop && obj->op[op].face==f;op++)
+         if (obj->op[op].type==OBJ_USEMTL && use[op]>=0 && use[op]!=cur)
+         {
+            meshrange_t* r = mesh->range+mesh->nrange;
+            r->count = mesh->nind - r->first;
+            //  Empty ranges are replaced
+            if (r->count) r = mesh->range + ++mesh->nrange;
+            cur = use[op];
+            r->mtl   = cur;
+            r->first = mesh->nind;
+         }
+      //  Triangle fan
+      for (k=obj->face[f];k<obj->face[f+1];k++)
+      {
+         const int* K = obj->corner+3*k;
+         int v;
+         if (!K[0]) continue;
+         v = Weld(table,size-1,K,obj,mesh);
+         if (2u*mesh->nvert>size)
+         {
+            table = Rehash(table,size);
+            size *= 2;
+         }
+         mesh->ncorner++;
+         if (n++==0)
+            v0 = v;
+         else if (n>2)
+         {
+            mesh->ind[mesh->nind++] = v0;
+            mesh->ind[mesh->nind++] = v1;
+            mesh->ind[mesh->nind++] = v;
+         }
+         v1 = v;
+      }
+   }
+   //  Close last range
+   mesh->range[mesh->nrange].count = mesh->nind - mesh->range[mesh->nrange].first;
+   if (mesh->range[mesh->nrange].count) mesh->nrange++;
+   //  One range per material
+   GroupRanges(mesh);
+   MeshBounds(mesh);
+   //  Release unused vertexes
+   free(table);
+   mesh->vert = (float*)realloc(mesh->vert,8*sizeof(float)*((size_t)mesh->nvert+1));
+   if (!mesh->vert) Fatal("Cannot allocate memory for mesh\n");
+}
+
+//
+//  Bounding sphere centered on a box
+//    Finds the farthest of n vertexes listed in ind (all vertexes if NULL)
+//
+static void Sphere(const mesh_t* mesh,const unsigned int* ind,int n,const float min[3],const float max[3],float center[3],float* radius)
+{
+   int i,k;
+   double r=0;
+   for (k=0;k<3;k++)
+      center[k] = 0.5*(min[k]+max[k]);
+   for (i=0;i<n;i++)
+   {
+      const float* v = mesh->vert+8*(ind ? ind[i] : (unsigned int)i);
+      double d = 0;
+      for (k=0;k<3;k++)
+         d += (v[k]-center[k])*(v[k]-center[k]);
+      if (d>r) r = d;
+   }
+   *radius = sqrt(r);
+}
+
+/*
+ *  Find the bounding box and sphere of a mesh and of each draw range
+ *    The spheres are centered on the boxes
+ */
+void MeshBounds(mesh_t* mesh)
+{
+   int i,k,r;
+   //  Bounding box of the mesh
+   for (k=0;k<3;k++)
+      mesh->min[k] = mesh->max[k] = mesh->nvert ? mesh->vert[k] : 0;
+   for (i=1;i<mesh->nvert;i++)
+      for (k=0;k<3;k++)
+      {
+         float x = mesh->vert[8*i+k];
+         if (x<mesh->min[k]) mesh->min[k] = x;
+         if (x>mesh->max[k]) mesh->max[k] = x;
+      }
+   Sphere(mesh,NULL,mesh->nvert,mesh->min,mesh->max,mesh->center,&mesh->radius);
+   //  Bounds of each range
+   free(mesh->bound);
+   mesh->bound = (bounds_t*)malloc((mesh->nrange+1)*sizeof(bounds_t));
+   if (!mesh->bound) Fatal("Cannot allocate memory for mesh\n");
+   for (r=0;r<mesh->nrange;r++)
+   {
+      bounds_t* b = mesh->bound+r;
+      const unsigned int* ind = mesh->ind+mesh->range[r].first;
+      int n = mesh->range[r].count;
+      for (k=0;k<3;k++)
+         b->min[k] = b->max[k] = n ? mesh->vert[8*ind[0]+k] : 0;
+      for (i=1;i<n;i++)
+         for (k=0;k<3;k++)
+         {
+            float x = mesh->vert[8*ind[i]+k];
+            if (x<b->min[k]) b->min[k] = x;
+            if (x>b->max[k]) b->max[k] = x;
+         }
+      Sphere(mesh,ind,n,b->min,b->max,b->center,&b->radius);
+   }
+}
+
+//
+//  Copy indexes with 2 or 4 bytes each
+//
+static void CopyIndexes(void* dst,const unsigned int* src,int n,int isize)
+{
+   int k;
+   if (isize==4)
+      memcpy(dst,src,n*sizeof(unsigned int));
+   else
+      for (k=0;k<n;k++)
+         ((unsigned short*)dst)[k] = src[k];
+}
+
+/*
+ *  Copy mesh to vertex and index buffers
+ *    Indexes of the simplified levels follow those of the full mesh
+ *    Vertexes of a quantized mesh are packed first
+ */
+void UploadMesh(mesh_t* mesh)
+{
+   int k,n=mesh->nind;
+   char* ind;
+   //  Sanity check
+   ErrCheck("UploadMesh");
+   if (!mesh->nvert || !mesh->nind) return;
+   //  Vertexes
+   if (!mesh->vbo) glGenBuffers(1,&mesh->vbo);
+   glBindBuffer(GL_ARRAY_BUFFER,mesh->vbo);
+   if (mesh->format==MESH_QUANT)
+   {
+      size_t size = (size_t)MeshStride(mesh)*mesh->nvert;
+      void* buf = malloc(size);
+      if (!buf) Fatal("Cannot allocate memory for mesh\n");
+      PackMesh(mesh,buf);
+      glBufferData(GL_ARRAY_BUFFER,size,buf,GL_STATIC_DRAW);
+      free(buf);
+   }
+   else
+      glBufferData(GL_ARRAY_BUFFER,STRIDE*mesh->nvert,mesh->vert,GL_STATIC_DRAW);
+   glBindBuffer(GL_ARRAY_BUFFER,0);
+   //  Indexes of all levels (16 bits when they fit)
+   for (k=0;k<mesh->nlod;k++)
+      n += mesh->lod[k].nind;
+   mesh->isize = mesh->nvert<=65536 ? 2 : 4;
+   ind = (char*)malloc((size_t)mesh->isize*n);
+   if (!ind) Fatal("Cannot allocate memory for mesh\n");
+   CopyIndexes(ind,mesh->ind,mesh->nind,mesh->isize);
+   for (n=mesh->nind,k=0;k<mesh->nlod;k++)
+   {
+      CopyIndexes(ind+(size_t)mesh->isize*n,mesh->lod[k].ind,mesh->lod[k].nind,mesh->isize);
+      n += mesh->lod[k].nind;
+   }
+   if (!mesh->ibo) glGenBuffers(1,&mesh->ibo);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh->ibo);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER,(size_t)mesh->isize*n,ind,GL_STATIC_DRAW);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+   free(ind);
+   ErrCheck("UploadMesh");
+}
+
+/*
+ *  Draw ranges of the index buffer of a mesh
+ *    The ranges start base indexes into the buffer
+ *    A material is set only when it differs from that of the range before
+ *    A quantized mesh is drawn with its decode matrix applied to the
+ *    modelview matrix
+ */
+void DrawMeshRanges(const mesh_t* mesh,int nrange,const meshrange_t* range,size_t base)
+{
+   int k;
+   GLenum type = mesh->isize==2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+   if (!mesh->vbo) return;
+   //  Save texture and array state
+   glPushAttrib(GL_TEXTURE_BIT|GL_ENABLE_BIT);
+   glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+   //  Point arrays at buffers
+   glBindBuffer(GL_ARRAY_BUFFER,mesh->vbo);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mesh->ibo);
+   glEnableClientState(GL_VERTEX_ARRAY);
+   if (mesh->format==MESH_QUANT)
+   {
+      int stride = MeshStride(mesh);
+      size_t off = 8;
+      //  Integer positions are scaled and moved by the decode matrix, which
+      //  scales normals too
+      glPushMatrix();
+      glMultMatrixf(mesh->decode);
+      glEnable(GL_NORMALIZE);
+      glVertexPointer(3,GL_SHORT,stride,(void*)0);
+      if (mesh->attr & MESH_NORMAL)
+      {
+         glEnableClientState(GL_NORMAL_ARRAY);
+         glNormalPointer(GL_BYTE,stride,(void*)off);
+         off += 4;
+      }
+      if (mesh->attr & MESH_TEXTURE)
+      {
+         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+         glTexCoordPointer(2,GL_HALF_FLOAT,stride,(void*)off);
+      }
+   }
+   else
+   {
+      glVertexPointer(3,GL_FLOAT,STRIDE,(void*)0);
+      if (mesh->attr & MESH_NORMAL)
+      {
+         glEnableClientState(GL_NORMAL_ARRAY);
+         glNormalPointer(GL_FLOAT,STRIDE,(void*)(3*sizeof(float)));
+      }
+      if (mesh->attr & MESH_TEXTURE)
+      {
+         glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+         glTexCoordPointer(2,GL_FLOAT,STRIDE,(void*)(6*sizeof(float)));
+      }
+   }
+   //  One draw per range
+   for (k=0;k<nrange;k++)
+   {
+      const meshrange_t* r = range+k;
+      if (r->mtl>=0 && (k==0 || r->mtl!=r[-1].mtl)) ApplyMaterial(mesh->mtl+r->mtl);
+      glDrawElements(GL_TRIANGLES,r->count,type,(char*)0+(base+r->first)*mesh->isize);
+   }
+   //  Restore state
+   if (mesh->format==MESH_QUANT) glPopMatrix();
+   glBindBuffer(GL_ARRAY_BUFFER,0);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+   glPopClientAttrib();
+   glPopAttrib();
+   TexBindReset();
+}
+
+/*
+ *  Draw level of detail of a mesh
+ *    Level 0 is the full mesh and 1 to nlod the simplified levels
+ */
+void DrawMeshLOD(const mesh_t* mesh,int level)
+{
+   int k;
+   size_t base=0;  //  Indexes before the level
+   if (level>mesh->nlod) level = mesh->nlod;
+   if (level<=0)
+      DrawMeshRanges(mesh,mesh->nrange,mesh->range,0);
+   else
+   {
+      base = mesh->nind;
+      for (k=0;k<level-1;k++)
+         base += mesh->lod[k].nind;
+      DrawMeshRanges(mesh,mesh->lod[level-1].nrange,mesh->lod[level-1].range,base);
+   }
+}
+
+/*
+ *  Draw mesh
+ */
+void DrawMesh(const mesh_t* mesh)
+{
+   DrawMeshLOD(mesh,0);
+}
+
+/*
+ *  Select level of detail for drawing a mesh with the current matrixes
+ *    The bounding sphere is projected with the matrixes set by Project()
+ *    (field of view or dim) to find how many pixels an object unit covers,
+ *    and the coarsest level whose error covers at most the given number of
+ *    pixels is chosen
+ *    Returns 0 for the full mesh or 1 to nlod
+ */
+int MeshLOD(const mesh_t* mesh,float pixels)
+{
+   int k;
+   float M[16],P[16];
+   int V[4];
+   const float* c = mesh->center;
+   double r = mesh->radius;
+   double s=0,z,scale;
+   if (!mesh->nlod) return 0;
+   glGetFloatv(GL_MODELVIEW_MATRIX,M);
+   glGetFloatv(GL_PROJECTION_MATRIX,P);
+   glGetIntegerv(GL_VIEWPORT,V);
+   //  Largest scale of the modelview matrix
+   for (k=0;k<3;k++)
+   {
+      double l = M[4*k]*M[4*k]+M[4*k+1]*M[4*k+1]+M[4*k+2]*M[4*k+2];
+      if (l>s) s = l;
+   }
+   s = sqrt(s);
+   //  Pixels per object unit at the nearest point of the sphere
+   //  (P[5] is the cotangent of half the field of view, or 1/dim)
+   scale = 0.5*V[3]*P[5]*s;
+   if (P[15]==0)
+   {
+      z = -(M[2]*c[0]+M[6]*c[1]+M[10]*c[2]+M[14]) - r*s;
+      if (z<=0) return 0;
+      scale /= z;
+   }
+   //  Coarsest level that is close enough
+   for (k=mesh->nlod;k>0;k--)
+      if (mesh->lod[k-1].error*scale<=pixels) return k;
+   return 0;
+}
+
+/*
+ *  Free mesh and its buffers
+ *    Textures belong to the texture cache and are not deleted
+ */
+void FreeMesh(mesh_t* mesh)
+{
+   int k;
+   if (mesh->vbo) glDeleteBuffers(1,&mesh->vbo);
+   if (mesh->ibo) glDeleteBuffers(1,&mesh->ibo);
+   for (k=0;k<mesh->nmtl;k++)
+   {
+      free(mesh->mtl[k].name);
+      free(mesh->mtl[k].file);
+   }
+   free(mesh->mtl);
+   for (k=0;k<mesh->nlod;k++)
+   {
+      free(mesh->lod[k].ind);
+      free(mesh->lod[k].range);
+   }
+   free(mesh->lod);
+   free(mesh->vert);
+   free(mesh->tan);
+   free(mesh->bound);
+   free(mesh->ind);
+   free(mesh->range);
+   memset(mesh,0,sizeof(mesh_t));
+}
@@ -0,0 +1,374 @@
+/*
+ *  Meshlets: small clusters of triangles culled on the CPU
+ *
+ *  The triangles of each draw range are split into clusters of at most
+ *  MESHLET_VERTS vertexes and MESHLET_TRIS triangles, grown across shared
+ *  vertexes so each cluster is a compact patch of surface.  The indexes of
+ *  the mesh are reordered so every cluster is a run of the index buffer.
+ *
+ *  Each cluster has a bounding sphere and a cone around its face normals.
+ *  Before drawing, clusters whose sphere is outside the view frustum, or
+ *  whose every face points away from the eye, are dropped, and the runs of
+ *  the clusters left are joined into a short list of glDrawElements calls.
+ */
+#include "CSCIx229.h"
+
+#define SCAN 32  //  Triangles of a vertex looked at per step when growing
+
+//
+//  Unit normal of a triangle (zero if it has no area)
+//
+static void FaceNormal(const mesh_t* mesh,const unsigned int* t,float n[3])
+{
+   const float* a = mesh->vert+8*t[0];
+   const float* b = mesh->vert+8*t[1];
+   const float* c = mesh->vert+8*t[2];
+   double u[3],v[3],w[3],l;
+   int k;
+   for (k=0;k<3;k++)
+   {
+      u[k] = b[k]-a[k];
+      v[k] = c[k]-a[k];
+   }
+   w[0] = u[1]*v[2]-u[2]*v[1];
+   w[1] = u[2]*v[0]-u[0]*v[2];
+   w[2] = u[0]*v[1]-u[1]*v[0];
+   l = sqrt(w[0]*w[0]+w[1]*w[1]+w[2]*w[2]);
+   if (l>0) l = 1/l;
+   for (k=0;k<3;k++)
+      n[k] = l*w[k];
+}
+
+//
+//  Bounding sphere and normal cone of a meshlet
+//    The sphere is centered on the box around the vertexes and the cone
+//    axis is the mean of the face normals
+//
+static void Bound(const mesh_t* mesh,meshlet_t* m)
+{
+   int i,k;
+   const unsigned int* ind = mesh->ind+m->first;
+   float min[3],max[3];
+   double r=0,l=0,a[3]={0,0,0};
+   //  Sphere
+   for (k=0;k<3;k++)
+      min[k] = max[k] = mesh->vert[8*ind[0]+k];
+   for (i=1;i<m->count;i++)
+      for (k=0;k<3;k++)
+      {
+         float x = mesh->vert[8*ind[i]+k];
+         if (x<min[k]) min[k] = x;
+         if (x>max[k]) max[k] = x;
+      }
+   for (k=0;k<3;k++)
+      m->center[k] = 0.5*(min[k]+max[k]);
+   for (i=0;i<m->count;i++)
+   {
+      const float* v = mesh->vert+8*ind[i];
+      double d = (v[0]-m->center[0])*(v[0]-m->center[0]) + (v[1]-m->center[1])*(v[1]-m->center[1]) + (v[2]-m->center[2])*(v[2]-m->center[2]);
+      if (d>r) r = d;
+   }
+   m->radius = sqrt(r)*(1+1e-6);
+   //  Cone axis
+   for (i=0;i<m->count;i+=3)
+   {
+      float n[3];
+      FaceNormal(mesh,ind+i,n);
+      for (k=0;k<3;k++)
+         a[k] += n[k];
+   }
+   l = sqrt(a[0]*a[0]+a[1]*a[1]+a[2]*a[2]);
+   if (l>0) l = 1/l;
+   for (k=0;k<3;k++)
+      m->axis[k] = l*a[k];
+   //  Cone half angle from the normal furthest from the axis
+   //  (degenerate faces face nowhere and are left out)
+   m->cosine = l>0 ? 1 : 0;
+   for (i=0;i<m->count && m->cosine>0;i+=3)
+   {
+      float n[3];
+      double c;
+      FaceNormal(mesh,ind+i,n);
+      if (n[0]==0 && n[1]==0 && n[2]==0) continue;
+      c = n[0]*m->axis[0]+n[1]*m->axis[1]+n[2]*m->axis[2];
+      if (c<m->cosine) m->cosine = c;
+   }
+   //  Cones of 90 degrees or more cannot be culled
+   if (m->cosine<=0) m->cosine = 0;
+}
+
+/*
+ *  Split the triangles of a mesh into meshlets
+ *    The indexes are reordered so each meshlet is a run of them within its
+ *    draw range, so call after OptimizeMesh (the index buffer is filled
+ *    again if the mesh is already uploaded)
+ */
+void BuildMeshlets(mesh_t* mesh,meshlets_t* ml)
+{
+   int ntri = mesh->nind/3;
+   int* adj;            //  Triangles of each vertex
+   int* head;           //  First triangle of each vertex that may be unused
+   int* start;          //  Start of the triangles of each vertex
+   int* mark;           //  Meshlet a vertex was last added to
+   char* used;          //  Triangles already in a meshlet
+   unsigned int* ind;   //  Indexes in meshlet order
+   int  vert[MESHLET_VERTS];
+   int  r,k,n=0,M=16;
+
+   memset(ml,0,sizeof(meshlets_t));
+   adj   = (int*)malloc(3*sizeof(int)*(ntri+1));
+   start = (int*)calloc(mesh->nvert+1,sizeof(int));
+   head  = (int*)malloc(sizeof(int)*(mesh->nvert+1));
+   mark  = (int*)malloc(sizeof(int)*(mesh->nvert+1));
+   used  = (char*)calloc(ntri+1,1);
+   ind   = (unsigned int*)malloc(sizeof(unsigned int)*(mesh->nind+1));
+   ml->meshlet = (meshlet_t*)malloc(M*sizeof(meshlet_t));
+   if (!adj || !start || !head || !mark || !used || !ind || !ml->meshlet) Fatal("Cannot allocate memory for meshlets\n");
+
+   //  Vertex to triangle adjacency (triangles in increasing order)
+   for (k=0;k<3*ntri;k++)
+      start[mesh->ind[k]+1]++;
+   for (k=0;k<mesh->nvert;k++)
+   {
+      start[k+1] += start[k];
+      head[k] = start[k];
+      mark[k] = -1;
+   }
+   for (k=0;k<3*ntri;k++)
+      adj[head[mesh->ind[k]]++] = k/3;
+   for (k=0;k<mesh->nvert;k++)
+      head[k] = start[k];
+
+   //  Grow meshlets one draw range at a time
+   //  (indexes outside every range stay where they are)
+   memcpy(ind,mesh->ind,sizeof(unsigned int)*mesh->nind);
+   for (r=0;r<mesh->nrange;r++)
+   {
+      int pos = mesh->range[r].first;   //  Next index written
+      int t0  = pos/3;
+      int t1  = t0 + mesh->range[r].count/3;
+      int next = t0;                    //  Seed of the next meshlet
+      while (next<t1)
+      {
+         meshlet_t* m;
+         int nv=0,nt=0,i,j,t=next;
+         if (n==M)
+         {
+            M *= 2;
+            ml->meshlet = (meshlet_t*)realloc(ml->meshlet,M*sizeof(meshlet_t));
+            if (!ml->meshlet) Fatal("Cannot allocate memory for meshlets\n");
+         }
+         m = ml->meshlet+n;
+         m->first = pos;
+         //  Add triangles until full or none that fits is next to it
+         while (t>=0)
+         {
+            const unsigned int* T = mesh->ind+3*t;
+            int best=-1,bscore=-1;
+            used[t] = 1;
+            for (k=0;k<3;k++)
+            {
+               ind[pos++] = T[k];
+               if (mark[T[k]]!=n)
+               {
+                  mark[T[k]] = n;
+                  vert[nv++] = T[k];
+               }
+            }
+            if (++nt==MESHLET_TRIS) break;
+            //  Unused triangle sharing the most vertexes with the meshlet,
+            //  the earliest of those on a tie
+            for (i=0;i<nv;i++)
+            {
+               int v = vert[i];
+               while (head[v]<start[v+1] && used[adj[head[v]]])
+                  head[v]++;
+               for (j=head[v];j<start[v+1] && j<head[v]+SCAN;j++)
+               {
+                  int c = adj[j];
+                  int score;
+                  if (c>=t1) break;
+                  if (used[c]) continue;
+                  score = (mark[mesh->ind[3*c]]==n) + (mark[mesh->ind[3*c+1]]==n) + (mark[mesh->ind[3*c+2]]==n);
+                  if (nv+3-score>MESHLET_VERTS) continue;
+                  if (score>bscore || (score==bscore && c<best))
+                  {
+                     best   = c;
+                     bscore = score;
+                  }
+               }
+            }
+            t = best;
+         }
+         m->count = 3*nt;
+         m->nvert = nv;
+         m->range = r;
+         n++;
+         while (next<t1 && used[next])
+            next++;
+      }
+   }
+   memcpy(mesh->ind,ind,sizeof(unsigned int)*mesh->nind);
+   ml->nmeshlet = n;
+
+   //  Bounds once the indexes are in place
+   for (k=0;k<n;k++)
+      Bound(mesh,ml->meshlet+k);
+   ml->draw = (meshrange_t*)malloc(sizeof(meshrange_t)*(n+1));
+   if (!ml->draw) Fatal("Cannot allocate memory for meshlets\n");
+   if (mesh->ibo) UploadMesh(mesh);
+   free(ind);
+   free(adj);
+   free(start);
+   free(head);
+   free(mark);
+   free(used);
+}
+
+/*
+ *  Make the draw list of the meshlets that may be seen
+ *    M and P are the modelview and projection matrixes (column major)
+ *    back is 1 to drop meshlets facing away when front faces are counter
+ *    clockwise, -1 when they are clockwise and 0 to keep them
+ *    Visible meshlets that follow one another in the index buffer with the
+ *    same material are joined into one draw
+ *    Makes no OpenGL calls
+ *    Returns the number of triangles in the draw list
+ */
+int CullMeshlets(const mesh_t* mesh,meshlets_t* ml,const float M[16],const float P[16],int back)
+{
+   int i,k;
+   double C[16];      //  Object to clip coordinates
+   double plane[6][4];//  Frustum planes in object coordinates (inside is positive)
+   double R[9],det;   //  Inverse of the linear part of M
+   double eye[3];     //  Eye position, or direction to it if orthographic
+   int ortho = P[15]!=0;
+   //  Frustum planes from the rows of P*M
+   for (i=0;i<4;i++)
+      for (k=0;k<4;k++)
+         C[4*k+i] = P[i]*M[4*k] + P[4+i]*M[4*k+1] + P[8+i]*M[4*k+2] + P[12+i]*M[4*k+3];
+   for (i=0;i<6;i++)
+   {
+      int    row = i/2;
+      double s   = (i&1) ? -1 : 1;
+      double l;
+      for (k=0;k<4;k++)
+         plane[i][k] = C[4*k+3] + s*C[4*k+row];
+      l = sqrt(plane[i][0]*plane[i][0]+plane[i][1]*plane[i][1]+plane[i][2]*plane[i][2]);
+      if (l>0)
+         for (k=0;k<4;k++)
+            plane[i][k] /= l;
+   }
+   //  Eye in object coordinates
+   R[0] = M[5]*M[10]-M[6]*M[9];
+   R[1] = M[2]*M[9]-M[1]*M[10];
+   R[2] = M[1]*M[6]-M[2]*M[5];
+   R[3] = M[6]*M[8]-M[4]*M[10];
+   R[4] = M[0]*M[10]-M[2]*M[8];
+   R[5] = M[2]*M[4]-M[0]*M[6];
+   R[6] = M[4]*M[9]-M[5]*M[8];
+   R[7] = M[1]*M[8]-M[0]*M[9];
+   R[8] = M[0]*M[5]-M[1]*M[4];
+   det = M[0]*R[0] + M[4]*R[1] + M[8]*R[2];
+   if (det==0) back = 0;
+   //  A mirroring matrix turns the faces around
+   if (det<0) back = -back;
+   for (k=0;k<3;k++)
+   {
+      //  Column j of the inverse is (R[3*j],R[3*j+1],R[3*j+2])/det
+      if (ortho)
+         eye[k] = R[6+k];
+      else
+         eye[k] = -(R[k]*M[12] + R[3+k]*M[13] + R[6+k]*M[14])/(det ? det : 1);
+   }
+   if (ortho)
+   {
+      double l = sqrt(eye[0]*eye[0]+eye[1]*eye[1]+eye[2]*eye[2]);
+      if (l>0)
+         for (k=0;k<3;k++)
+            eye[k] /= l*(det<0 ? -1 : 1);
+   }
+
+   //  Test each meshlet
+   ml->ndraw = ml->ntri = ml->nout = ml->nback = 0;
+   for (i=0;i<ml->nmeshlet;i++)
+   {
+      const meshlet_t* m = ml->meshlet+i;
+      const float* c = m->center;
+      int mtl = mesh->range[m->range].mtl;
+      int out = 0;
+      //  Outside a frustum plane
+      for (k=0;k<6 && !out;k++)
+         out = plane[k][0]*c[0]+plane[k][1]*c[1]+plane[k][2]*c[2]+plane[k][3] < -m->radius;
+      if (out)
+      {
+         ml->nout++;
+         continue;
+      }
+      //  Every face points away from every point of the sphere when the
+      //  angle from the axis to the eye, plus the half angle of the cone,
+      //  is over 90 degrees by enough to clear the sphere
+      if (back && m->cosine>0)
+      {
+         double d[3],dd=0,ll=0,sine=sqrt(1-m->cosine*m->cosine);
+         for (k=0;k<3;k++)
+         {
+            d[k] = ortho ? -eye[k] : c[k]-eye[k];
+            dd += back*m->axis[k]*d[k];
+            ll += d[k]*d[k];
+         }
+         if (dd*m->cosine - sqrt(ll>dd*dd ? ll-dd*dd : 0)*sine > (ortho ? 0 : m->radius))
+         {
+            ml->nback++;
+            continue;
+         }
+      }
+      //  Join with the draw before when it ends where this one starts
+      if (ml->ndraw && ml->draw[ml->ndraw-1].mtl==mtl && ml->draw[ml->ndraw-1].first+ml->draw[ml->ndraw-1].count==m->first)
+         ml->draw[ml->ndraw-1].count += m->count;
+      else
+      {
+         meshrange_t* r = ml->draw+ml->ndraw++;
+         r->mtl   = mtl;
+         r->first = m->first;
+         r->count = m->count;
+      }
+      ml->ntri += m->count/3;
+   }
+   return ml->ntri;
+}
+
+/*
+ *  Draw the meshlets that may be seen with the current matrixes
+ *    Meshlets facing away are dropped when GL_CULL_FACE is enabled
+ */
+void DrawMeshlets(const mesh_t* mesh,meshlets_t* ml)
+{
+   float M[16],P[16];
+   int back=0;
+   glGetFloatv(GL_MODELVIEW_MATRIX,M);
+   glGetFloatv(GL_PROJECTION_MATRIX,P);
+   if (glIsEnabled(GL_CULL_FACE))
+   {
+      int face,front;
+      glGetIntegerv(GL_CULL_FACE_MODE,&face);
+      glGetIntegerv(GL_FRONT_FACE,&front);
+      back = front==GL_CCW ? 1 : -1;
+      if (face==GL_FRONT) back = -back;
+      if (face==GL_FRONT_AND_BACK) return;
+   }
+   //  The quantized positions are only undone in the modelview matrix
+   //  when drawing, so the object coordinates of meshlets still apply
+   CullMeshlets(mesh,ml,M,P,back);
+   DrawMeshRanges(mesh,ml->ndraw,ml->draw,0);
+}
+
+/*
+ *  Free meshlets
+ */
+void FreeMeshlets(meshlets_t* ml)
+{
+   free(ml->meshlet);
+   free(ml->draw);
+   memset(ml,0,sizeof(meshlets_t));
+}
@@ -0,0 +1,381 @@
+/*
+ *  Triangle order optimization for meshes
+ *
+ *  Triangles are reordered in three steps, each inside a draw range so the
+ *  materials are unchanged:
+ *    1.  Vertex cache order using Tom Forsyth's greedy algorithm, which
+ *        picks the next triangle by how recently its vertexes were used and
+ *        how few triangles they have left
+ *    2.  Overdraw order: the cache ordered triangles are cut into clusters
+ *        where starting over with a cold cache costs little, and clusters
+ *        facing away from the center of the range are drawn first so they
+ *        tend to hide the clusters behind them (Sander, Nehab and Barczak)
+ *    3.  Vertex fetch order: vertexes are renumbered in the order they are
+ *        first used so the vertex buffer is read front to back
+ *  A FIFO cache simulator measures the average cache miss ratio (misses per
+ *  triangle) and the average transform to vertex ratio (misses per vertex)
+ *  after each step, so the result can be checked without a GPU.
+ */
+#include "CSCIx229.h"
+
+#define LRU       32    //  Cache size assumed by the vertex cache order
+#define FIFO      16    //  Cache size of the simulator
+#define THRESHOLD 1.05  //  Cache misses allowed by the overdraw order relative to the cache order
+
+//  Cluster of triangles for the overdraw order
+typedef struct
+{
+   int   first,count;  //  Triangles in cluster
+   float area;         //  Twice the area
+   float cen[3];       //  Center times area
+   float nrm[3];       //  Sum of normals times area
+   float key;          //  Distance the cluster faces out from the center
+} cluster_t;
+
+//
+//  Forsyth vertex score from position in cache and triangles left
+//
+static float VertexScore(int pos,int live)
+{
+   float s = 0;
+   if (live==0) return -1;
+   //  Last triangle's vertexes score the same so it does not matter which is used
+   if (pos>=0) s = pos<3 ? 0.75 : pow(1-(pos-3)/(float)(LRU-3),1.5);
+   //  Boost vertexes with few triangles left to avoid leaving them behind
+   return s + 2/sqrt(live);
+}
+
+//
+//  Count cache misses for a list of indexes with a FIFO cache
+//    stamp has one zeroed entry for each vertex
+//    Sets the number of distinct vertexes used
+//
+static int Simulate(const unsigned int* ind,int n,int cache,int* stamp,int* used)
+{
+   int k,miss=0,time=cache;
+   *used = 0;
+   for (k=0;k<n;k++)
+   {
+      int v = ind[k];
+      if (!stamp[v]) (*used)++;
+      if (time-stamp[v]>=cache)
+      {
+         stamp[v] = time++;
+         miss++;
+      }
+   }
+   return miss;
+}
+
+/*
+ *  Simulate a FIFO vertex cache of the given size drawing the mesh
+ *    Sets the cache misses per triangle (ACMR) and per vertex used (ATVR)
+ */
+void MeshCacheMiss(const mesh_t* mesh,int cache,double* acmr,double* atvr)
+{
+   int miss,used;
+   int* stamp = (int*)calloc(mesh->nvert+1,sizeof(int));
+   if (!stamp) Fatal("Cannot allocate memory for mesh\n");
+   miss = Simulate(mesh->ind,mesh->nind,cache,stamp,&used);
+   free(stamp);
+   *acmr = mesh->nind ? 3.0*miss/mesh->nind : 0;
+   *atvr = used ? (double)miss/used : 0;
+}
+
+//
+//  Vertex cache order for the triangles in one range
+//    Triangles are listed in out in the new order
+//    Work arrays have one entry per vertex and per index
+//
+static void CacheOrder(const unsigned int* ind,int ntri,unsigned int* out,
+                       int* live,int* off,int* pos,float* vscore,int* adj,char* added)
+{
+   int i,k,t;
+   int cache[LRU+3],ncache=0;  //  Vertexes in cache, most recent first
+   int best=-1;                //  Next triangle
+   int next=0;                 //  First triangle that might not be added
+
+   //  Triangles using each vertex
+   for (k=0;k<3*ntri;k++)
+   {
+      live[ind[k]] = 0;
+      off[ind[k]] = -1;
+   }
+   for (k=0;k<3*ntri;k++)
+      live[ind[k]]++;
+   for (i=k=0;k<3*ntri;k++)
+   {
+      int v = ind[k];
+      if (off[v]<0)
+      {
+         off[v] = i;
+         i += live[v];
+         live[v] = 0;
+      }
+      adj[off[v]+live[v]++] = k/3;
+   }
+   //  Initial scores
+   for (k=0;k<3*ntri;k++)
+   {
+      pos[ind[k]] = -1;
+      vscore[ind[k]] = VertexScore(-1,live[ind[k]]);
+   }
+   for (t=0;t<ntri;t++)
+      added[t] = 0;
+
+   for (i=0;i<ntri;i++)
+   {
+      int nnew=0,newc[LRU+3];
+      float top=-1e30;
+      //  Nothing in cache is usable, so take the next triangle in order
+      if (best<0)
+      {
+         while (added[next]) next++;
+         best = next;
+      }
+      //  Add triangle
+      out[3*i]   = ind[3*best];
+      out[3*i+1] = ind[3*best+1];
+      out[3*i+2] = ind[3*best+2];
+      added[best] = 1;
+      //  Remove it from the lists of its vertexes and put them first in cache
+      for (k=0;k<3;k++)
+      {
+         int v = ind[3*best+k];
+         int* a = adj+off[v];
+         int j;
+         for (j=0;a[j]!=best;j++);
+         a[j] = a[--live[v]];
+         a[live[v]] = best;
+         for (j=0;j<nnew && newc[j]!=v;j++);
+         if (j==nnew) newc[nnew++] = v;
+      }
+      //  Older vertexes follow, and those pushed out leave the cache
+      for (k=0;k<ncache;k++)
+      {
+         int v = cache[k];
+         if (v!=newc[0] && (nnew<2 || v!=newc[1]) && (nnew<3 || v!=newc[2]))
+         {
+            if (nnew<LRU)
+               newc[nnew++] = v;
+            else
+            {
+               pos[v] = -1;
+               vscore[v] = VertexScore(-1,live[v]);
+            }
+         }
+      }
+      ncache = nnew;
+      for (k=0;k<ncache;k++)
+      {
+         int v = cache[k] = newc[k];
+         pos[v] = k;
+         vscore[v] = VertexScore(k,live[v]);
+      }
+      //  Best triangle using a vertex in cache
+      best = -1;
+      for (k=0;k<ncache;k++)
+      {
+         int v = cache[k];
+         int j;
+         for (j=0;j<live[v];j++)
+         {
+            int u = adj[off[v]+j];
+            float s = vscore[ind[3*u]] + vscore[ind[3*u+1]] + vscore[ind[3*u+2]];
+            if (!added[u] && s>top)
+            {
+               top = s;
+               best = u;
+            }
+         }
+      }
+   }
+}
+
+//
+//  Compare clusters (largest key first, then in order)
+//
+static int ClusterCmp(const void* a,const void* b)
+{
+   const cluster_t* A = (const cluster_t*)a;
+   const cluster_t* B = (const cluster_t*)b;
+   if (A->key!=B->key) return A->key>B->key ? -1 : +1;
+   return A->first-B->first;
+}
+
+//
+//  Overdraw order for the cache ordered triangles in one range
+//    A cluster ends once its own cache miss ratio, counted from a cold
+//    cache, is within THRESHOLD of the whole range, so cutting there costs
+//    few extra misses
+//
+static void OverdrawOrder(const float* vert,const unsigned int* ind,int ntri,unsigned int* out,int* stamp,cluster_t* clus)
+{
+   int i,k,t,n=0,used,time=FIFO;
+   int miss=0;              //  Misses in cluster
+   float C[3]={0,0,0},A=0;  //  Center and area of range
+   float limit;             //  Largest misses per triangle at the end of a cluster
+
+   if (ntri<1) return;
+   //  Misses per triangle of range
+   for (k=0;k<3*ntri;k++)
+      stamp[ind[k]] = 0;
+   limit = THRESHOLD*Simulate(ind,3*ntri,FIFO,stamp,&used)/ntri;
+   for (k=0;k<3*ntri;k++)
+      stamp[ind[k]] = 0;
+   for (t=0;t<ntri;t++)
+   {
+      const float* p0 = vert+8*ind[3*t];
+      const float* p1 = vert+8*ind[3*t+1];
+      const float* p2 = vert+8*ind[3*t+2];
+      float u[3],v[3],N[3],a;
+      //  Start cluster with a cold cache
+      if (t==0 || miss<=limit*clus[n-1].count)
+      {
+         memset(clus+n,0,sizeof(cluster_t));
+         clus[n++].first = t;
+         time += FIFO;
+         miss = 0;
+      }
+      for (k=0;k<3;k++)
+      {
+         int j = ind[3*t+k];
+         if (time-stamp[j]>=FIFO)
+         {
+            stamp[j] = time++;
+            miss++;
+         }
+      }
+      clus[n-1].count++;
+      //  Normal with length twice the area
+      for (k=0;k<3;k++)
+      {
+         u[k] = p1[k]-p0[k];
+         v[k] = p2[k]-p0[k];
+      }
+      N[0] = u[1]*v[2]-u[2]*v[1];
+      N[1] = u[2]*v[0]-u[0]*v[2];
+      N[2] = u[0]*v[1]-u[1]*v[0];
+      a = sqrt(N[0]*N[0]+N[1]*N[1]+N[2]*N[2]);
+      //  Area weighted centers and normal
+      for (k=0;k<3;k++)
+      {
+         float c = a*(p0[k]+p1[k]+p2[k])/3;
+         clus[n-1].cen[k] += c;
+         clus[n-1].nrm[k] += N[k];
+         C[k] += c;
+      }
+      clus[n-1].area += a;
+      A += a;
+   }
+   for (k=0;k<3;k++)
+      C[k] = A>0 ? C[k]/A : 0;
+   //  Sort clusters by how far they face out from the center
+   for (i=0;i<n;i++)
+   {
+      float d=0,l=0;
+      for (k=0;k<3;k++)
+      {
+         float c = clus[i].area>0 ? clus[i].cen[k]/clus[i].area : 0;
+         d += (c-C[k])*clus[i].nrm[k];
+         l += clus[i].nrm[k]*clus[i].nrm[k];
+      }
+      clus[i].key = l>0 ? d/sqrt(l) : 0;
+   }
+   qsort(clus,n,sizeof(cluster_t),ClusterCmp);
+   for (i=k=0;i<n;i++)
+   {
+      memcpy(out+k,ind+3*clus[i].first,3*sizeof(unsigned int)*clus[i].count);
+      k += 3*clus[i].count;
+   }
+}
+
+//
+//  Vertex fetch order
+//    Vertexes are renumbered in order of first use and unused vertexes dropped
+//
+static void FetchOrder(mesh_t* mesh,int* remap)
+{
+   int i,k,n=0;
+   float* vert = (float*)malloc(8*sizeof(float)*((size_t)mesh->nvert+1));
+   float* tan  = mesh->tan ? (float*)malloc(4*sizeof(float)*((size_t)mesh->nvert+1)) : NULL;
+   if (!vert || (mesh->tan && !tan)) Fatal("Cannot allocate memory for mesh\n");
+   for (k=0;k<mesh->nvert;k++)
+      remap[k] = -1;
+   for (k=0;k<mesh->nind;k++)
+   {
+      int v = mesh->ind[k];
+      if (remap[v]<0)
+      {
+         memcpy(vert+8*n,mesh->vert+8*v,8*sizeof(float));
+         if (tan) memcpy(tan+4*n,mesh->tan+4*v,4*sizeof(float));
+         remap[v] = n++;
+      }
+      mesh->ind[k] = remap[v];
+   }
+   //  Levels of detail use the same vertexes
+   for (i=0;i<mesh->nlod;i++)
+      for (k=0;k<mesh->lod[i].nind;k++)
+         mesh->lod[i].ind[k] = remap[mesh->lod[i].ind[k]];
+   free(mesh->vert);
+   free(mesh->tan);
+   mesh->vert  = vert;
+   mesh->tan   = tan;
+   mesh->nvert = n;
+}
+
+/*
+ *  Reorder mesh triangles and vertexes for the vertex cache and overdraw
+ *    Works on the copy of the mesh in memory, so call before UploadMesh
+ *    Triangles stay in their draw range
+ *    When stats is not NULL, the FIFO cache misses as loaded and after
+ *    each step are reported
+ */
+void OptimizeMesh(mesh_t* mesh,meshopt_t* stats)
+{
+   int r;
+   int ntri = mesh->nind/3;
+   size_t nv = (size_t)mesh->nvert+1;
+   //  Work arrays
+   unsigned int* out = (unsigned int*)malloc(sizeof(unsigned int)*(mesh->nind+1));
+   int*   live   = (int*)malloc(sizeof(int)*nv);
+   int*   off    = (int*)malloc(sizeof(int)*nv);
+   int*   pos    = (int*)malloc(sizeof(int)*nv);
+   float* vscore = (float*)malloc(sizeof(float)*nv);
+   int*   adj    = (int*)malloc(sizeof(int)*(mesh->nind+1));
+   char*  added  = (char*)malloc(ntri+1);
+   cluster_t* clus = (cluster_t*)malloc(sizeof(cluster_t)*(ntri+1));
+   if (!out || !live || !off || !pos || !vscore || !adj || !added || !clus) Fatal("Cannot allocate memory for mesh\n");
+
+   if (stats) MeshCacheMiss(mesh,FIFO,stats->acmr+0,stats->atvr+0);
+   //  Vertex cache order
+   for (r=0;r<mesh->nrange;r++)
+   {
+      unsigned int* ind = mesh->ind+mesh->range[r].first;
+      int n = mesh->range[r].count/3;
+      CacheOrder(ind,n,out,live,off,pos,vscore,adj,added);
+      memcpy(ind,out,3*sizeof(unsigned int)*n);
+   }
+   if (stats) MeshCacheMiss(mesh,FIFO,stats->acmr+1,stats->atvr+1);
+   //  Overdraw order
+   for (r=0;r<mesh->nrange;r++)
+   {
+      unsigned int* ind = mesh->ind+mesh->range[r].first;
+      int n = mesh->range[r].count/3;
+      OverdrawOrder(mesh->vert,ind,n,out,live,clus);
+      memcpy(ind,out,3*sizeof(unsigned int)*n);
+   }
+   if (stats) MeshCacheMiss(mesh,FIFO,stats->acmr+2,stats->atvr+2);
+   //  Vertex fetch order
+   FetchOrder(mesh,live);
+   if (stats) MeshCacheMiss(mesh,FIFO,stats->acmr+3,stats->atvr+3);
+
+   free(out);
+   free(live);
+   free(off);
+   free(pos);
+   free(vscore);
+   free(adj);
+   free(added);
+   free(clus);
+}
@@ -0,0 +1,327 @@
+/*
+ *  Build mipmap chains on the CPU
+ *
+ *  Each level halves the size of the previous one (rounding down, minimum
+ *  1) until the image is 1x1.  Images with even dimensions are reduced with
+ *  a 2x2 box filter, using SSE2 for RGB and RGBA images where it is
+ *  available.  Odd dimensions (non power of two images)
+ *  use an area weighted box so every source pixel counts equally.  Kaiser
+ *  and Lanczos filters give sharper results at a higher cost.
+ *
+ *  Nothing here calls OpenGL, so chains may be built on loader threads.
+ */
+#include "CSCIx229.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define PI 3.14159265358979323846
+
+//  Filter selected with TexMipmap
+static int mipfilter=MIP_NONE;
+
+/*
+ *  Select filter used when creating textures
+ *    MIP_NONE uploads only level 0 (the default)
+ */
+void TexMipmap(int filter)
+{
+   mipfilter = filter;
+}
+
+/*
+ *  Filter used when creating textures
+ */
+int TexMipmapFilter(void)
+{
+   return mipfilter;
+}
+
+//
+//  Sum of two rows as 16 bit values
+//
+static void SumRows(unsigned short* sum,const unsigned char* r0,const unsigned char* r1,int n)
+{
+   int k=0;
+#if defined(__SSE2__)
+   const __m128i zero = _mm_setzero_si128();
+   for (;k+16<=n;k+=16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i*)(r0+k));
+      __m128i b = _mm_loadu_si128((const __m128i*)(r1+k));
+      _mm_storeu_si128((__m128i*)(sum+k)  ,_mm_add_epi16(_mm_unpacklo_epi8(a,zero),_mm_unpacklo_epi8(b,zero)));
+      _mm_storeu_si128((__m128i*)(sum+k+8),_mm_add_epi16(_mm_unpackhi_epi8(a,zero),_mm_unpackhi_epi8(b,zero)));
+   }
+#endif
+   for (;k<n;k++)
+      sum[k] = r0[k] + r1[k];
+}
+
+//
+//  2x2 box filter for images with even dimensions
+//
+static void Box2x2(image_t* dst,const image_t* src)
+{
+   int i,j,c;
+   int n = src->n;
+   int len = src->dx*n;
+   //  The RGB vector loop reads one lane past the row
+   unsigned short* sum = (unsigned short*)malloc((len+4)*sizeof(unsigned short));
+   if (!sum) Fatal("Cannot allocate memory for mipmap\n");
+   memset(sum+len,0,4*sizeof(unsigned short));
+   for (j=0;j<dst->dy;j++)
+   {
+      const unsigned char* r0 = src->data + (size_t)(2*j)*len;
+      unsigned char* out = dst->data + (size_t)j*dst->dx*n;
+      //  Vertical pairs
+      SumRows(sum,r0,r0+len,len);
+      //  Horizontal pairs
+      i = 0;
+#if defined(__SSE2__)
+      if (n==4)
+      {
+         //  Two pixels are four 16 bit lanes each
+         const __m128i two = _mm_set1_epi16(2);
+         for (;i+4<=dst->dx;i+=4)
+         {
+            __m128i a = _mm_loadu_si128((const __m128i*)(sum+8*i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(sum+8*i+8));
+            __m128i e = _mm_unpacklo_epi64(a,b);
+            __m128i o = _mm_unpackhi_epi64(a,b);
+            __m128i s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(e,o),two),2);
+            _mm_storel_epi64((__m128i*)(out+4*i),_mm_packus_epi16(s,s));
+            a = _mm_loadu_si128((const __m128i*)(sum+8*i+16));
+            b = _mm_loadu_si128((const __m128i*)(sum+8*i+24));
+            e = _mm_unpacklo_epi64(a,b);
+            o = _mm_unpackhi_epi64(a,b);
+            s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(e,o),two),2);
+            _mm_storel_epi64((__m128i*)(out+4*i+8),_mm_packus_epi16(s,s));
+         }
+      }
+      else if (n==3)
+      {
+         //  Each pixel is padded to four 16 bit lanes by loading four lanes
+         //  from each of its two sums, then the fourth byte is squeezed out
+         const __m128i two  = _mm_set1_epi16(2);
+         const __m128i m0   = _mm_set_epi32(0,0,0,0x00FFFFFF);
+         const __m128i m1   = _mm_set_epi32(0,0,0x00FFFFFF,0);
+         const __m128i m2   = _mm_set_epi32(0,0x00FFFFFF,0,0);
+         const __m128i m3   = _mm_set_epi32(0x00FFFFFF,0,0,0);
+         for (;i+4<=dst->dx;i+=4)
+         {
+            const unsigned short* q = sum+6*i;
+            int last;
+            __m128i a = _mm_add_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)q)     ,_mm_loadl_epi64((const __m128i*)(q+6))),
+                                      _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(q+3)) ,_mm_loadl_epi64((const __m128i*)(q+9))));
+            __m128i b = _mm_add_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(q+12)),_mm_loadl_epi64((const __m128i*)(q+18))),
+                                      _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(q+15)),_mm_loadl_epi64((const __m128i*)(q+21))));
+            __m128i p;
+            a = _mm_srli_epi16(_mm_add_epi16(a,two),2);
+            b = _mm_srli_epi16(_mm_add_epi16(b,two),2);
+            p = _mm_packus_epi16(a,b);
+            p = _mm_or_si128(_mm_or_si128(_mm_and_si128(p,m0),_mm_srli_si128(_mm_and_si128(p,m1),1)),
+                             _mm_or_si128(_mm_srli_si128(_mm_and_si128(p,m2),2),_mm_srli_si128(_mm_and_si128(p,m3),3)));
+            //  Twelve bytes out
+            _mm_storel_epi64((__m128i*)(out+3*i),p);
+            last = _mm_cvtsi128_si32(_mm_srli_si128(p,8));
+            memcpy(out+3*i+8,&last,4);
+         }
+      }
+#endif
+      for (;i<dst->dx;i++)
+         for (c=0;c<n;c++)
+            out[i*n+c] = (sum[2*i*n+c] + sum[(2*i+1)*n+c] + 2) >> 2;
+   }
+   free(sum);
+}
+
+//
+//  Kaiser windowed sinc
+//
+static double Bessel0(double x)
+{
+   double sum=1,term=1;
+   int k;
+   for (k=1;k<20;k++)
+   {
+      term *= (x/(2*k))*(x/(2*k));
+      sum += term;
+   }
+   return sum;
+}
+static double Sinc(double x)
+{
+   return fabs(x)<1e-6 ? 1 : sin(PI*x)/(PI*x);
+}
+static double Kernel(int filter,double x,double* radius)
+{
+   x = fabs(x);
+   //  Lanczos 3
+   if (filter==MIP_LANCZOS)
+   {
+      *radius = 3;
+      return x<3 ? Sinc(x)*Sinc(x/3) : 0;
+   }
+   //  Kaiser (alpha=4) over 3 lobes
+   else if (filter==MIP_KAISER)
+   {
+      const double alpha=4;
+      *radius = 3;
+      return x<3 ? Sinc(x)*Bessel0(PI*alpha*sqrt(1-(x/3)*(x/3)))/Bessel0(PI*alpha) : 0;
+   }
+   //  Box
+   *radius = 0.5;
+   return x<=0.5 ? 1 : 0;
+}
+
+//
+//  Filter taps for one output sample
+//
+typedef struct
+{
+   int first,n;   //  First source sample and number of taps
+   float* w;      //  Weights
+} taps_t;
+
+//
+//  Filter taps to resample ns samples to nd samples
+//
+static taps_t* Taps(int filter,int ns,int nd)
+{
+   int i,k;
+   double scale = (double)ns/nd;
+   taps_t* taps = (taps_t*)malloc(nd*sizeof(taps_t));
+   if (!taps) Fatal("Cannot allocate memory for mipmap\n");
+   for (i=0;i<nd;i++)
+   {
+      double radius,sum=0;
+      double c = (i+0.5)*scale;
+      //  Box integrates the footprint exactly
+      if (filter==MIP_BOX)
+      {
+         double x0 = i*scale, x1 = (i+1)*scale;
+         taps[i].first = (int)x0;
+         taps[i].n = (int)ceil(x1) - taps[i].first;
+         taps[i].w = (float*)malloc(taps[i].n*sizeof(float));
+         if (!taps[i].w) Fatal("Cannot allocate memory for mipmap\n");
+         for (k=0;k<taps[i].n;k++)
+         {
+            double a = taps[i].first+k, b = a+1;
+            if (a<x0) a = x0;
+            if (b>x1) b = x1;
+            taps[i].w[k] = (b-a)/scale;
+         }
+         continue;
+      }
+      Kernel(filter,0,&radius);
+      taps[i].first = (int)floor(c-radius*scale);
+      taps[i].n = (int)ceil(c+radius*scale) - taps[i].first;
+      taps[i].w = (float*)malloc(taps[i].n*sizeof(float));
+      if (!taps[i].w) Fatal("Cannot allocate memory for mipmap\n");
+      for (k=0;k<taps[i].n;k++)
+      {
+         taps[i].w[k] = Kernel(filter,(taps[i].first+k+0.5-c)/scale,&radius);
+         sum += taps[i].w[k];
+      }
+      for (k=0;k<taps[i].n;k++)
+         taps[i].w[k] /= sum;
+   }
+   return taps;
+}
+
+static void FreeTaps(taps_t* taps,int n)
+{
+   int i;
+   for (i=0;i<n;i++)
+      free(taps[i].w);
+   free(taps);
+}
+
+//
+//  Separable resample for odd sizes and the windowed sinc filters
+//    Edges are clamped
+//
+static void Resample(int filter,image_t* dst,const image_t* src)
+{
+   int i,j,k,c;
+   int n = src->n;
+   taps_t* tx = Taps(filter,src->dx,dst->dx);
+   taps_t* ty = Taps(filter,src->dy,dst->dy);
+   //  Horizontal pass into floats
+   float* tmp = (float*)malloc((size_t)dst->dx*src->dy*n*sizeof(float));
+   if (!tmp) Fatal("Cannot allocate memory for mipmap\n");
+   for (j=0;j<src->dy;j++)
+   {
+      const unsigned char* row = src->data + (size_t)j*src->dx*n;
+      for (i=0;i<dst->dx;i++)
+         for (c=0;c<n;c++)
+         {
+            float sum=0;
+            for (k=0;k<tx[i].n;k++)
+            {
+               int x = tx[i].first+k;
+               if (x<0) x = 0;
+               if (x>=src->dx) x = src->dx-1;
+               sum += tx[i].w[k]*row[x*n+c];
+            }
+            tmp[((size_t)j*dst->dx+i)*n+c] = sum;
+         }
+   }
+   //  Vertical pass into bytes
+   for (j=0;j<dst->dy;j++)
+      for (i=0;i<dst->dx*n;i++)
+      {
+         float sum=0;
+         for (k=0;k<ty[j].n;k++)
+         {
+            int y = ty[j].first+k;
+            if (y<0) y = 0;
+            if (y>=src->dy) y = src->dy-1;
+            sum += ty[j].w[k]*tmp[(size_t)y*dst->dx*n+i];
+         }
+         sum += 0.5;
+         dst->data[(size_t)j*dst->dx*n+i] = sum<0 ? 0 : sum>255 ? 255 : (unsigned char)sum;
+      }
+   free(tmp);
+   FreeTaps(tx,dst->dx);
+   FreeTaps(ty,dst->dy);
+}
+
+/*
+ *  Build mipmap chain
+ *    img is level 0 and is stored as levels[0] (the pixels are shared)
+ *    levels must have room for MAXMIP images
+ *    Returns the number of levels
+ */
+int BuildMipmaps(const image_t* img,int filter,image_t levels[])
+{
+   int k=0;
+   levels[0] = *img;
+   while (levels[k].dx>1 || levels[k].dy>1)
+   {
+      image_t* src = levels+k;
+      image_t* dst = levels+k+1;
+      dst->dx = src->dx>1 ? src->dx/2 : 1;
+      dst->dy = src->dy>1 ? src->dy/2 : 1;
+      dst->n  = src->n;
+      dst->data = (unsigned char*)malloc((size_t)dst->dx*dst->dy*dst->n);
+      if (!dst->data) Fatal("Cannot allocate memory for mipmap\n");
+      if (filter==MIP_BOX && src->dx==2*dst->dx && src->dy==2*dst->dy)
+         Box2x2(dst,src);
+      else
+         Resample(filter,dst,src);
+      k++;
+   }
+   return k+1;
+}
+
+/*
+ *  Free mipmap levels built by BuildMipmaps (level 0 is not freed)
+ */
+void FreeMipmaps(image_t levels[],int n)
+{
+   int k;
+   for (k=1;k<n;k++)
+      free(levels[k].data);
+}
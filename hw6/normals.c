@@ -0,0 +1,446 @@
+/*
+ *  Smooth normals and tangents
+ *
+ *  BuildNormals gives OBJ faces that have no normals, or broken ones, the
+ *  average of the normals of the faces around each corner.  Each face is
+ *  weighted by its area and by the angle of its corner, so a vertex shared
+ *  by many thin triangles on one side is not pulled towards them.  Faces
+ *  meeting at more than the crease angle are not averaged, so hard edges
+ *  stay hard.  Corners of a vertex that end up with the same normal share
+ *  it, so BuildMesh welds them as before.
+ *
+ *  BuildTangents follows MikkTSpace: the tangent of each triangle is taken
+ *  from its texture coordinates, projected into the plane of each corner
+ *  normal, weighted by the corner angle and summed per vertex, then made
+ *  orthogonal to the normal.  The fourth component is the handedness of the
+ *  bitangent.  Vertexes are not split where the handedness flips, so
+ *  mirrored texture seams that share a vertex get one tangent frame.
+ *
+ *  Both work in parallel.  Threads write only their own corners or vertexes,
+ *  or sum into their own copy of the tangents that is then added up, so no
+ *  atomic operations are needed.
+ */
+#include "CSCIx229.h"
+
+#define MINWORK 16384    //  Fewest faces or vertexes worth a thread
+
+//  Work for one thread
+typedef struct
+{
+   int    beg,end;       //  Range of faces, vertexes or triangles
+   obj_t* obj;           //  OBJ file (BuildNormals)
+   mesh_t* mesh;         //  Mesh (BuildTangents)
+   float* fn;            //  Unit normal of each face
+   float* fa;            //  Area of each face
+   float* cw;            //  Angle of each corner
+   int*   cf;            //  Face of each corner
+   int*   first;         //  First corner of each vertex
+   int*   adj;           //  Corners of each vertex
+   char*  need;          //  Faces needing normals
+   float* out;           //  Normal of each corner
+   float  cosc;          //  Cosine of the crease angle
+   float* acc;           //  Tangent and bitangent sums (6 per vertex)
+   float* const* part;   //  Sums of every thread (reduction)
+   int    nthread;       //  Number of threads (reduction)
+} job_t;
+
+//
+//  Run fn on n jobs splitting [0,count) evenly
+//
+static void Split(void* (*fn)(void*),job_t job[],int n,int count)
+{
+   int k;
+   for (k=0;k<n;k++)
+   {
+      job[k].beg = (long long)count*k/n;
+      job[k].end = (long long)count*(k+1)/n;
+   }
+   Parallel(fn,job,sizeof(job_t),n);
+}
+
+//
+//  Vector helpers
+//
+static float Dot(const float a[3],const float b[3])
+{
+   return a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+}
+static void Cross(float c[3],const float a[3],const float b[3])
+{
+   c[0] = a[1]*b[2]-a[2]*b[1];
+   c[1] = a[2]*b[0]-a[0]*b[2];
+   c[2] = a[0]*b[1]-a[1]*b[0];
+}
+static float Normalize(float v[3])
+{
+   float l = sqrt(Dot(v,v));
+   if (l>0)
+   {
+      v[0] /= l;
+      v[1] /= l;
+      v[2] /= l;
+   }
+   return l;
+}
+//  Angle between a-o and b-o
+static float Angle(const float o[3],const float a[3],const float b[3])
+{
+   float u[3] = {a[0]-o[0],a[1]-o[1],a[2]-o[2]};
+   float v[3] = {b[0]-o[0],b[1]-o[1],b[2]-o[2]};
+   float c;
+   if (Normalize(u)==0 || Normalize(v)==0) return 0;
+   c = Dot(u,v);
+   return acos(c<-1 ? -1 : c>1 ? 1 : c);
+}
+
+//
+//  Face normals, areas and corner angles (one thread)
+//    The normal of a polygon is found with Newell's method, whose length
+//    is twice the area
+//    Faces with missing or broken normals are marked
+//
+static void* FaceNormals(void* arg)
+{
+   job_t* job = (job_t*)arg;
+   const obj_t* obj = job->obj;
+   int f,k;
+   for (f=job->beg;f<job->end;f++)
+   {
+      float* n = job->fn+3*f;
+      int c0 = obj->face[f];
+      int nc = obj->face[f+1]-c0;
+      n[0] = n[1] = n[2] = 0;
+      for (k=0;k<nc;k++)
+      {
+         const int* K = obj->corner+3*(c0+k);
+         const int* L = obj->corner+3*(c0+(k+1)%nc);
+         const int* J = obj->corner+3*(c0+(k+nc-1)%nc);
+         const float* p = obj->V+3*(K[0]-1);
+         const float* q = obj->V+3*(L[0]-1);
+         job->cf[c0+k] = f;
+         job->cw[c0+k] = 0;
+         if (!K[0] || !L[0] || !J[0]) continue;
+         n[0] += (p[1]-q[1])*(p[2]+q[2]);
+         n[1] += (p[2]-q[2])*(p[0]+q[0]);
+         n[2] += (p[0]-q[0])*(p[1]+q[1]);
+         job->cw[c0+k] = Angle(p,q,obj->V+3*(J[0]-1));
+      }
+      job->fa[f] = 0.5*Normalize(n);
+      //  Normals are broken when missing, not finite, zero or pointing away
+      for (k=c0;k<c0+nc && !job->need[f];k++)
+      {
+         const int* K = obj->corner+3*k;
+         const float* v = K[2] ? obj->N+3*(K[2]-1) : NULL;
+         if (K[0] && (!v || !(Dot(v,v)>0 && Dot(v,v)<1e30) || Dot(v,n)<0)) job->need[f] = 1;
+      }
+   }
+   return NULL;
+}
+
+//
+//  Compare the face normals of two corners
+//
+static int NormalCmp(const job_t* job,int c,int d)
+{
+   const float* a = job->fn+3*job->cf[c];
+   const float* b = job->fn+3*job->cf[d];
+   int k;
+   for (k=0;k<3;k++)
+      if (a[k]!=b[k]) return a[k]<b[k] ? -1 : 1;
+   return 0;
+}
+
+//
+//  Sort the corners of a vertex by face normal (Shell sort)
+//
+static void SortCorners(const job_t* job,int* c,int n)
+{
+   int gap,i,j;
+   for (gap=1;gap<n/3;gap=3*gap+1);
+   for (;gap>0;gap/=3)
+      for (i=gap;i<n;i++)
+      {
+         int x = c[i];
+         for (j=i;j>=gap && NormalCmp(job,c[j-gap],x)>0;j-=gap)
+            c[j] = c[j-gap];
+         c[j] = x;
+      }
+}
+
+//
+//  Smooth normal of each corner of the faces needing them (one thread)
+//    Sums the normals of the faces around the vertex within the crease
+//    angle of the face of the corner, weighted by area and corner angle
+//    Corners are sorted by face normal so faces with the same normal,
+//    which get the same sum, share the work
+//
+static void* CornerNormals(void* arg)
+{
+   job_t* job = (job_t*)arg;
+   int v,i,j;
+   for (v=job->beg;v<job->end;v++)
+   {
+      int* adj = job->adj+job->first[v];
+      int n = job->first[v+1]-job->first[v];
+      int prev = -1;   //  Corner whose sum was found last
+      SortCorners(job,adj,n);
+      for (i=0;i<n;i++)
+      {
+         int c = adj[i];
+         const float* nf = job->fn+3*job->cf[c];
+         float* out = job->out+3*c;
+         if (!job->need[job->cf[c]]) continue;
+         //  Same face normal, or every face is within the crease angle
+         if (prev>=0 && (job->cosc<=-1 || !NormalCmp(job,prev,c)))
+         {
+            memcpy(out,job->out+3*prev,3*sizeof(float));
+            continue;
+         }
+         out[0] = out[1] = out[2] = 0;
+         for (j=0;j<n;j++)
+         {
+            int d = adj[j];
+            int g = job->cf[d];
+            const float* ng = job->fn+3*g;
+            float w = job->fa[g]*job->cw[d];
+            if (Dot(nf,ng)<job->cosc) continue;
+            out[0] += w*ng[0];
+            out[1] += w*ng[1];
+            out[2] += w*ng[2];
+         }
+         if (Normalize(out)==0) memcpy(out,nf,3*sizeof(float));
+         prev = c;
+      }
+   }
+   return NULL;
+}
+
+/*
+ *  Give faces without normals smooth normals
+ *    Faces with missing, zero, non-finite or reversed normals get new ones,
+ *    or every face does when all is set
+ *    Faces meeting at more than crease degrees keep a sharp edge
+ *    The normals are added to obj->N and the corners set to use them
+ */
+void BuildNormals(obj_t* obj,float crease,int all)
+{
+   int f,k,v,n;
+   int nthread;
+   job_t job[MAXTHREADS];
+   job_t base;
+   int* idx;         //  Normal index of each corner
+   int nn;           //  Normals kept
+
+   if (obj->nc==0) return;
+   memset(&base,0,sizeof(base));
+   base.obj   = obj;
+   base.cosc  = cos(3.14159265358979/180*(crease<0 ? 0 : crease>180 ? 180 : crease));
+   base.fn    = (float*)malloc(3*sizeof(float)*((size_t)obj->nf+1));
+   base.fa    = (float*)malloc(sizeof(float)*((size_t)obj->nf+1));
+   base.need  = (char*)malloc((size_t)obj->nf+1);
+   base.cw    = (float*)malloc(sizeof(float)*((size_t)obj->nc+1));
+   base.cf    = (int*)malloc(sizeof(int)*((size_t)obj->nc+1));
+   base.out   = (float*)malloc(3*sizeof(float)*((size_t)obj->nc+1));
+   base.first = (int*)calloc((size_t)obj->nv+2,sizeof(int));
+   base.adj   = (int*)malloc(sizeof(int)*((size_t)obj->nc+1));
+   idx        = (int*)malloc(sizeof(int)*((size_t)obj->nc+1));
+   if (!base.fn || !base.fa || !base.need || !base.cw || !base.cf || !base.out || !base.first || !base.adj || !idx)
+      Fatal("Cannot allocate memory for normals\n");
+   memset(base.need,all?1:0,obj->nf);
+
+   //  Face normals
+   nthread = Threads(obj->nf,MINWORK);
+   for (k=0;k<nthread;k++)
+      job[k] = base;
+   Split(FaceNormals,job,nthread,obj->nf);
+
+   //  Corners of each vertex (counting sort)
+   for (k=0;k<obj->nc;k++)
+      if (obj->corner[3*k])
+         base.first[obj->corner[3*k]+1]++;
+   for (v=1;v<=obj->nv+1;v++)
+      base.first[v] += base.first[v-1];
+   for (k=0;k<obj->nc;k++)
+      if (obj->corner[3*k])
+         base.adj[base.first[obj->corner[3*k]]++] = k;
+   for (v=obj->nv+1;v>0;v--)
+      base.first[v] = base.first[v-1];
+   base.first[0] = 0;
+
+   //  Smooth normals of the corners of each vertex
+   nthread = Threads(obj->nv+1,MINWORK);
+   for (k=0;k<nthread;k++)
+      job[k] = base;
+   Split(CornerNormals,job,nthread,obj->nv+1);
+
+   //  Corners of a vertex with the same normal share it
+   //    The corners are still sorted by face normal, so corners with the
+   //    same normal are next to each other and only neighbours are compared
+   nn = all ? 0 : obj->nn;
+   for (n=v=0;v<=obj->nv;v++)
+   {
+      int prev = -1;   //  Last corner given a normal
+      for (k=base.first[v];k<base.first[v+1];k++)
+      {
+         int c = base.adj[k];
+         if (!base.need[base.cf[c]]) continue;
+         if (prev>=0 && !memcmp(base.out+3*c,base.out+3*prev,3*sizeof(float)))
+            idx[c] = idx[prev];
+         else
+            idx[c] = nn+n++;
+         prev = c;
+      }
+   }
+   if (all)
+   {
+      free(obj->N);
+      obj->N = NULL;
+   }
+   obj->N = (float*)realloc(obj->N,3*sizeof(float)*((size_t)nn+n+1));
+   if (!obj->N) Fatal("Cannot allocate memory for normals\n");
+   for (f=0;f<obj->nf;f++)
+      for (k=obj->face[f];k<obj->face[f+1];k++)
+         if (base.need[f] && obj->corner[3*k])
+         {
+            memcpy(obj->N+3*idx[k],base.out+3*k,3*sizeof(float));
+            obj->corner[3*k+2] = idx[k]+1;
+         }
+   obj->nn = nn+n;
+
+   free(base.fn);
+   free(base.fa);
+   free(base.need);
+   free(base.cw);
+   free(base.cf);
+   free(base.out);
+   free(base.first);
+   free(base.adj);
+   free(idx);
+}
+
+//
+//  Sum triangle tangents and bitangents per vertex (one thread)
+//
+static void* TriangleTangents(void* arg)
+{
+   job_t* job = (job_t*)arg;
+   const mesh_t* mesh = job->mesh;
+   int t,k,i;
+   memset(job->acc,0,6*sizeof(float)*mesh->nvert);
+   for (t=job->beg;t<job->end;t++)
+   {
+      const unsigned int* ind = mesh->ind+3*t;
+      const float* p[3];
+      float e1[3],e2[3],T[3],B[3];
+      float du1,dv1,du2,dv2,r;
+      for (k=0;k<3;k++)
+         p[k] = mesh->vert+8*ind[k];
+      for (k=0;k<3;k++)
+      {
+         e1[k] = p[1][k]-p[0][k];
+         e2[k] = p[2][k]-p[0][k];
+      }
+      du1 = p[1][6]-p[0][6];
+      dv1 = p[1][7]-p[0][7];
+      du2 = p[2][6]-p[0][6];
+      dv2 = p[2][7]-p[0][7];
+      r = du1*dv2-du2*dv1;
+      if (r==0) continue;
+      for (k=0;k<3;k++)
+      {
+         T[k] = (e1[k]*dv2-e2[k]*dv1)/r;
+         B[k] = (e2[k]*du1-e1[k]*du2)/r;
+      }
+      //  Project onto the plane of each corner normal, weighted by angle
+      for (i=0;i<3;i++)
+      {
+         const float* n = p[i]+3;
+         float* acc = job->acc+6*ind[i];
+         float w = Angle(p[i],p[(i+1)%3],p[(i+2)%3]);
+         float d = Dot(n,T);
+         float u[3] = {T[0]-d*n[0],T[1]-d*n[1],T[2]-d*n[2]};
+         if (Normalize(u)==0) continue;
+         for (k=0;k<3;k++)
+         {
+            acc[k]   += w*u[k];
+            acc[3+k] += w*B[k];
+         }
+      }
+   }
+   return NULL;
+}
+
+//
+//  Add up the sums of the threads and finish each tangent (one thread)
+//
+static void* FinishTangents(void* arg)
+{
+   job_t* job = (job_t*)arg;
+   mesh_t* mesh = job->mesh;
+   int v,k,i;
+   for (v=job->beg;v<job->end;v++)
+   {
+      const float* n = mesh->vert+8*v+3;
+      float* tan = mesh->tan+4*v;
+      float T[3]={0,0,0},B[3]={0,0,0},c[3],d;
+      for (i=0;i<job->nthread;i++)
+         for (k=0;k<3;k++)
+         {
+            T[k] += job->part[i][6*v+k];
+            B[k] += job->part[i][6*v+3+k];
+         }
+      //  Orthogonal to the normal (any such direction if there is no tangent)
+      d = Dot(n,T);
+      for (k=0;k<3;k++)
+         T[k] -= d*n[k];
+      if (Normalize(T)==0)
+      {
+         float a[3] = {fabs(n[0])<0.9 ? 1 : 0,fabs(n[0])<0.9 ? 0 : 1,0};
+         Cross(T,n,a);
+         if (Normalize(T)==0) T[0] = 1;
+      }
+      Cross(c,n,T);
+      memcpy(tan,T,3*sizeof(float));
+      tan[3] = Dot(c,B)<0 ? -1 : 1;
+   }
+   return NULL;
+}
+
+/*
+ *  Build a tangent for each vertex of a mesh from its texture coordinates
+ *    mesh->tan gets four floats per vertex: the tangent (xyz) and the
+ *    handedness (w) of the bitangent, which is w * cross(normal,tangent)
+ *    Call after OptimizeMesh, which moves the tangents with the vertexes
+ */
+void BuildTangents(mesh_t* mesh)
+{
+   int k;
+   int ntri = mesh->nind/3;
+   int nthread = Threads(ntri,MINWORK);
+   job_t job[MAXTHREADS];
+   float* part[MAXTHREADS];
+
+   free(mesh->tan);
+   mesh->tan = (float*)malloc(4*sizeof(float)*((size_t)mesh->nvert+1));
+   if (!mesh->tan) Fatal("Cannot allocate memory for tangents\n");
+   //  Each thread sums its triangles into its own array
+   memset(job,0,sizeof(job));
+   for (k=0;k<nthread;k++)
+   {
+      part[k] = (float*)malloc(6*sizeof(float)*((size_t)mesh->nvert+1));
+      if (!part[k]) Fatal("Cannot allocate memory for tangents\n");
+      job[k].mesh = mesh;
+      job[k].acc  = part[k];
+   }
+   Split(TriangleTangents,job,nthread,ntri);
+   //  Reduction
+   for (k=0;k<nthread;k++)
+   {
+      job[k].part = part;
+      job[k].nthread = nthread;
+   }
+   Split(FinishTangents,job,nthread,mesh->nvert);
+   for (k=0;k<nthread;k++)
+      free(part[k]);
+   mesh->attr |= MESH_TANGENT;
+}
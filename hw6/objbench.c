@@ -0,0 +1,290 @@
+/*
+ *  Benchmark the OBJ parser
+ *
+ *  Usage: objbench [-n runs] [-t threads] [-o] [-l levels] [-s limit] [-g crease] [-b rays] [-q] [-m] [file.obj ...]
+ *    -n  number of runs per file, the fastest is reported (default 3)
+ *    -t  number of parser threads (default one per core)
+ *    -o  optimize the mesh and report vertex cache misses for each step
+ *    -l  build levels of detail and report their triangles and error
+ *    -s  also convert with StreamOBJ using at most limit bytes (suffix k or M)
+ *    -g  generate normals of every face with the crease angle, and tangents
+ *    -b  build a BVH and time rays through the bounding sphere
+ *    -q  quantize the vertexes and report the bytes saved and the errors
+ *    -m  build meshlets and report the triangles culled from six views
+ *  Without files, sphere meshes of increasing size are generated in
+ *  objbench.obj and parsed.  Reports the parse rate in MB/s and in vertexes
+ *  per second, and how far welding shrinks the vertexes of the mesh.
+ */
+#include "CSCIx229.h"
+#include <sys/time.h>
+
+//
+//  Time in seconds
+//
+static double Now(void)
+{
+   struct timeval t;
+   gettimeofday(&t,NULL);
+   return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+//
+//  Write a sphere with n bands of 2n quads as an OBJ file
+//
+static void Sphere(const char* file,int n)
+{
+   int i,j;
+   FILE* f = fopen(file,"w");
+   if (!f) Fatal("Cannot create %s\n",file);
+   fprintf(f,"# objbench sphere %d\n",n);
+   for (i=0;i<=n;i++)
+      for (j=0;j<=2*n;j++)
+      {
+         double th = 3.14159265358979*j/n;
+         double ph = 3.14159265358979*i/n - 1.57079632679490;
+         double x = cos(ph)*sin(th), y = sin(ph), z = cos(ph)*cos(th);
+         fprintf(f,"v %.6f %.6f %.6f\n",x,y,z);
+         fprintf(f,"vt %.6f %.6f\n",0.5*j/n,(double)i/n);
+         fprintf(f,"vn %.6f %.6f %.6f\n",x,y,z);
+      }
+   for (i=0;i<n;i++)
+      for (j=0;j<2*n;j++)
+      {
+         int a = i*(2*n+1)+j+1;
+         int b = a+2*n+1;
+         fprintf(f,"f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",a,a,a,a+1,a+1,a+1,b+1,b+1,b+1,b,b,b);
+      }
+   if (fclose(f)) Fatal("Error writing %s\n",file);
+}
+
+//
+//  Convert a file with StreamOBJ and report the memory used
+//
+static void Stream(const char* file,unsigned long limit)
+{
+   objstats_t s0,s1;
+   unsigned long bytes;
+   double t;
+   OBJStats(&s0);
+   t = Now();
+   bytes = StreamOBJ(file,"objbench.cmesh",limit);
+   t = Now()-t;
+   OBJStats(&s1);
+   printf("   streamed to %.1f MB in %.3f s using %lu KB (limit %lu KB) %lu page reads\n",
+      1e-6*bytes,t,s1.peak>>10,limit>>10,s1.pages-s0.pages);
+   remove("objbench.cmesh");
+}
+
+//
+//  Build meshlets and cull them looking at the mesh along each axis
+//    The eye is 2.5 radiuses from the center with a 50 degree field of view
+//
+static void Meshlets(mesh_t* mesh)
+{
+   int k,i,ntri=0;
+   double t,nv=0;
+   meshlets_t ml;
+   float P[16] = {0};
+   double n=0.1*mesh->radius,f=10*mesh->radius,cot=1/tan(25*M_PI/180);
+   t = Now();
+   BuildMeshlets(mesh,&ml);
+   t = Now()-t;
+   for (k=0;k<ml.nmeshlet;k++)
+      nv += ml.meshlet[k].nvert;
+   printf("   %d meshlets of %.1f vertexes %.1f triangles in %.3f s\n",ml.nmeshlet,
+      ml.nmeshlet ? nv/ml.nmeshlet : 0.0,ml.nmeshlet ? mesh->nind/3.0/ml.nmeshlet : 0.0,t);
+   P[0] = P[5] = cot;
+   P[10] = (f+n)/(n-f);
+   P[11] = -1;
+   P[14] = 2*f*n/(n-f);
+   t = Now();
+   for (k=0;k<6;k++)
+   {
+      //  Eye on the side of the mesh axis a points to (or away from)
+      float M[16] = {0};
+      int a = k/2,b = (a+1)%3,c = (a+2)%3;
+      float s = (k&1) ? -1 : 1;
+      M[4*b]   = s;
+      M[4*c+1] = 1;
+      M[4*a+2] = s;
+      M[15]    = 1;
+      for (i=0;i<3;i++)
+         M[12+i] = -(M[i]*mesh->center[0]+M[4+i]*mesh->center[1]+M[8+i]*mesh->center[2]);
+      M[14] -= 2.5*mesh->radius;
+      ntri += CullMeshlets(mesh,&ml,M,P,1);
+   }
+   t = Now()-t;
+   printf("   culling keeps %.1f%% of triangles in %.0f draws (%.1f us per view)\n",
+      mesh->nind ? 100.0*ntri/(6*mesh->nind/3.0) : 0.0,0.0+ml.ndraw,1e6*t/6);
+   FreeMeshlets(&ml);
+}
+
+//
+//  Parse a file and report the fastest run
+//
+static void Bench(const char* file,int runs,int opt,int lod,unsigned long limit,float crease,int rays,int quant,int meshlet)
+{
+   int k;
+   double t,best=1e30;
+   obj_t obj;
+   mesh_t mesh;
+   objmem_t mem;
+   for (k=0;k<runs;k++)
+   {
+      t = Now();
+      ParseOBJ(file,&obj);
+      t = Now()-t;
+      if (t<best) best = t;
+      if (k<runs-1) FreeOBJ(&obj);
+   }
+   if (best<=0) best = 1e-6;
+   printf("%s: %.1f MB %d vertexes %d faces %.3f s %.1f MB/s %.2f Mvertex/s\n",
+      file,1e-6*obj.bytes,obj.nv,obj.nf,best,1e-6*obj.bytes/best,1e-6*obj.nv/best);
+   //  Memory of the parsed file
+   OBJMemory(&mem);
+   printf("   %.1f MB of arrays, %lu names in %lu arena chunks (%lu KB)\n",
+      1e-6*mem.arrays,mem.names,mem.chunks,mem.arena>>10);
+   //  Generate normals
+   if (crease>=0)
+   {
+      t = Now();
+      BuildNormals(&obj,crease,1);
+      t = Now()-t;
+      printf("   generated %d normals in %.3f s\n",obj.nn,t);
+   }
+   //  Weld corners into mesh vertexes
+   t = Now();
+   BuildMesh(&obj,NULL,&mesh);
+   t = Now()-t;
+   printf("   welded %d corners to %d vertexes (%.2fx) in %.3f s\n",
+      mesh.ncorner,mesh.nvert,mesh.nvert ? (double)mesh.ncorner/mesh.nvert : 0.0,t);
+   //  Optimize triangle order
+   if (opt)
+   {
+      const char* step[4] = {"loaded","vertex cache","overdraw","vertex fetch"};
+      meshopt_t stats;
+      t = Now();
+      OptimizeMesh(&mesh,&stats);
+      t = Now()-t;
+      printf("   optimized in %.3f s\n",t);
+      for (k=0;k<4;k++)
+         printf("   %-12s ACMR %.3f ATVR %.3f\n",step[k],stats.acmr[k],stats.atvr[k]);
+   }
+   //  Simplify
+   if (lod)
+   {
+      t = Now();
+      BuildMeshLOD(&mesh,lod,NULL);
+      t = Now()-t;
+      printf("   %d levels of detail in %.3f s\n",mesh.nlod,t);
+      for (k=0;k<mesh.nlod;k++)
+         printf("   level %d %d triangles (%.1f%%) error %g\n",k+1,mesh.lod[k].nind/3,
+            100.0*mesh.lod[k].nind/mesh.nind,mesh.lod[k].error);
+   }
+   //  Bounding volume hierarchy
+   if (rays)
+   {
+      bvh_t bvh;
+      bvhhit_t hit;
+      int hits=0;
+      t = Now();
+      BuildBVH(&mesh,&bvh);
+      t = Now()-t;
+      printf("   BVH of %d nodes in %.3f s\n",bvh.nnode,t);
+      //  Rays from the bounding sphere towards points inside it
+      srand(1);
+      t = Now();
+      for (k=0;k<rays;k++)
+      {
+         float org[3],dir[3];
+         int i;
+         for (i=0;i<3;i++)
+         {
+            org[i] = mesh.center[i] + 2*mesh.radius*(2.0*rand()/RAND_MAX-1);
+            dir[i] = mesh.center[i] + mesh.radius*(rand()/(double)RAND_MAX-0.5) - org[i];
+         }
+         hits += BVHRay(&bvh,org,dir,1e30,&hit);
+      }
+      t = Now()-t;
+      printf("   %d rays %d hits %.2f Mrays/s\n",rays,hits,t>0 ? 1e-6*rays/t : 0.0);
+      FreeBVH(&bvh);
+   }
+   //  Tangents
+   if (crease>=0)
+   {
+      t = Now();
+      BuildTangents(&mesh);
+      t = Now()-t;
+      printf("   tangents in %.3f s\n",t);
+   }
+   //  Meshlets
+   if (meshlet) Meshlets(&mesh);
+   //  Quantize
+   if (quant)
+   {
+      meshquant_t err;
+      QuantizeMesh(&mesh,&err);
+      printf("   quantized %d to %d bytes per vertex (%.1fx) error position %g normal %.3f deg uv %g\n",
+         err.stride[0],err.stride[1],(double)err.stride[0]/err.stride[1],err.pos,err.normal,err.uv);
+   }
+   FreeMesh(&mesh);
+   FreeOBJ(&obj);
+   //  Stream
+   if (limit) Stream(file,limit);
+}
+
+//
+//  Main program
+//
+int main(int argc,char* argv[])
+{
+   int k,runs=3,opt=0,lod=0;
+   unsigned long limit=0;
+   float crease=-1;
+   int rays=0,quant=0,meshlet=0;
+   for (k=1;k<argc && argv[k][0]=='-';k++)
+   {
+      if (!strcmp(argv[k],"-n") && k+1<argc)
+         runs = atoi(argv[++k]);
+      else if (!strcmp(argv[k],"-t") && k+1<argc)
+         OBJThreads(atoi(argv[++k]));
+      else if (!strcmp(argv[k],"-o"))
+         opt = 1;
+      else if (!strcmp(argv[k],"-l") && k+1<argc)
+         lod = atoi(argv[++k]);
+      else if (!strcmp(argv[k],"-s") && k+1<argc)
+      {
+         char* end;
+         limit = strtoul(argv[++k],&end,10);
+         if (*end=='k' || *end=='K') limit <<= 10;
+         if (*end=='m' || *end=='M') limit <<= 20;
+      }
+      else if (!strcmp(argv[k],"-g") && k+1<argc)
+         crease = atof(argv[++k]);
+      else if (!strcmp(argv[k],"-b") && k+1<argc)
+         rays = atoi(argv[++k]);
+      else if (!strcmp(argv[k],"-q"))
+         quant = 1;
+      else if (!strcmp(argv[k],"-m"))
+         meshlet = 1;
+      else
+         Fatal("Usage: %s [-n runs] [-t threads] [-o] [-l levels] [-s limit] [-g crease] [-b rays] [-q] [-m] [file.obj ...]\n",argv[0]);
+   }
+   if (runs<1) runs = 1;
+   //  Files given
+   if (k<argc)
+      for (;k<argc;k++)
+         Bench(argv[k],runs,opt,lod,limit,crease,rays,quant,meshlet);
+   //  Generated meshes
+   else
+   {
+      int n;
+      for (n=64;n<=1024;n*=4)
+      {
+         Sphere("objbench.obj",n);
+         Bench("objbench.obj",runs,opt,lod,limit,crease,rays,quant,meshlet);
+      }
+      remove("objbench.obj");
+   }
+   return 0;
+}
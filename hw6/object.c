@@ -1,6 +1,10 @@
 #include "CSCIx229.h"
 #include <ctype.h>
 
+#define MINCHUNK (1<<20)   //  Smallest piece of a file worth a thread
+#define PAGE 1024          //  Coordinates per page streamed by StreamOBJ
+#define MINSTREAM (1<<20)  //  Smallest memory limit of StreamOBJ
+
 //  Load an OBJ file
 //  Vertex, Normal and Texture coordinates are supported
 //  Materials are supported
@@ -16,126 +20,319 @@
 //  WARNING:  There are lots of really broken OBJ files on the internet.  Some
 //  files may have correct surfaces, but the normals are complete junk and so
 //  the lighting is totally broken.  So beware of which OBJ files you use.
+//
+//  The file is parsed in place from a memory mapping by ParseOBJ, which makes
+//  no OpenGL calls, and LoadOBJ then compiles the display list from the
+//  parsed file.  Numbers are converted by hand since sscanf dominates the
+//  load time of large files.  Large files are split into pieces that are
+//  parsed on separate threads and joined in file order, so the result is
+//  the same as parsing serially.  Both loaders save the model in a binary
+//  mesh cache next to the file and load that instead while the OBJ and MTL
+//  files are unchanged.
+//
+//  The names in material statements are kept in an arena that is freed in
+//  one go with the parsed file rather than allocated one at a time.
+//
+//  Materials are found by name with a hash table, and faces are grouped by
+//  material so each material is set once per draw however often the file
+//  switches between them.
+//
+//  Faces without usable normals can be given smooth ones (OBJNormals),
+//  since many files have missing or broken normals and the lighting is
+//  wrong without them.
+//
+//  Files too large to hold in memory are converted to a .cmesh file by
+//  StreamOBJ in two passes.  The first reads the text through a fixed window
+//  and spills the coordinates and faces to temporary files, noting the last
+//  face that uses each page of coordinates.  The second welds the faces
+//  through a fixed size table and writes the vertexes and indexes to
+//  temporary files, keeping a few pages of coordinates in memory and
+//  dropping first those no later face uses.
 
-//  Material structure
+#define NHASH 1024  //  Number of material hash buckets (power of two)
+
+//  Material count, array and size of the array
+static int Nmtl=0;
+static material_t* mtl=NULL;
+static int Mmtl=0;
+//  Material hash table (indexes plus one, 0 ends a chain)
+static int mhead[NHASH];   //  First material in each bucket
+static int* mnext=NULL;    //  Next material in the same bucket
+//  Material counters
+static objstats_t stats;
+//  Bounds of the display lists made by LoadOBJ
 typedef struct
 {
-   char* name;                 //  Material name
-   float Ka[4],Kd[4],Ks[4],Ns; //  Colors and shininess
-   float d;                    //  Transparency
-   int map;                    //  Texture
-} mtl_t;
+   int list;
+   bounds_t b;
+} listbounds_t;
+static int Nlist=0,Mlist=0;
+static listbounds_t* lbounds=NULL;
+//  Memory of the last file parsed
+static objmem_t mem;
 
-//  Material count and array
-static int Nmtl=0;
-static mtl_t* mtl=NULL;
+//  Piece of an OBJ file parsed by one thread
+typedef struct
+{
+   const char* beg;  //  Start of text
+   const char* end;  //  End of text
+   int   check;      //  Check indexes as they are read
+   int   bad;        //  Negative index seen (when not checking)
+   int   excess[3];  //  Largest index less the number read before it (when not checking)
+   obj_t obj;        //  Contents of this piece
+} chunk_t;
+
+//  Coordinates spilled to a temporary file by StreamOBJ
+typedef struct
+{
+   FILE*  f;             //  Temporary file
+   int    n;             //  Floats per coordinate
+   int    count;         //  Number of coordinates
+   int    npage;         //  Number of pages
+   int    M;             //  Pages allocated
+   int*   last;          //  Last face using each page (-1 if none)
+   int*   slot;          //  Slot holding each page (-1 if not loaded)
+   int    nslot;         //  Number of pages kept in memory
+   int*   page;          //  Page in each slot (-1 if empty)
+   unsigned long* used;  //  When each slot was last used
+   float* data;          //  Contents of the slots
+} pages_t;
+
+//  State of the first pass of StreamOBJ
+typedef struct
+{
+   pages_t a[3];   //  Vertexes, texture coordinates and normals
+   FILE*   face;   //  Faces: corners with a vertex, then their index triplets
+   obj_t   ops;    //  Material statements (nf counts the faces)
+   int     Mo;     //  Statements allocated
+   int*    K;      //  Index triplets of the current face
+   int     Mk;     //  Triplets allocated
+   int     nc;     //  Corners with a vertex
+} stream_t;
+
+//  Weld table slot of StreamOBJ
+typedef struct
+{
+   int K[3];  //  Vertex, texture and normal index
+   int v;     //  Mesh vertex (-1 if the slot is empty)
+} weld_t;
+
+//  Parser threads selected with OBJThreads
+static int nthread=0;
+//  Optimize triangle order of meshes (OBJOptimize)
+static int optimize=0;
+//  Levels of detail built for meshes (OBJLOD)
+static int nlod=0;
+//  Generated normals and tangents and crease angle (OBJNormals)
+static int normals=0;
+static float crease=0;
+//  Quantize vertexes of meshes (OBJQuantize)
+static int quantize=0;
+
+//  Exact powers of ten
+static const double tens[23] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+                                 1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
 
 //
-//  Return true if CR or LF
+//  Return true if space or tab (lines never contain CR or LF)
 //
-static int CRLF(char ch)
+static int Space(char ch)
 {
-   return ch == '\r' || ch == '\n';
+   return ch==' ' || ch=='\t' || ch=='\v' || ch=='\f';
 }
 
 //
-//  Read line from file
-//    Returns pointer to line or NULL on EOF
+//  Find next line
+//    p is the current position and end the end of the file
+//    Sets the line to [*beg,*eol) and returns the position after it, or
+//    NULL at the end of the file.  Empty lines are skipped.
 //
-static int linelen=0;    //  Length of line
-static char* line=NULL;  //  Internal storage for line
-static char* readline(FILE* f)
+static const char* NextLine(const char* p,const char* end,const char** beg,const char** eol)
 {
-   char ch;  //  Character read
-   int k=0;  //  Character count
-   while ((ch = fgetc(f)) != EOF)
+   const char* e;
+   const char* cr;
+   //  Skip CR and LF
+   while (p<end && (*p=='\r' || *p=='\n'))
+      p++;
+   if (p==end) return NULL;
+   //  Line ends at LF or at CR for files with Mac line endings
+   e = (const char*)memchr(p,'\n',end-p);
+   if (!e) e = end;
+   cr = (const char*)memchr(p,'\r',e-p);
+   if (cr) e = cr;
+   *beg = p;
+   *eol = e;
+   return e;
+}
+
+//
+//  Skip to next word
+//    Returns NULL if there are no more words on the line
+//
+static const char* NextWord(const char* p,const char* e)
+{
+   while (p<e && Space(*p))
+      p++;
+   return p<e ? p : NULL;
+}
+
+//
+//  Skip to end of word
+//
+static const char* EndWord(const char* p,const char* e)
+{
+   while (p<e && !Space(*p))
+      p++;
+   return p;
+}
+
+//
+//  Copy word to a new string
+//
+static char* CopyWord(const char* p,const char* e)
+{
+   int n = EndWord(p,e)-p;
+   char* str = (char*)malloc(n+1);
+   if (!str) Fatal("Cannot allocate %d for name\n",n+1);
+   memcpy(str,p,n);
+   str[n] = 0;
+   return str;
+}
+
+//
+//  Convert a decimal number
+//    Plain numbers with up to 15 digits are converted exactly with one
+//    multiplication or division.  Anything else (long mantissas, large
+//    exponents, inf, nan, hex) is left to strtod.
+//    Returns pointer past the number or NULL if the word is not a number
+//
+static const char* ParseFloat(const char* p,const char* e,float* x)
+{
+   const char* s = p;
+   unsigned long long m=0;  //  Significant digits
+   int nd=0;                //  Number of significant digits
+   int digits=0;            //  Number of digits seen
+   int exp=0;               //  Decimal exponent
+   int neg=0;
+   double v;
+   //  Sign
+   if (p<e && (*p=='-' || *p=='+')) neg = (*p++=='-');
+   //  Integer part
+   for (;p<e && isdigit((unsigned char)*p);p++,digits++)
    {
-      //  Allocate more memory for long strings
-      if (k>=linelen)
+      if (nd<19)
       {
-         linelen += 8192;
-         line = (char*)realloc(line,linelen);
-         if (!line) Fatal("Out of memory in readline\n");
+         m = 10*m + (*p-'0');
+         if (m) nd++;
       }
-      //  End of Line
-      if (CRLF(ch))
+      else
+         exp++;
+   }
+   //  Fraction
+   if (p<e && *p=='.')
+      for (p++;p<e && isdigit((unsigned char)*p);p++,digits++)
+         if (nd<19)
+         {
+            m = 10*m + (*p-'0');
+            if (m) nd++;
+            exp--;
+         }
+   //  Exponent
+   if (digits && p+1<e && (*p=='e' || *p=='E'))
+   {
+      const char* q = p+1;
+      int eneg=0,ev=0;
+      if (q<e && (*q=='-' || *q=='+')) eneg = (*q++=='-');
+      if (q<e && isdigit((unsigned char)*q))
       {
-         // Eat extra CR or LF characters (if any)
-         while ((ch = fgetc(f)) != EOF)
-           if (!CRLF(ch)) break;
-         //  Stick back the overrun
-         if (ch != EOF) ungetc(ch,f);
-         //  Bail
-         break;
+         for (;q<e && isdigit((unsigned char)*q);q++)
+            if (ev<10000) ev = 10*ev + (*q-'0');
+         exp += eneg ? -ev : ev;
+         p = q;
       }
-      //  Pad character to line
-      else
-         line[k++] = ch;
    }
-   //  Terminate line if anything was read
-   if (k>0) line[k] = 0;
-   //  Return pointer to line or NULL on EOF
-   return k>0 ? line : NULL;
-}
-
-//
-//  Read to next non-whitespace word
-//  Note that this destroys line in the process
-//
-static char* getword(char** line)
-{
-   char* word;
-   //  Skip leading whitespace
-   while (**line && isspace(**line))
-      (*line)++;
-   if (!**line) return NULL;
-   //  Start of word
-   word = *line;
-   //  Read until next whitespace
-   while (**line && !isspace(**line))
-      (*line)++;
-   //  Mark end of word if not NULL
-   if (**line)
+   //  Fast path (the whole word must be the number)
+   if (digits && nd<=15 && exp>=-22 && exp<=22 && (p==e || Space(*p)))
+   {
+      v = exp<0 ? m/tens[-exp] : m*tens[exp];
+      *x = neg ? -v : v;
+      return p;
+   }
+   //  Slow path
+   else
    {
-      **line = 0;
-      (*line)++;
+      char buf[64];
+      char* q;
+      int n = EndWord(s,e)-s;
+      if (n>63) n = 63;
+      memcpy(buf,s,n);
+      buf[n] = 0;
+      v = strtod(buf,&q);
+      if (q==buf) return NULL;
+      *x = v;
+      return s+(q-buf);
    }
-   return word;
+}
+
+//
+//  Convert an integer
+//    Returns pointer past the number or NULL if there is none
+//
+static const char* ParseInt(const char* p,const char* e,int* k)
+{
+   int neg=0,v=0;
+   if (p<e && (*p=='-' || *p=='+')) neg = (*p++=='-');
+   if (p==e || !isdigit((unsigned char)*p)) return NULL;
+   for (;p<e && isdigit((unsigned char)*p);p++)
+      if (v<100000000) v = 10*v + (*p-'0');
+   *k = neg ? -v : v;
+   return p;
 }
 
 //
 //  Read n floats
 //
-static void readfloat(char* line,int n,float x[])
+static void readfloat(const char* p,const char* e,int n,float x[])
 {
    int i;
    for (i=0;i<n;i++)
    {
-      char* str = getword(&line);
-      if (!str)  Fatal("Premature EOL reading %d floats\n",n);
-      if (sscanf(str,"%f",x+i)!=1) Fatal("Error reading float %d\n",i);
+      p = NextWord(p,e);
+      if (!p) Fatal("Premature EOL reading %d floats\n",n);
+      p = ParseFloat(p,e,x+i);
+      if (!p) Fatal("Error reading float %d\n",i);
+      p = EndWord(p,e);
    }
 }
 
+//
+//  Make room for n more items in an array
+//    N is the number of items and M the number allocated
+//
+static void* Grow(void* x,int n,int N,int* M,size_t size)
+{
+   if (N+n <= *M) return x;
+   *M = *M ? 2*(*M) : 8192;
+   if (*M < N+n) *M = N+n;
+   x = realloc(x,(*M)*size);
+   if (!x) Fatal("Cannot allocate memory\n");
+   return x;
+}
+
 //
 //  Read coordinates
 //    n is how many coordiantes to read
 //    N is the coordinate index
 //    M is the number of coordinates
 //    x is the array
-//    This function adds more memory as needed in 8192 work chunks
+//    This function doubles the memory as needed
 //
-static void readcoord(char* line,int n,float* x[],int* N,int* M)
+static void readcoord(const char* p,const char* e,int n,float* x[],int* N,int* M)
 {
    //  Allocate memory if necessary
-   if (*N+n > *M)
-   {
-      *M += 8192;
-      *x = (float*)realloc(*x,(*M)*sizeof(float));
-      if (!*x) Fatal("Cannot allocate memory\n");
-   }
+   *x = (float*)Grow(*x,n,*N,M,sizeof(float));
    //  Read n coordinates
-   readfloat(line,n,(*x)+*N);
+   readfloat(p,e,n,(*x)+*N);
    (*N)+=n;
 }
 
@@ -143,53 +340,127 @@ static void readcoord(char* line,int n,float* x[],int* N,int* M)
 //  Read string conditionally
 //     Line must start with skip string
 //     After skip sting return first word
-//     getword terminates the line
 //
-static char* readstr(char* line,const char* skip)
+static const char* readstr(const char* p,const char* e,const char* skip)
 {
    //  Check for a match on the skip string
-   while (*skip && *line && *skip==*line)
+   while (*skip && p<e && *skip==*p)
    {
       skip++;
-      line++;
+      p++;
    }
    //  Skip must be NULL for a match
-   if (*skip || !isspace(*line)) return NULL;
+   if (*skip || p==e || !Space(*p)) return NULL;
    //  Read string
-   return getword(&line);
+   return NextWord(p,e);
+}
+
+//
+//  Read face corner
+//    Forms are v, v/t, v//n and v/t/n (0 for missing indexes)
+//    Returns pointer past the corner
+//
+static const char* readcorner(const char* p,const char* e,int K[3])
+{
+   const char* q = ParseInt(p,e,K);
+   if (!q) Fatal("Invalid facet %.*s\n",(int)(EndWord(p,e)-p),p);
+   K[1] = K[2] = 0;
+   if (q<e && *q=='/')
+   {
+      //  Texture index (empty for v//n)
+      const char* r = ParseInt(q+1,e,K+1);
+      q = r ? r : q+1;
+      //  Normal index
+      if (q<e && *q=='/' && (r=ParseInt(q+1,e,K+2))) q = r;
+   }
+   return EndWord(q,e);
+}
+
+//
+//  Hash a string (FNV-1a)
+//
+static unsigned int Hash(const char* str)
+{
+   unsigned int h = 2166136261u;
+   while (*str)
+      h = (h ^ (unsigned char)*str++) * 16777619u;
+   return h & (NHASH-1);
+}
+
+//
+//  Forget materials (the array belongs to the caller by now)
+//
+static void ResetMaterials(void)
+{
+   mtl  = NULL;
+   Nmtl = Mmtl = 0;
+   free(mnext);
+   mnext = NULL;
+   memset(mhead,0,sizeof(mhead));
+}
+
+//
+//  Find material by name
+//    Returns -1 if there is no such material
+//
+static int FindMaterial(const char* name)
+{
+   int k;
+   for (k=mhead[Hash(name)]-1;k>=0;k=mnext[k]-1)
+      if (!strcmp(mtl[k].name,name)) return k;
+   return -1;
 }
 
 //
 //  Load materials from file
+//    Textures are loaded when tex is set, otherwise only their file names
+//    are kept and no OpenGL calls are made
 //
-static void LoadMaterial(const char* file)
+static void LoadMaterial(const char* file,int tex)
 {
    int k=-1;
-   char* line;
-   char* str;
+   size_t len;
+   const char* map;
+   const char* p;
+   const char* line;
+   const char* e;
+   const char* str;
 
    //  Open file or return with warning on error
-   FILE* f = fopen(file,"r");
-   if (!f)
+   map = (const char*)MapFile(file,&len);
+   if (!map)
    {
       fprintf(stderr,"Cannot open material file %s\n",file);
       return;
    }
 
    //  Read lines
-   while ((line = readline(f)))
+   for (p=map;(p=NextLine(p,map+len,&line,&e));)
    {
       //  New material
-      if ((str = readstr(line,"newmtl")))
+      if ((str = readstr(line,e,"newmtl")))
       {
-         int l = strlen(str);
-         //  Allocate memory for structure
+         unsigned int h;
+         //  Allocate memory for structure (doubling the arrays)
+         if (Nmtl==Mmtl)
+         {
+            Mmtl = Mmtl ? 2*Mmtl : 16;
+            mtl = (material_t*)realloc(mtl,Mmtl*sizeof(material_t));
+            mnext = (int*)realloc(mnext,Mmtl*sizeof(int));
+            if (!mtl || !mnext) Fatal("Cannot allocate memory for materials\n");
+         }
          k = Nmtl++;
-         mtl = (mtl_t*)realloc(mtl,Nmtl*sizeof(mtl_t));
-         //  Store name
-         mtl[k].name = (char*)malloc(l+1);
-         if (!mtl[k].name) Fatal("Cannot allocate %d for name\n",l+1);
-         strcpy(mtl[k].name,str);
+         //  Store name and hash it unless the name is taken, since the
+         //  first material with a name is the one used
+         mtl[k].name = CopyWord(str,e);
+         mnext[k] = 0;
+         if (FindMaterial(mtl[k].name)<0)
+         {
+            h = Hash(mtl[k].name);
+            mnext[k] = mhead[h];
+            mhead[h] = k+1;
+         }
+         stats.materials++;
          //  Initialize materials
          mtl[k].Ka[0] = mtl[k].Ka[1] = mtl[k].Ka[2] = 0;   mtl[k].Ka[3] = 1;
          mtl[k].Kd[0] = mtl[k].Kd[1] = mtl[k].Kd[2] = 0;   mtl[k].Kd[3] = 1;
@@ -197,164 +468,1097 @@ static void LoadMaterial(const char* file)
          mtl[k].Ns  = 0;
          mtl[k].d   = 0;
          mtl[k].map = 0;
+         mtl[k].file = NULL;
       }
-      //  If no material short circuit here
-      else if (k<0)
+      //  If no material or line too short short circuit here
+      else if (k<0 || e-line<2)
       {}
       //  Ambient color
       else if (line[0]=='K' && line[1]=='a')
-         readfloat(line+2,3,mtl[k].Ka);
+         readfloat(line+2,e,3,mtl[k].Ka);
       //  Diffuse color
       else if (line[0]=='K' && line[1] == 'd')
-         readfloat(line+2,3,mtl[k].Kd);
+         readfloat(line+2,e,3,mtl[k].Kd);
       //  Specular color
       else if (line[0]=='K' && line[1] == 's')
-         readfloat(line+2,3,mtl[k].Ks);
+         readfloat(line+2,e,3,mtl[k].Ks);
       //  Material Shininess
       else if (line[0]=='N' && line[1]=='s')
-         readfloat(line+2,1,&mtl[k].Ns);
+         readfloat(line+2,e,1,&mtl[k].Ns);
       //  Textures (must be BMP - will fail if not)
-      else if ((str = readstr(line,"map_Kd")))
-         mtl[k].map = LoadTexBMP(str);
+      else if ((str = readstr(line,e,"map_Kd")))
+      {
+         free(mtl[k].file);
+         mtl[k].file = CopyWord(str,e);
+         if (tex) mtl[k].map = LoadTexBMP(mtl[k].file);
+      }
       //  Ignore line if we get here
    }
-   fclose(f);
+   UnmapFile(map,len);
 }
 
 //
-//  Set material
+//  Look up the material of each usemtl statement
+//    Unknown materials are -1 and the current material is kept
 //
-static void SetMaterial(const char* name)
+static int* LookupMaterials(const obj_t* obj)
 {
    int k;
-   //  Search materials for a matching name
-   for (k=0;k<Nmtl;k++)
-      if (!strcmp(mtl[k].name,name))
-      {
-         //  Set material colors
-         glMaterialfv(GL_FRONT_AND_BACK,GL_AMBIENT  ,mtl[k].Ka);
-         glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE  ,mtl[k].Kd);
-         glMaterialfv(GL_FRONT_AND_BACK,GL_SPECULAR ,mtl[k].Ks);
-         glMaterialfv(GL_FRONT_AND_BACK,GL_SHININESS,&mtl[k].Ns);
-         //  Bind texture if specified
-         if (mtl[k].map)
-         {
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D,mtl[k].map);
-         }
-         else
-            glDisable(GL_TEXTURE_2D);
-         return;
-      }
-   //  No matches
-   fprintf(stderr,"Unknown material %s\n",name);
+   int* use = (int*)malloc((obj->nop+1)*sizeof(int));
+   if (!use) Fatal("Cannot allocate memory\n");
+   for (k=0;k<obj->nop;k++)
+   {
+      use[k] = obj->op[k].type==OBJ_USEMTL ? FindMaterial(obj->op[k].name) : -1;
+      if (obj->op[k].type==OBJ_USEMTL && use[k]<0) fprintf(stderr,"Unknown material %s\n",obj->op[k].name);
+      if (use[k]>=0) stats.usemtl++;
+   }
+   return use;
 }
 
 //
-//  Load OBJ file
+//  Sort faces by material keeping file order for each material
+//    Returns the faces in drawing order
+//    The faces of material k are from first[k+1] to first[k+2]-1, and
+//    those before any material are from first[0] to first[1]-1
 //
-int LoadOBJ(const char* file)
+static int* GroupFaces(const obj_t* obj,const int use[],int first[])
 {
-   int k;
-   int  Nv,Nn,Nt;  //  Number of vertex, normal and textures
-   int  Mv,Mn,Mt;  //  Maximum vertex, normal and textures
-   float* V;       //  Array of vertexes
-   float* N;       //  Array of normals
-   float* T;       //  Array if textures coordinates
-   char*  line;    //  Line pointer
-   char*  str;     //  String pointer
-
-   //  Open file
-   FILE* f = fopen(file,"r");
-   if (!f) Fatal("Cannot open file %s\n",file);
+   int f,k,op,cur=-1;
+   int* face = (int*)malloc((obj->nf+1)*sizeof(int));
+   int* bin  = (int*)malloc((obj->nf+1)*sizeof(int));
+   if (!face || !bin) Fatal("Cannot allocate memory\n");
+   //  Material of each face
+   memset(first,0,(Nmtl+2)*sizeof(int));
+   for (op=f=0;f<obj->nf;f++)
+   {
+      for (;op<obj->nop && obj->op[op].face==f;op++)
+         if (use[op]>=0) cur = use[op];
+      bin[f] = cur+1;
+      first[cur+2]++;
+   }
+   //  Counting sort
+   for (k=1;k<Nmtl+2;k++)
+      first[k] += first[k-1];
+   for (f=0;f<obj->nf;f++)
+      face[first[bin[f]]++] = f;
+   for (k=Nmtl+1;k>0;k--)
+      first[k] = first[k-1];
+   first[0] = 0;
+   free(bin);
+   return face;
+}
 
-   // Reset materials
-   mtl = NULL;
-   Nmtl = 0;
+//
+//  Add material statement
+//    M is the number of statements allocated
+//    The name goes in the arena of the file
+//
+static void AddOp(obj_t* obj,int* M,int type,const char* p,const char* e)
+{
+   obj->op = (objop_t*)Grow(obj->op,1,obj->nop,M,sizeof(objop_t));
+   obj->op[obj->nop].face = obj->nf;
+   obj->op[obj->nop].type = type;
+   obj->op[obj->nop].name = ArenaString(&obj->arena,p,EndWord(p,e)-p);
+   obj->nop++;
+}
 
-   //  Start new displaylist
-   int list = glGenLists(1);
-   glNewList(list,GL_COMPILE);
-   //  Push attributes for textures
-   glPushAttrib(GL_TEXTURE_BIT);
+//
+//  Parse a piece of an OBJ file
+//    Counts are of floats and face and corner numbers start from zero, so
+//    pieces can be appended to one another.  Indexes refer to the whole file.
+//
+static void* ParseChunk(void* arg)
+{
+   chunk_t* c = (chunk_t*)arg;
+   obj_t* obj = &c->obj;
+   int  Mv,Mn,Mt;  //  Maximum vertex, normal and textures
+   int  Mf,Mc,Mo;  //  Maximum faces, corners and statements
+   const char* p;     //  Position in file
+   const char* line;  //  Start of line
+   const char* e;     //  End of line
+   const char* str;   //  String pointer
 
    //  Read vertexes and facets
-   V  = N  = T  = NULL;
-   Nv = Nn = Nt = 0;
+   memset(obj,0,sizeof(obj_t));
    Mv = Mn = Mt = 0;
-   while ((line = readline(f)))
+   Mf = Mc = Mo = 0;
+   obj->face = (int*)Grow(NULL,1,0,&Mf,sizeof(int));
+   obj->face[0] = 0;
+   for (p=c->beg;(p=NextLine(p,c->end,&line,&e));)
    {
       //  Vertex coordinates (always 3)
-      if (line[0]=='v' && line[1]==' ')
-         readcoord(line+2,3,&V,&Nv,&Mv);
+      if (line[0]=='v' && e-line>1 && line[1]==' ')
+         readcoord(line+2,e,3,&obj->V,&obj->nv,&Mv);
       //  Normal coordinates (always 3)
-      else if (line[0]=='v' && line[1] == 'n')
-         readcoord(line+2,3,&N,&Nn,&Mn);
+      else if (line[0]=='v' && e-line>1 && line[1] == 'n')
+         readcoord(line+2,e,3,&obj->N,&obj->nn,&Mn);
       //  Texture coordinates (always 2)
-      else if (line[0]=='v' && line[1] == 't')
-         readcoord(line+2,2,&T,&Nt,&Mt);
-      //  Read and draw facets
+      else if (line[0]=='v' && e-line>1 && line[1] == 't')
+         readcoord(line+2,e,2,&obj->T,&obj->nt,&Mt);
+      //  Read facets
       else if (line[0]=='f')
       {
-         line++;
          //  Read Vertex/Texture/Normal triplets
-         glBegin(GL_POLYGON);
-         while ((str = getword(&line)))
+         for (str=NextWord(line+1,e);str;str=NextWord(str,e))
          {
-            int Kv,Kt,Kn;
-            //  Try Vertex/Texture/Normal triplet
-            if (sscanf(str,"%d/%d/%d",&Kv,&Kt,&Kn)==3)
+            int* K;
+            obj->corner = (int*)Grow(obj->corner,3,3*obj->nc,&Mc,sizeof(int));
+            K = obj->corner+3*obj->nc++;
+            str = readcorner(str,e,K);
+            //  Check right away
+            if (c->check)
             {
-               if (Kv<0 || Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",Kv,Nv/3);
-               if (Kn<0 || Kn>Nn/3) Fatal("Normal %d out of range 1-%d\n",Kn,Nn/3);
-               if (Kt<0 || Kt>Nt/2) Fatal("Texture %d out of range 1-%d\n",Kt,Nt/2);
+               if (K[0]<0 || K[0]>obj->nv/3) Fatal("Vertex %d out of range 1-%d\n",K[0],obj->nv/3);
+               if (K[2]<0 || K[2]>obj->nn/3) Fatal("Normal %d out of range 1-%d\n",K[2],obj->nn/3);
+               if (K[1]<0 || K[1]>obj->nt/2) Fatal("Texture %d out of range 1-%d\n",K[1],obj->nt/2);
             }
-            //  Try Vertex//Normal pairs
-            else if (sscanf(str,"%d//%d",&Kv,&Kn)==2)
-            {
-               if (Kv<0 || Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",Kv,Nv/3);
-               if (Kn<0 || Kn>Nn/3) Fatal("Normal %d out of range 1-%d\n",Kn,Nn/3);
-               Kt = 0;
-            }
-            //  Try Vertex index
-            else if (sscanf(str,"%d",&Kv)==1)
+            //  Check later when earlier pieces have been counted
+            else
             {
-               if (Kv<0 || Kv>Nv/3) Fatal("Vertex %d out of range 1-%d\n",Kv,Nv/3);
-               Kn = 0;
-               Kt = 0;
+               if (K[0]<0 || K[1]<0 || K[2]<0) c->bad = 1;
+               if (K[0]-obj->nv/3 > c->excess[0]) c->excess[0] = K[0]-obj->nv/3;
+               if (K[1]-obj->nt/2 > c->excess[1]) c->excess[1] = K[1]-obj->nt/2;
+               if (K[2]-obj->nn/3 > c->excess[2]) c->excess[2] = K[2]-obj->nn/3;
             }
-            //  This is an error
-            else
-               Fatal("Invalid facet %s\n",str);
-            //  Draw vectors
-            if (Kt) glTexCoord2fv(T+2*(Kt-1));
-            if (Kn) glNormal3fv(N+3*(Kn-1));
-            if (Kv) glVertex3fv(V+3*(Kv-1));
          }
-         glEnd();
+         obj->face = (int*)Grow(obj->face,1,obj->nf+1,&Mf,sizeof(int));
+         obj->face[++obj->nf] = obj->nc;
       }
       //  Use material
-      else if ((str = readstr(line,"usemtl")))
-         SetMaterial(str);
+      else if ((str = readstr(line,e,"usemtl")))
+         AddOp(obj,&Mo,OBJ_USEMTL,str,e);
       //  Load materials
-      else if ((str = readstr(line,"mtllib")))
-         LoadMaterial(str);
+      else if ((str = readstr(line,e,"mtllib")))
+         AddOp(obj,&Mo,OBJ_MTLLIB,str,e);
       //  Skip this line
    }
-   fclose(f);
+   return NULL;
+}
+
+//
+//  Append array b of nb items to array a of na items
+//
+static void* Append(void* a,size_t na,const void* b,size_t nb,size_t size)
+{
+   if (!nb) return a;
+   a = realloc(a,(na+nb)*size);
+   if (!a) Fatal("Cannot allocate memory\n");
+   memcpy((char*)a+na*size,b,nb*size);
+   return a;
+}
+
+//
+//  Check indexes of pieces parsed without checking
+//    Returns 0 if an index refers past what was read before it
+//
+static int Valid(const chunk_t c[],int n)
+{
+   int k,nv=0,nt=0,nn=0;
+   for (k=0;k<n;k++)
+   {
+      if (c[k].bad || c[k].excess[0]>nv || c[k].excess[1]>nt || c[k].excess[2]>nn) return 0;
+      nv += c[k].obj.nv/3;
+      nt += c[k].obj.nt/2;
+      nn += c[k].obj.nn/3;
+   }
+   return 1;
+}
+
+//
+//  Join pieces in file order
+//    The first piece is extended and the others freed
+//
+static void Merge(obj_t* obj,chunk_t c[],int n)
+{
+   int k,j;
+   *obj = c[0].obj;
+   for (k=1;k<n;k++)
+   {
+      obj_t* o = &c[k].obj;
+      //  Coordinates
+      obj->V = (float*)Append(obj->V,obj->nv,o->V,o->nv,sizeof(float));
+      obj->T = (float*)Append(obj->T,obj->nt,o->T,o->nt,sizeof(float));
+      obj->N = (float*)Append(obj->N,obj->nn,o->N,o->nn,sizeof(float));
+      obj->nv += o->nv;
+      obj->nt += o->nt;
+      obj->nn += o->nn;
+      //  Faces continue from the corners and faces before them
+      for (j=1;j<=o->nf;j++)
+         o->face[j] += obj->nc;
+      for (j=0;j<o->nop;j++)
+         o->op[j].face += obj->nf;
+      obj->face   = (int*)Append(obj->face,obj->nf+1,o->face+1,o->nf,sizeof(int));
+      obj->corner = (int*)Append(obj->corner,3*(size_t)obj->nc,o->corner,3*(size_t)o->nc,sizeof(int));
+      obj->op     = (objop_t*)Append(obj->op,obj->nop,o->op,o->nop,sizeof(objop_t));
+      obj->nf  += o->nf;
+      obj->nc  += o->nc;
+      obj->nop += o->nop;
+      //  Names now belong to obj
+      ArenaJoin(&obj->arena,&o->arena);
+      FreeOBJ(o);
+   }
+   obj->nv /= 3;
+   obj->nt /= 2;
+   obj->nn /= 3;
+}
+
+/*
+ *  Set number of threads used to parse OBJ files
+ *    0 uses one thread per core (the default) and 1 parses serially
+ *    The result does not depend on the number of threads
+ */
+void OBJThreads(int n)
+{
+   nthread = n<0 ? 0 : n;
+}
+
+/*
+ *  Set whether LoadOBJMesh reorders triangles and vertexes for the vertex
+ *  cache and overdraw (off by default)
+ */
+void OBJOptimize(int on)
+{
+   optimize = on;
+}
+
+/*
+ *  Set number of simplified levels of detail LoadOBJMesh builds (none by
+ *  default), each with half the triangles of the one before
+ */
+void OBJLOD(int n)
+{
+   nlod = n<0 ? 0 : n;
+}
+
+/*
+ *  Set which normals and tangents the OBJ loaders generate (none by default)
+ *    OBJ_NORMALS gives faces without normals, or with broken ones, smooth
+ *    normals and OBJ_NORMALS_ALL replaces the normals of every face
+ *    Faces meeting at more than crease degrees keep a sharp edge
+ *    OBJ_TANGENTS makes LoadOBJMesh build tangents
+ */
+void OBJNormals(int mode,float angle)
+{
+   normals = mode;
+   crease  = angle<0 ? 0 : angle>180 ? 180 : angle;
+}
+
+/*
+ *  Set whether LoadOBJMesh stores vertexes in the compact format of
+ *  QuantizeMesh (off by default)
+ *    Display lists made by LoadOBJ always hold floats
+ */
+void OBJQuantize(int on)
+{
+   quantize = on;
+}
+
+/*
+ *  Parse OBJ file into memory
+ *    Large files are split at line boundaries and the pieces parsed on
+ *    several threads, then joined in file order
+ *    Makes no OpenGL calls so it may be used from any thread
+ */
+void ParseOBJ(const char* file,obj_t* obj)
+{
+   chunk_t   c[MAXTHREADS];
+   size_t len;        //  File size
+   const char* map;   //  File contents
+   int n,k;
+
+   //  Map file
+   map = (const char*)MapFile(file,&len);
+   if (!map) Fatal("Cannot open file %s\n",file);
+
+   //  Number of pieces
+   n = nthread ? nthread : Processors();
+   if (n>MAXTHREADS) n = MAXTHREADS;
+   if (n>(int)(len/MINCHUNK)) n = len/MINCHUNK;
+   if (n<1) n = 1;
+
+   //  Split after a line end
+   memset(c,0,n*sizeof(chunk_t));
+   for (k=0;k<n;k++)
+   {
+      const char* p = map + len*k/n;
+      if (k) while (p<map+len && p[-1]!='\n' && p[-1]!='\r') p++;
+      c[k].beg = p;
+      if (k) c[k-1].end = p;
+   }
+   c[n-1].end = map+len;
+   c[0].check = (n==1);
+
+   //  Parse the pieces
+   Parallel(ParseChunk,c,sizeof(chunk_t),n);
+
+   //  Bad indexes are reported by parsing again serially
+   if (n>1 && !Valid(c,n))
+   {
+      for (k=0;k<n;k++)
+         FreeOBJ(&c[k].obj);
+      n = 1;
+      c[0].end = map+len;
+      c[0].check = 1;
+      ParseChunk(c);
+   }
+   Merge(obj,c,n);
+   obj->bytes = len;
+   UnmapFile(map,len);
+
+   //  Memory report
+   mem.names  = obj->arena.allocs;
+   mem.chunks = obj->arena.chunks;
+   mem.arena  = obj->arena.bytes;
+   mem.arrays = sizeof(float)*(3*(size_t)obj->nv+2*(size_t)obj->nt+3*(size_t)obj->nn) +
+                sizeof(int)*(obj->nf+1+3*(size_t)obj->nc) + sizeof(objop_t)*obj->nop;
+}
+
+/*
+ *  Free OBJ file in memory
+ *    The names of the material statements go at once with their arena
+ */
+void FreeOBJ(obj_t* obj)
+{
+   ArenaFree(&obj->arena);
+   free(obj->op);
+   free(obj->V);
+   free(obj->T);
+   free(obj->N);
+   free(obj->face);
+   free(obj->corner);
+   memset(obj,0,sizeof(obj_t));
+}
+
+//
+//  Mesh cache flags for the current settings
+//    The crease angle is kept in whole degrees when normals are generated
+//
+static int CacheFlags(void)
+{
+   int flags = optimize ? CMESH_OPTIMIZED : 0;
+   if (normals & OBJ_NORMALS_ALL)
+      flags |= CMESH_NORMALS_ALL | (int)(crease+0.5)<<8;
+   else if (normals & OBJ_NORMALS)
+      flags |= CMESH_NORMALS | (int)(crease+0.5)<<8;
+   return flags;
+}
+
+//
+//  Parse OBJ file and generate the normals set by OBJNormals
+//
+static void ReadOBJ(const char* file,obj_t* obj)
+{
+   ParseOBJ(file,obj);
+   if (normals & (OBJ_NORMALS|OBJ_NORMALS_ALL))
+      BuildNormals(obj,crease,normals&OBJ_NORMALS_ALL);
+}
+
+//
+//  Name of the mesh cache for an OBJ file
+//
+static char* CacheName(const char* file)
+{
+   char* cache = (char*)malloc(strlen(file)+7);
+   if (!cache) Fatal("Cannot allocate memory for %s\n",file);
+   sprintf(cache,"%s.cmesh",file);
+   return cache;
+}
+
+//
+//  Build mesh from a parsed file and the materials loaded for it
+//    use is the material of each statement from LookupMaterials
+//    The mesh takes over the materials
+//
+static void MakeMesh(const obj_t* obj,const int use[],mesh_t* mesh)
+{
+   BuildMesh(obj,use,mesh);
+   mesh->nmtl = Nmtl;
+   mesh->mtl  = mtl;
+   ResetMaterials();
+   if (optimize) OptimizeMesh(mesh,NULL);
+}
+
+//
+//  Save mesh in the cache for next time
+//    The OBJ file and its material files are recorded so changes to them
+//    are noticed (failing to save only costs time)
+//
+static void SaveMesh(const char* cache,const char* file,const obj_t* obj,const mesh_t* mesh)
+{
+   int k,n=0;
+   const char** src = (const char**)malloc((obj->nop+1)*sizeof(char*));
+   if (!src) Fatal("Cannot allocate memory\n");
+   src[n++] = file;
+   for (k=0;k<obj->nop;k++)
+      if (obj->op[k].type==OBJ_MTLLIB)
+         src[n++] = obj->op[k].name;
+   WriteCMESH(cache,mesh,CacheFlags(),src,n);
+   free(src);
+}
+
+//
+//  Remember the bounds of a display list
+//
+static void AddBounds(int list,const mesh_t* mesh)
+{
+   listbounds_t* l;
+   if (Nlist==Mlist)
+   {
+      Mlist = Mlist ? 2*Mlist : 16;
+      lbounds = (listbounds_t*)realloc(lbounds,Mlist*sizeof(listbounds_t));
+      if (!lbounds) Fatal("Cannot allocate memory for bounds\n");
+   }
+   l = lbounds+Nlist++;
+   l->list = list;
+   memcpy(l->b.min,mesh->min,sizeof(l->b.min));
+   memcpy(l->b.max,mesh->max,sizeof(l->b.max));
+   memcpy(l->b.center,mesh->center,sizeof(l->b.center));
+   l->b.radius = mesh->radius;
+}
+
+/*
+ *  Load OBJ file
+ *    Returns a display list that draws the model
+ *    Faces are grouped by material so each material is set once
+ *    The model is also saved as file.cmesh, which is compiled into the list
+ *    instead of parsing the file while the OBJ and MTL files are unchanged
+ *    Normals are generated when set by OBJNormals
+ *    The bounds of the model are kept for OBJBounds
+ */
+int LoadOBJ(const char* file)
+{
+   int i,k,m;
+   int* use;     //  Material of each statement
+   int* face;    //  Faces grouped by material
+   int* first;   //  First face of each material
+   obj_t obj;
+   mesh_t mesh;
+   char* cache = CacheName(file);
+
+   //  Compile cached mesh
+   memset(&mem,0,sizeof(mem));
+   if (LoadCMESH(cache,CacheFlags(),&mesh))
+   {
+      int list = glGenLists(1);
+      TexNewList(list);
+      DrawMesh(&mesh);
+      TexEndList();
+      AddBounds(list,&mesh);
+      FreeMesh(&mesh);
+      free(cache);
+      return list;
+   }
+
+   //  Read file
+   ReadOBJ(file,&obj);
+
+   // Reset materials
+   ResetMaterials();
+   //  Load materials first so textures are not compiled into the list
+   for (k=0;k<obj.nop;k++)
+      if (obj.op[k].type==OBJ_MTLLIB)
+         LoadMaterial(obj.op[k].name,1);
+   //  Group faces by material
+   use  = LookupMaterials(&obj);
+   first = (int*)malloc((Nmtl+2)*sizeof(int));
+   if (!first) Fatal("Cannot allocate memory\n");
+   face = GroupFaces(&obj,use,first);
+
+   //  Start new displaylist
+   int list = glGenLists(1);
+   TexNewList(list);
+   //  Push attributes for textures (as DrawMesh does for cached meshes)
+   glPushAttrib(GL_TEXTURE_BIT|GL_ENABLE_BIT);
+
+   //  Draw facets one material at a time
+   for (m=0;m<=Nmtl;m++)
+   {
+      if (first[m]==first[m+1]) continue;
+      //  Faces before any material use the current one
+      if (m)
+      {
+         ApplyMaterial(mtl+m-1);
+         stats.binds++;
+      }
+      for (i=first[m];i<first[m+1];i++)
+      {
+         int f = face[i];
+         //  Draw Vertex/Texture/Normal triplets
+         glBegin(GL_POLYGON);
+         for (k=obj.face[f];k<obj.face[f+1];k++)
+         {
+            const int* K = obj.corner+3*k;
+            if (K[1]) glTexCoord2fv(obj.T+2*(K[1]-1));
+            if (K[2]) glNormal3fv(obj.N+3*(K[2]-1));
+            if (K[0]) glVertex3fv(obj.V+3*(K[0]-1));
+         }
+         glEnd();
+      }
+   }
    //  Pop attributes (textures)
    glPopAttrib();
-   glEndList();
+   TexEndList();
 
-   //  Free materials
-   for (k=0;k<Nmtl;k++)
-      free(mtl[k].name);
-   free(mtl);
+   //  Save mesh, which takes over the materials
+   MakeMesh(&obj,use,&mesh);
+   SaveMesh(cache,file,&obj,&mesh);
+   AddBounds(list,&mesh);
+   FreeMesh(&mesh);
 
-   //  Free arrays
-   free(V);
-   free(T);
-   free(N);
+   //  Free file
+   free(use);
+   free(face);
+   free(first);
+   FreeOBJ(&obj);
+   free(cache);
 
    return list;
 }
+
+/*
+ *  Load OBJ file as a mesh drawn from vertex and index buffers
+ *    Polygons are split into triangle fans and faces using the same
+ *    material are grouped and drawn with one glDrawElements call
+ *    Triangles are reordered for the vertex cache when set by OBJOptimize
+ *    The mesh is kept in file.cmesh and loaded from there while the OBJ
+ *    and MTL files are unchanged
+ *    Levels of detail are built when set by OBJLOD
+ *    Normals and tangents are generated when set by OBJNormals
+ *    Vertexes are quantized when set by OBJQuantize
+ */
+void LoadOBJMesh(const char* file,mesh_t* mesh)
+{
+   int k;
+   int* use;    //  Material of each statement
+   obj_t obj;
+   char* cache = CacheName(file);
+
+   //  Use cached mesh
+   memset(&mem,0,sizeof(mem));
+   if (LoadCMESH(cache,CacheFlags(),mesh))
+   {
+      if (nlod) BuildMeshLOD(mesh,nlod,NULL);
+      if (normals & OBJ_TANGENTS) BuildTangents(mesh);
+      //  The cache holds floats, so pack the vertex buffer again
+      if (quantize)
+      {
+         QuantizeMesh(mesh,NULL);
+         UploadMesh(mesh);
+      }
+      free(cache);
+      return;
+   }
+
+   //  Read file and materials
+   ReadOBJ(file,&obj);
+   ResetMaterials();
+   for (k=0;k<obj.nop;k++)
+      if (obj.op[k].type==OBJ_MTLLIB)
+         LoadMaterial(obj.op[k].name,1);
+   use = LookupMaterials(&obj);
+
+   //  Build mesh and save it for next time
+   MakeMesh(&obj,use,mesh);
+   SaveMesh(cache,file,&obj,mesh);
+   for (k=0;k<mesh->nrange;k++)
+      if (mesh->range[k].mtl>=0) stats.binds++;
+   free(use);
+   FreeOBJ(&obj);
+   free(cache);
+   if (nlod) BuildMeshLOD(mesh,nlod,NULL);
+   if (normals & OBJ_TANGENTS) BuildTangents(mesh);
+   if (quantize) QuantizeMesh(mesh,NULL);
+   UploadMesh(mesh);
+}
+
+//
+//  Create temporary file
+//
+static FILE* TempFile(void)
+{
+   FILE* f = tmpfile();
+   if (!f) Fatal("Cannot create temporary file\n");
+   return f;
+}
+
+//
+//  Write to a temporary file
+//
+static void Spill(const void* x,size_t size,size_t n,FILE* f)
+{
+   if (fwrite(x,size,n,f)!=n) Fatal("Error writing temporary file\n");
+}
+
+//
+//  Read from a temporary file
+//
+static void Unspill(void* x,size_t size,size_t n,FILE* f)
+{
+   if (fread(x,size,n,f)!=n) Fatal("Error reading temporary file\n");
+}
+
+//
+//  Add a coordinate to its temporary file
+//
+static void StreamCoord(pages_t* a,const char* p,const char* e)
+{
+   float x[3];
+   readfloat(p,e,a->n,x);
+   Spill(x,sizeof(float),a->n,a->f);
+   if (a->count++%PAGE==0)
+   {
+      a->last = (int*)Grow(a->last,1,a->npage,&a->M,sizeof(int));
+      a->last[a->npage++] = -1;
+   }
+}
+
+//
+//  Read one line of an OBJ file for StreamOBJ
+//    Corners are checked and written to the face file with the faces they
+//    belong to marked as the last users of their pages
+//
+static void StreamLine(stream_t* s,const char* line,const char* e)
+{
+   const char* str;
+   //  Coordinates
+   if (line[0]=='v' && e-line>1 && line[1]==' ')
+      StreamCoord(s->a,line+2,e);
+   else if (line[0]=='v' && e-line>1 && line[1] == 't')
+      StreamCoord(s->a+1,line+2,e);
+   else if (line[0]=='v' && e-line>1 && line[1] == 'n')
+      StreamCoord(s->a+2,line+2,e);
+   //  Facets (corners without a vertex are dropped)
+   else if (line[0]=='f')
+   {
+      int n=0,k;
+      for (str=NextWord(line+1,e);str;str=NextWord(str,e))
+      {
+         int* K;
+         s->K = (int*)Grow(s->K,3,3*n,&s->Mk,sizeof(int));
+         K = s->K+3*n;
+         str = readcorner(str,e,K);
+         if (K[0]<0 || K[0]>s->a[0].count) Fatal("Vertex %d out of range 1-%d\n",K[0],s->a[0].count);
+         if (K[2]<0 || K[2]>s->a[2].count) Fatal("Normal %d out of range 1-%d\n",K[2],s->a[2].count);
+         if (K[1]<0 || K[1]>s->a[1].count) Fatal("Texture %d out of range 1-%d\n",K[1],s->a[1].count);
+         if (!K[0]) continue;
+         for (k=0;k<3;k++)
+            if (K[k]) s->a[k].last[(K[k]-1)/PAGE] = s->ops.nf;
+         n++;
+      }
+      Spill(&n,sizeof(int),1,s->face);
+      Spill(s->K,3*sizeof(int),n,s->face);
+      s->nc += n;
+      s->ops.nf++;
+   }
+   //  Material statements
+   else if ((str = readstr(line,e,"usemtl")))
+      AddOp(&s->ops,&s->Mo,OBJ_USEMTL,str,e);
+   else if ((str = readstr(line,e,"mtllib")))
+      AddOp(&s->ops,&s->Mo,OBJ_MTLLIB,str,e);
+}
+
+//
+//  Read an OBJ file through a window of size bytes
+//    Only whole lines are parsed and the rest is moved to the front
+//
+static void StreamText(const char* file,stream_t* s,char* buf,size_t size)
+{
+   size_t have=0;
+   FILE* f = fopen(file,"rb");
+   if (!f) Fatal("Cannot open file %s\n",file);
+   for (;;)
+   {
+      size_t got = fread(buf+have,1,size-have,f);
+      const char* end = buf+have+got;
+      const char* stop = end;
+      const char* p;
+      const char* line;
+      const char* e;
+      int last = got<size-have;
+      if (last && ferror(f)) Fatal("Error reading %s\n",file);
+      //  Stop after the last line end unless this is the end of the file
+      if (!last)
+      {
+         while (stop>buf && stop[-1]!='\n' && stop[-1]!='\r')
+            stop--;
+         if (stop==buf) Fatal("Line longer than %lu bytes in %s\n",(unsigned long)size,file);
+      }
+      for (p=buf;(p=NextLine(p,stop,&line,&e));)
+         StreamLine(s,line,e);
+      if (last) break;
+      have = end-stop;
+      memmove(buf,stop,have);
+   }
+   fclose(f);
+}
+
+//
+//  Set aside memory for the pages of a coordinate
+//    Returns the bytes allocated
+//
+static unsigned long PageSlots(pages_t* a,unsigned long bytes)
+{
+   int k;
+   a->nslot = bytes/(PAGE*a->n*sizeof(float));
+   if (a->nslot<2) a->nslot = 2;
+   if (a->nslot>a->npage) a->nslot = a->npage;
+   a->slot = (int*)malloc((a->npage+1)*sizeof(int));
+   a->page = (int*)malloc((a->nslot+1)*sizeof(int));
+   a->used = (unsigned long*)calloc(a->nslot+1,sizeof(unsigned long));
+   a->data = (float*)malloc((size_t)a->nslot*PAGE*a->n*sizeof(float)+1);
+   if (!a->slot || !a->page || !a->used || !a->data) Fatal("Cannot allocate memory for pages\n");
+   for (k=0;k<a->npage;k++)
+      a->slot[k] = -1;
+   for (k=0;k<a->nslot;k++)
+      a->page[k] = -1;
+   fflush(a->f);
+   return (size_t)a->nslot*(PAGE*a->n*sizeof(float)+sizeof(int)+sizeof(long)) + (a->npage+1)*sizeof(int);
+}
+
+//
+//  Get coordinate k (1 based) for face f
+//    A page that is not in memory replaces one no face from f on uses, or
+//    else the one used longest ago
+//
+static const float* Fetch(pages_t* a,int k,int f,unsigned long time)
+{
+   int p = (k-1)/PAGE;
+   int s = a->slot[p];
+   if (s<0)
+   {
+      int j;
+      size_t n = a->count-p*PAGE < PAGE ? a->count-p*PAGE : PAGE;
+      for (s=j=0;j<a->nslot;j++)
+      {
+         if (a->page[j]<0 || a->last[a->page[j]]<f)
+         {
+            s = j;
+            break;
+         }
+         if (a->used[j]<a->used[s]) s = j;
+      }
+      if (a->page[s]>=0) a->slot[a->page[s]] = -1;
+      a->page[s] = p;
+      a->slot[p] = s;
+      if (fseek(a->f,(long)p*PAGE*a->n*sizeof(float),SEEK_SET)) Fatal("Error reading temporary file\n");
+      Unspill(a->data+(size_t)s*PAGE*a->n,a->n*sizeof(float),n,a->f);
+      stats.pages++;
+   }
+   a->used[s] = time;
+   return a->data+((size_t)s*PAGE+(k-1)%PAGE)*a->n;
+}
+
+//
+//  Free temporary file and pages of a coordinate
+//
+static void FreePages(pages_t* a)
+{
+   if (a->f) fclose(a->f);
+   free(a->last);
+   free(a->slot);
+   free(a->page);
+   free(a->used);
+   free(a->data);
+}
+
+//
+//  Hash index triplet
+//
+static unsigned int HashK(const int K[3],unsigned int mask)
+{
+   unsigned int h = (K[0]*73856093u ^ K[1]*19349663u ^ K[2]*83492791u) * 2654435761u;
+   return (h>>7) & mask;
+}
+
+//
+//  Group the indexes of a streamed mesh into one range per material
+//    Materials keep the order they are first used in, as in BuildMesh
+//    The indexes are copied through buf of n indexes
+//    Returns the file holding the grouped indexes
+//
+static FILE* StreamGroup(mesh_t* mesh,FILE* ind,unsigned int* buf,size_t n)
+{
+   int k,g,ng=0,nm=0;
+   int* rank;
+   meshrange_t* range;
+   FILE* out;
+
+   if (mesh->nrange<2) return ind;
+   for (k=0;k<mesh->nrange;k++)
+      if (mesh->range[k].mtl+1>nm) nm = mesh->range[k].mtl+1;
+   rank  = (int*)malloc((nm+1)*sizeof(int));
+   range = (meshrange_t*)malloc((nm+1)*sizeof(meshrange_t));
+   if (!rank || !range) Fatal("Cannot allocate memory for mesh\n");
+   for (k=0;k<=nm;k++)
+      rank[k] = -1;
+   for (k=0;k<mesh->nrange;k++)
+   {
+      int m = mesh->range[k].mtl;
+      if (rank[m+1]<0)
+      {
+         rank[m+1] = ng;
+         range[ng].mtl = m;
+         range[ng++].count = 0;
+      }
+      range[rank[m+1]].count += mesh->range[k].count;
+   }
+   //  Nothing to gain
+   if (ng==mesh->nrange)
+   {
+      free(rank);
+      free(range);
+      return ind;
+   }
+   //  Copy the ranges of each group in turn
+   fflush(ind);
+   out = TempFile();
+   for (g=0;g<ng;g++)
+   {
+      range[g].first = g ? range[g-1].first+range[g-1].count : 0;
+      for (k=0;k<mesh->nrange;k++)
+      {
+         size_t i,c;
+         const meshrange_t* r = mesh->range+k;
+         if (rank[r->mtl+1]!=g) continue;
+         if (fseek(ind,(long)r->first*sizeof(unsigned int),SEEK_SET)) Fatal("Error reading temporary file\n");
+         for (i=0;i<(size_t)r->count;i+=c)
+         {
+            c = r->count-i<n ? r->count-i : n;
+            Unspill(buf,sizeof(unsigned int),c,ind);
+            Spill(buf,sizeof(unsigned int),c,out);
+         }
+      }
+   }
+   fclose(ind);
+   free(mesh->range);
+   mesh->range = range;
+   mesh->nrange = ng;
+   free(rank);
+   return out;
+}
+
+/*
+ *  Convert an OBJ file to a .cmesh file using limited memory
+ *    limit is the most memory in bytes for reading, welding and holding
+ *    coordinates (at least 1 MB), unless the file has so many material
+ *    statements that their bookkeeping does not fit
+ *    Coordinates, faces, vertexes and indexes are kept in temporary files
+ *    The mesh is the same as LoadOBJMesh builds except that a vertex may be
+ *    repeated once the weld table fills up, and it is not optimized
+ *    Load the result with LoadCMESH(out,0,mesh)
+ *    Makes no OpenGL calls
+ *    Returns the size of the .cmesh file, or 0 if it could not be written or
+ *    the mesh is too large for the format
+ */
+unsigned long StreamOBJ(const char* file,const char* out,unsigned long limit)
+{
+   int f,k,op,cur=-1,floats=0;
+   unsigned long peak,left,time=0,bytes;
+   unsigned int size,used=0;  //  Size of weld table and slots used
+   size_t window;             //  Bytes of text read at a time
+   char* buf;                 //  Text window
+   weld_t* table;             //  Vertex for each index triplet
+   int* use;                  //  Material of each statement
+   const char** src;          //  Source files
+   FILE* vert;                //  Vertexes
+   FILE* ind;                 //  Indexes
+   stream_t s;
+   mesh_t mesh;
+
+   //  Split the memory between the window, weld table and pages
+   if (limit<MINSTREAM) limit = MINSTREAM;
+   window = limit/8;
+   for (size=1024;2*size*sizeof(weld_t)<=limit/4;size*=2);
+   buf = (char*)malloc(window);
+   table = (weld_t*)malloc(size*sizeof(weld_t));
+   if (!buf || !table) Fatal("Cannot allocate memory for %s\n",file);
+
+   //  First pass spills coordinates and faces
+   memset(&s,0,sizeof(s));
+   for (k=0;k<3;k++)
+   {
+      s.a[k].f = TempFile();
+      s.a[k].n = k==1 ? 2 : 3;
+   }
+   s.face = TempFile();
+   StreamText(file,&s,buf,window);
+   peak = window + s.Mk*sizeof(int) + s.Mo*sizeof(objop_t);
+   for (k=0;k<3;k++)
+      peak += s.a[k].M*sizeof(int);
+   free(s.K);
+   s.K = NULL;
+   memset(&mem,0,sizeof(mem));
+   mem.names  = s.ops.arena.allocs;
+   mem.chunks = s.ops.arena.chunks;
+   mem.arena  = s.ops.arena.bytes;
+
+   //  Materials without textures
+   ResetMaterials();
+   for (k=0;k<s.ops.nop;k++)
+      if (s.ops.op[k].type==OBJ_MTLLIB)
+         LoadMaterial(s.ops.op[k].name,0);
+   use = LookupMaterials(&s.ops);
+
+   //  Pages get what the window, weld table and bookkeeping leave over in
+   //  proportion to the floats of each coordinate
+   bytes = window + size*sizeof(weld_t) + s.Mo*sizeof(objop_t) + Nmtl*sizeof(material_t) +
+           (s.ops.nop+1)*(sizeof(int)+sizeof(meshrange_t));
+   for (k=0;k<3;k++)
+      if (s.a[k].count)
+      {
+         floats += s.a[k].n;
+         bytes += s.a[k].M*sizeof(int);
+      }
+   left = limit>bytes ? limit-bytes : 0;
+   for (k=0;k<3;k++)
+      if (s.a[k].count) bytes += PageSlots(s.a+k,left/floats*s.a[k].n);
+   stats.peak = bytes>peak ? bytes : peak;
+
+   //  Second pass welds the faces
+   memset(&mesh,0,sizeof(mesh));
+   mesh.range = (meshrange_t*)malloc(sizeof(meshrange_t)*(s.ops.nop+1));
+   if (!mesh.range) Fatal("Cannot allocate memory for mesh\n");
+   mesh.range[0].mtl = -1;
+   mesh.range[0].first = 0;
+   for (k=0;k<(int)size;k++)
+      table[k].v = -1;
+   vert = TempFile();
+   ind = TempFile();
+   rewind(s.face);
+   for (op=f=0;f<s.ops.nf;f++)
+   {
+      int n,c,v0=0,v1=0;
+      //  Start a new range when the material changes
+      for (;op<s.ops.nop && s.ops.op[op].face==f;op++)
+         if (s.ops.op[op].type==OBJ_USEMTL && use[op]>=0 && use[op]!=cur)
+         {
+            meshrange_t* r = mesh.range+mesh.nrange;
+            r->count = mesh.nind - r->first;
+            //  Empty ranges are replaced
+            if (r->count) r = mesh.range + ++mesh.nrange;
+            cur = use[op];
+            r->mtl   = cur;
+            r->first = mesh.nind;
+         }
+      //  Triangle fan
+      Unspill(&n,sizeof(int),1,s.face);
+      for (c=0;c<n;c++)
+      {
+         int K[3];
+         unsigned int h;
+         Unspill(K,sizeof(int),3,s.face);
+         for (h=HashK(K,size-1);table[h].v>=0;h=(h+1)&(size-1))
+            if (table[h].K[0]==K[0] && table[h].K[1]==K[1] && table[h].K[2]==K[2]) break;
+         //  New vertex
+         if (table[h].v<0)
+         {
+            float x[8] = {0,0,0,0,0,0,0,0};
+            //  Start over when the table is half full
+            if (2*++used>size)
+            {
+               for (k=0;k<(int)size;k++)
+                  table[k].v = -1;
+               used = 1;
+               for (h=HashK(K,size-1);table[h].v>=0;h=(h+1)&(size-1));
+            }
+            memcpy(x,Fetch(s.a,K[0],f,++time),3*sizeof(float));
+            if (K[2])
+            {
+               memcpy(x+3,Fetch(s.a+2,K[2],f,time),3*sizeof(float));
+               mesh.attr |= MESH_NORMAL;
+            }
+            if (K[1])
+            {
+               memcpy(x+6,Fetch(s.a+1,K[1],f,time),2*sizeof(float));
+               mesh.attr |= MESH_TEXTURE;
+            }
+            for (k=0;k<3;k++)
+            {
+               if (!mesh.nvert || x[k]<mesh.min[k]) mesh.min[k] = x[k];
+               if (!mesh.nvert || x[k]>mesh.max[k]) mesh.max[k] = x[k];
+            }
+            Spill(x,sizeof(float),8,vert);
+            memcpy(table[h].K,K,sizeof(table[h].K));
+            table[h].v = mesh.nvert++;
+         }
+         if (c==0)
+            v0 = table[h].v;
+         else if (c>1)
+         {
+            unsigned int t[3] = {v0,v1,table[h].v};
+            Spill(t,sizeof(unsigned int),3,ind);
+            mesh.nind += 3;
+         }
+         v1 = table[h].v;
+      }
+      mesh.ncorner += n;
+   }
+   //  Close last range
+   mesh.range[mesh.nrange].count = mesh.nind - mesh.range[mesh.nrange].first;
+   if (mesh.range[mesh.nrange].count) mesh.nrange++;
+
+   //  Group by material and write the mesh with its sources
+   ind = StreamGroup(&mesh,ind,(unsigned int*)buf,window/sizeof(unsigned int));
+   mesh.nmtl = Nmtl;
+   mesh.mtl  = mtl;
+   ResetMaterials();
+   src = (const char**)malloc((s.ops.nop+1)*sizeof(char*));
+   if (!src) Fatal("Cannot allocate memory\n");
+   src[0] = file;
+   for (k=0,op=1;k<s.ops.nop;k++)
+      if (s.ops.op[k].type==OBJ_MTLLIB)
+         src[op++] = s.ops.op[k].name;
+   fflush(vert);
+   fflush(ind);
+   bytes = WriteCMESHFiles(out,&mesh,0,src,op,vert,ind);
+
+   //  Done
+   fclose(vert);
+   fclose(ind);
+   fclose(s.face);
+   for (k=0;k<3;k++)
+      FreePages(s.a+k);
+   free(s.K);
+   free(src);
+   free(use);
+   free(buf);
+   free(table);
+   FreeOBJ(&s.ops);
+   FreeMesh(&mesh);
+   return bytes;
+}
+
+/*
+ *  Get material counters of the files parsed so far
+ *    usemtl less binds is the number of material changes saved by
+ *    grouping faces by material
+ */
+void OBJStats(objstats_t* s)
+{
+   *s = stats;
+}
+
+/*
+ *  Get the memory used by the last OBJ file parsed
+ *    Everything is zero if the last file was loaded from its .cmesh file
+ */
+void OBJMemory(objmem_t* m)
+{
+   *m = mem;
+}
+
+/*
+ *  Get the bounding box and sphere of a display list made by LoadOBJ
+ *    Returns 0 if the list was not made by LoadOBJ
+ */
+int OBJBounds(int list,bounds_t* b)
+{
+   int k;
+   for (k=Nlist-1;k>=0;k--)
+      if (lbounds[k].list==list)
+      {
+         *b = lbounds[k].b;
+         return 1;
+      }
+   return 0;
+}
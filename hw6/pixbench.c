@@ -0,0 +1,168 @@
+/*
+ *  Benchmark the pixel conversion kernels
+ *
+ *  Usage: pixbench [-n runs] [size ...]
+ *    -n  number of runs per test, the fastest is reported (default 5)
+ *  Converts size x size images (default 512, 2048 and 8192) from BGR to RGB
+ *  in place and from BGR to RGBA, first with the scalar loops LoadTexBMP
+ *  used before the kernels and then with each kernel the CPU supports.
+ *  Reports the time, the rate in GB/s of bytes read plus bytes written and
+ *  the speedup over the scalar loop.
+ */
+#include "CSCIx229.h"
+#include <sys/time.h>
+
+//
+//  Time in seconds
+//
+static double Now(void)
+{
+   struct timeval t;
+   gettimeofday(&t,NULL);
+   return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+//
+//  Scalar BGR to RGB in place
+//
+static void LoopRGB(unsigned char* dst,const unsigned char* src,int n)
+{
+   int k;
+   for (k=0;k<3*n;k+=3)
+   {
+      unsigned char temp = dst[k];
+      dst[k]   = dst[k+2];
+      dst[k+2] = temp;
+   }
+}
+
+//
+//  Scalar BGR to RGBA
+//
+static void LoopRGBA(unsigned char* dst,const unsigned char* src,int n)
+{
+   int k;
+   for (k=0;k<n;k++)
+   {
+      dst[4*k]   = src[3*k+2];
+      dst[4*k+1] = src[3*k+1];
+      dst[4*k+2] = src[3*k];
+      dst[4*k+3] = 255;
+   }
+}
+
+//
+//  Kernels through the library
+//
+static void KernelRGB(unsigned char* dst,const unsigned char* src,int n)
+{
+   PixBGRtoRGB(dst,dst,n);
+}
+static void KernelRGBA(unsigned char* dst,const unsigned char* src,int n)
+{
+   PixBGRtoRGBA(dst,src,n,255);
+}
+
+//
+//  Time a conversion of n pixels and report it
+//    Small images are converted several times per run so each run takes a
+//    measurable time
+//    bytes is the number of bytes read plus written per pixel
+//    base is the time of the scalar loop (0 for the loop itself)
+//    Returns the time of one conversion
+//
+static double Time(const char* name,void (*conv)(unsigned char*,const unsigned char*,int),
+                   unsigned char* dst,const unsigned char* src,int n,int bytes,int runs,double base)
+{
+   int k,i;
+   int reps = n<(1<<24) ? (1<<24)/n : 1;
+   double t,best=1e30;
+   for (k=0;k<runs;k++)
+   {
+      t = Now();
+      for (i=0;i<reps;i++)
+         conv(dst,src,n);
+      t = (Now()-t)/reps;
+      if (t<best) best = t;
+   }
+   if (best<=0) best = 1e-9;
+   printf("   %-6s %9.3f ms %6.2f GB/s",name,1e3*best,1e-9*bytes*n/best);
+   if (base>0) printf(" %5.2fx",base/best);
+   printf("\n");
+   return best;
+}
+
+//
+//  Benchmark one conversion with the scalar loop and every kernel
+//
+static void Bench(const char* title,void (*loop)(unsigned char*,const unsigned char*,int),
+                  void (*kern)(unsigned char*,const unsigned char*,int),
+                  unsigned char* dst,const unsigned char* src,int n,int bytes,int runs)
+{
+   const char* name[3] = {"C","SSSE3","AVX2"};
+   int k;
+   double base;
+   printf("  %s\n",title);
+   base = Time("loop",loop,dst,src,n,bytes,runs,0);
+   for (k=PIX_C;k<=PIX_AVX2;k++)
+   {
+      if (PixKernel(k)!=k)
+         printf("   %-6s not supported\n",name[k]);
+      else
+         Time(name[k],kern,dst,src,n,bytes,runs,base);
+   }
+   PixKernel(PIX_BEST);
+}
+
+//
+//  Benchmark a size x size image
+//
+static void Size(int size,int runs)
+{
+   size_t k;
+   int n = size*size;
+   unsigned char* src = (unsigned char*)malloc(3*(size_t)n);
+   unsigned char* dst = (unsigned char*)malloc(4*(size_t)n);
+   if (!src || !dst) Fatal("Cannot allocate memory for %dx%d image\n",size,size);
+   //  Fill the images so their pages are resident
+   for (k=0;k<3*(size_t)n;k++)
+      src[k] = k*7;
+   memset(dst,0,4*(size_t)n);
+   printf("%dx%d: %.1f MB BGR\n",size,size,3e-6*n);
+   Bench("BGR to RGB in place",LoopRGB,KernelRGB,src,src,n,6,runs);
+   Bench("BGR to RGBA",LoopRGBA,KernelRGBA,dst,src,n,7,runs);
+   free(src);
+   free(dst);
+}
+
+//
+//  Main program
+//
+int main(int argc,char* argv[])
+{
+   int k,runs=5;
+   for (k=1;k<argc && argv[k][0]=='-';k++)
+   {
+      if (!strcmp(argv[k],"-n") && k+1<argc)
+         runs = atoi(argv[++k]);
+      else
+         Fatal("Usage: %s [-n runs] [size ...]\n",argv[0]);
+   }
+   if (runs<1) runs = 1;
+   //  Sizes given
+   if (k<argc)
+      for (;k<argc;k++)
+      {
+         int size = atoi(argv[k]);
+         if (size<1 || size>16384) Fatal("Size %s out of range 1-16384\n",argv[k]);
+         Size(size,runs);
+      }
+   //  Default sizes
+   else
+   {
+      Size(512,runs);
+      Size(2048,runs);
+      Size(8192,runs);
+   }
+   return 0;
+}
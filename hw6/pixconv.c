@@ -0,0 +1,267 @@
+/*
+ *  Pixel format conversion
+ *
+ *  Converts BGR images as stored in BMP files to RGB or RGBA and flips
+ *  images upside down.  On x86 the conversions use SSSE3 or AVX2 byte
+ *  shuffles when the CPU supports them, otherwise plain C is used.
+ *  PixKernel() picks a slower kernel for benchmarks (see pixbench.c).
+ */
+#include "CSCIx229.h"
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIX_X86
+#include <immintrin.h>
+#endif
+
+//  Selected kernels (chosen once, as images may be converted on several threads)
+static void (*bgr2rgb)(unsigned char* dst,const unsigned char* src,int n)=NULL;
+static void (*bgr2rgba)(unsigned char* dst,const unsigned char* src,int n,unsigned char alpha)=NULL;
+static pthread_once_t dispatch = PTHREAD_ONCE_INIT;
+
+//
+//  BGR to RGB in plain C
+//
+static void BGRtoRGB_C(unsigned char* dst,const unsigned char* src,int n)
+{
+   int k;
+   //  In place only B and R move, which compilers vectorize well
+   if (dst==src)
+   {
+      for (k=0;k<3*n;k+=3)
+      {
+         unsigned char temp = dst[k];
+         dst[k]   = dst[k+2];
+         dst[k+2] = temp;
+      }
+      return;
+   }
+   for (k=0;k<n;k++,dst+=3,src+=3)
+   {
+      unsigned char b = src[0];
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = b;
+   }
+}
+
+//
+//  BGR to RGBA in plain C
+//
+static void BGRtoRGBA_C(unsigned char* dst,const unsigned char* src,int n,unsigned char alpha)
+{
+   int k;
+   for (k=0;k<n;k++,dst+=4,src+=3)
+   {
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+      dst[3] = alpha;
+   }
+}
+
+#ifdef PIX_X86
+//
+//  Swap B and R in 16 pixels held in three vectors
+//    Pixels 5 and 10 straddle vector boundaries, so each output vector
+//    gathers a byte or two from its neighbours.
+//
+#define SWAP48(a,b,c,x,y,z,SHUF,OR) \
+   x = OR(SHUF(a,M(2,1,0,5,4,3,8,7,6,11,10,9,14,13,12,_)),SHUF(b,M(_,_,_,_,_,_,_,_,_,_,_,_,_,_,_,1))); \
+   y = OR(OR(SHUF(a,M(_,15,_,_,_,_,_,_,_,_,_,_,_,_,_,_)),SHUF(b,M(0,_,4,3,2,7,6,5,10,9,8,13,12,11,_,15))),SHUF(c,M(_,_,_,_,_,_,_,_,_,_,_,_,_,_,0,_))); \
+   z = OR(SHUF(b,M(14,_,_,_,_,_,_,_,_,_,_,_,_,_,_,_)),SHUF(c,M(_,3,2,1,6,5,4,9,8,7,12,11,10,15,14,13)));
+#define _ -1
+
+//
+//  BGR to RGB using SSSE3
+//    Converts 16 pixels (48 bytes) per step.  All loads happen before the
+//    stores, so converting in place is safe.
+//
+__attribute__((target("ssse3")))
+static void BGRtoRGB_SSSE3(unsigned char* dst,const unsigned char* src,int n)
+{
+#define M _mm_setr_epi8
+   int k=0;
+   for (;k+16<=n;k+=16)
+   {
+      __m128i x,y,z;
+      __m128i a = _mm_loadu_si128((const __m128i*)(src+3*k));
+      __m128i b = _mm_loadu_si128((const __m128i*)(src+3*k+16));
+      __m128i c = _mm_loadu_si128((const __m128i*)(src+3*k+32));
+      SWAP48(a,b,c,x,y,z,_mm_shuffle_epi8,_mm_or_si128)
+      _mm_storeu_si128((__m128i*)(dst+3*k)   ,x);
+      _mm_storeu_si128((__m128i*)(dst+3*k+16),y);
+      _mm_storeu_si128((__m128i*)(dst+3*k+32),z);
+   }
+   BGRtoRGB_C(dst+3*k,src+3*k,n-k);
+#undef M
+}
+
+//
+//  BGR to RGBA using SSSE3
+//    Each 16 byte load supplies 4 pixels
+//
+__attribute__((target("ssse3")))
+static void BGRtoRGBA_SSSE3(unsigned char* dst,const unsigned char* src,int n,unsigned char alpha)
+{
+   int k=0;
+   const __m128i mask = _mm_setr_epi8(2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1);
+   const __m128i a = _mm_set1_epi32((int)((unsigned int)alpha<<24));
+   for (;3*(n-k)>=16;k+=4)
+   {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src+3*k));
+      _mm_storeu_si128((__m128i*)(dst+4*k),_mm_or_si128(_mm_shuffle_epi8(v,mask),a));
+   }
+   BGRtoRGBA_C(dst+4*k,src+3*k,n-k,alpha);
+}
+
+//
+//  Load two 128 bit values into the lanes of a 256 bit vector
+//
+#define LOAD2(p,q) _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p))),_mm_loadu_si128((const __m128i*)(q)),1)
+
+//
+//  BGR to RGB using AVX2
+//    The two 128 bit lanes each convert 16 pixels, so 32 pixels (96 bytes)
+//    are converted per step.
+//
+__attribute__((target("avx2")))
+static void BGRtoRGB_AVX2(unsigned char* dst,const unsigned char* src,int n)
+{
+#define M(...) _mm256_setr_m128i(_mm_setr_epi8(__VA_ARGS__),_mm_setr_epi8(__VA_ARGS__))
+   int k=0;
+   for (;k+32<=n;k+=32)
+   {
+      __m256i x,y,z;
+      const unsigned char* p = src+3*k;
+      unsigned char* q = dst+3*k;
+      __m256i a = LOAD2(p   ,p+48);
+      __m256i b = LOAD2(p+16,p+64);
+      __m256i c = LOAD2(p+32,p+80);
+      SWAP48(a,b,c,x,y,z,_mm256_shuffle_epi8,_mm256_or_si256)
+      _mm_storeu_si128((__m128i*)(q)   ,_mm256_castsi256_si128(x));
+      _mm_storeu_si128((__m128i*)(q+16),_mm256_castsi256_si128(y));
+      _mm_storeu_si128((__m128i*)(q+32),_mm256_castsi256_si128(z));
+      _mm_storeu_si128((__m128i*)(q+48),_mm256_extracti128_si256(x,1));
+      _mm_storeu_si128((__m128i*)(q+64),_mm256_extracti128_si256(y,1));
+      _mm_storeu_si128((__m128i*)(q+80),_mm256_extracti128_si256(z,1));
+   }
+   BGRtoRGB_SSSE3(dst+3*k,src+3*k,n-k);
+#undef M
+}
+
+//
+//  BGR to RGBA using AVX2
+//    Each lane supplies 4 pixels
+//
+__attribute__((target("avx2")))
+static void BGRtoRGBA_AVX2(unsigned char* dst,const unsigned char* src,int n,unsigned char alpha)
+{
+   int k=0;
+   const __m256i mask = _mm256_setr_epi8(2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1,
+                                         2,1,0,-1,5,4,3,-1,8,7,6,-1,11,10,9,-1);
+   const __m256i a = _mm256_set1_epi32((int)((unsigned int)alpha<<24));
+   for (;3*(n-k)>=28;k+=8)
+   {
+      __m256i v = _mm256_shuffle_epi8(LOAD2(src+3*k,src+3*k+12),mask);
+      _mm256_storeu_si256((__m256i*)(dst+4*k),_mm256_or_si256(v,a));
+   }
+   BGRtoRGBA_SSSE3(dst+4*k,src+3*k,n-k,alpha);
+}
+#undef _
+#endif
+
+//
+//  Select the fastest kernels this CPU supports up to the one asked for
+//    Returns the kernel selected
+//
+static int Select(int kernel)
+{
+   int sel = PIX_C;
+   void (*rgb)(unsigned char*,const unsigned char*,int) = BGRtoRGB_C;
+   void (*rgba)(unsigned char*,const unsigned char*,int,unsigned char) = BGRtoRGBA_C;
+   if (kernel<0) kernel = PIX_AVX2;
+#ifdef PIX_X86
+   __builtin_cpu_init();
+   if (kernel>=PIX_AVX2 && __builtin_cpu_supports("avx2"))
+   {
+      sel  = PIX_AVX2;
+      rgb  = BGRtoRGB_AVX2;
+      rgba = BGRtoRGBA_AVX2;
+   }
+   else if (kernel>=PIX_SSSE3 && __builtin_cpu_supports("ssse3"))
+   {
+      sel  = PIX_SSSE3;
+      rgb  = BGRtoRGB_SSSE3;
+      rgba = BGRtoRGBA_SSSE3;
+   }
+#endif
+   bgr2rgba = rgba;
+   bgr2rgb  = rgb;
+   return sel;
+}
+
+//
+//  Select kernels for this CPU
+//
+static void Dispatch(void)
+{
+   Select(PIX_BEST);
+}
+
+/*
+ *  Select the pixel conversion kernels
+ *    kernel is PIX_C, PIX_SSSE3, PIX_AVX2 or PIX_BEST for the fastest
+ *    Returns the kernel selected, which is a slower one when the CPU lacks
+ *    the one asked for
+ *    Meant for benchmarks, so call it before loading images
+ */
+int PixKernel(int kernel)
+{
+   pthread_once(&dispatch,Dispatch);
+   return Select(kernel);
+}
+
+/*
+ *  Convert n pixels from BGR to RGB
+ *    dst and src may be the same buffer
+ */
+void PixBGRtoRGB(unsigned char* dst,const unsigned char* src,int n)
+{
+   pthread_once(&dispatch,Dispatch);
+   bgr2rgb(dst,src,n);
+}
+
+/*
+ *  Convert n pixels from BGR to RGBA with constant alpha
+ *    dst and src must not overlap
+ */
+void PixBGRtoRGBA(unsigned char* dst,const unsigned char* src,int n,unsigned char alpha)
+{
+   pthread_once(&dispatch,Dispatch);
+   bgr2rgba(dst,src,n,alpha);
+}
+
+/*
+ *  Flip image upside down in place
+ *    rowbytes is the number of bytes per row
+ */
+void PixFlipRows(unsigned char* img,int rowbytes,int rows)
+{
+   const int len=4096;
+   unsigned char tmp[4096];
+   unsigned char* top = img;
+   unsigned char* bot = img + (size_t)(rows-1)*rowbytes;
+   for (;top<bot;top+=rowbytes,bot-=rowbytes)
+   {
+      int k;
+      //  Swap rows in pieces that fit in the stack buffer
+      for (k=0;k<rowbytes;k+=len)
+      {
+         int n = rowbytes-k < len ? rowbytes-k : len;
+         memcpy(tmp,top+k,n);
+         memcpy(top+k,bot+k,n);
+         memcpy(bot+k,tmp,n);
+      }
+   }
+}
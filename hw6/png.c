@@ -0,0 +1,361 @@
+/*
+ *  Load texture from PNG file
+ *
+ *  Reads 8 bit RGB and RGBA images that are not interlaced, which covers
+ *  the PNG files written by image editors for textures.  The compressed
+ *  image data is inflated in one go and the rows are then unfiltered
+ *  straight into the image, bottom row first.  Unfiltering uses SSE2 where
+ *  available.  Chunk CRCs and the zlib checksum are not checked.
+ */
+#include "CSCIx229.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//
+//  Read big endian value from memory
+//
+static unsigned int Get32(const unsigned char* p)
+{
+   return ((unsigned int)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+//
+//  Paeth predictor
+//
+static int Paeth(int a,int b,int c)
+{
+   int p  = a+b-c;
+   int pa = abs(p-a);
+   int pb = abs(p-b);
+   int pc = abs(p-c);
+   return (pa<=pb && pa<=pc) ? a : (pb<=pc) ? b : c;
+}
+
+#if defined(__SSE2__)
+//
+//  Load and store 4 bytes
+//    RGB pixels are handled as 4 bytes too.  The extra byte stored is
+//    overwritten by the next pixel, so the last pixel of an RGB row is left
+//    to the C code.
+//
+static __m128i Load(const unsigned char* p)
+{
+   int v;
+   memcpy(&v,p,4);
+   return _mm_cvtsi32_si128(v);
+}
+static void Store(unsigned char* p,__m128i v)
+{
+   int x = _mm_cvtsi128_si32(v);
+   memcpy(p,&x,4);
+}
+//
+//  Absolute value of 16 bit lanes
+//
+static __m128i Abs16(__m128i x)
+{
+   return _mm_max_epi16(x,_mm_sub_epi16(_mm_setzero_si128(),x));
+}
+//
+//  Select x where m is set, otherwise y
+//
+static __m128i Select(__m128i m,__m128i x,__m128i y)
+{
+   return _mm_or_si128(_mm_and_si128(m,x),_mm_andnot_si128(m,y));
+}
+#endif
+
+//
+//  Undo filter on one row
+//    out is the unfiltered row, in the filtered row and prev the unfiltered
+//    row above (all zero for the first row)
+//    len is the row length in bytes and bpp the bytes per pixel
+//    Returns -1 for an unknown filter type
+//
+static int Unfilter(int type,unsigned char* out,const unsigned char* in,const unsigned char* prev,int len,int bpp)
+{
+   int k=0;
+#if defined(__SSE2__)
+   const __m128i zero = _mm_setzero_si128();
+#endif
+   switch (type)
+   {
+      //  None
+      case 0:
+         memcpy(out,in,len);
+         break;
+      //  Sub: add the pixel to the left
+      case 1:
+#if defined(__SSE2__)
+      {
+         __m128i a = zero;
+         for (;k+4<=len;k+=bpp)
+         {
+            a = _mm_add_epi8(a,Load(in+k));
+            Store(out+k,a);
+         }
+      }
+#endif
+         for (;k<bpp;k++)
+            out[k] = in[k];
+         for (;k<len;k++)
+            out[k] = in[k] + out[k-bpp];
+         break;
+      //  Up: add the pixel above
+      case 2:
+#if defined(__SSE2__)
+         for (;k+16<=len;k+=16)
+            _mm_storeu_si128((__m128i*)(out+k),_mm_add_epi8(_mm_loadu_si128((const __m128i*)(in+k)),_mm_loadu_si128((const __m128i*)(prev+k))));
+#endif
+         for (;k<len;k++)
+            out[k] = in[k] + prev[k];
+         break;
+      //  Average: add the mean of the pixels to the left and above
+      case 3:
+#if defined(__SSE2__)
+      {
+         //  _mm_avg_epu8 rounds up, so take off the low bit where it did
+         const __m128i one = _mm_set1_epi8(1);
+         __m128i a = zero;
+         for (;k+4<=len;k+=bpp)
+         {
+            __m128i b = Load(prev+k);
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a,b),_mm_and_si128(_mm_xor_si128(a,b),one));
+            a = _mm_add_epi8(Load(in+k),avg);
+            Store(out+k,a);
+         }
+      }
+#endif
+         for (;k<bpp;k++)
+            out[k] = in[k] + (prev[k]>>1);
+         for (;k<len;k++)
+            out[k] = in[k] + ((out[k-bpp]+prev[k])>>1);
+         break;
+      //  Paeth: add whichever of left, above and above left is closest to
+      //  left+above-above left
+      case 4:
+#if defined(__SSE2__)
+      {
+         //  Differences need 16 bits
+         __m128i a = zero;
+         __m128i c = zero;
+         for (;k+4<=len;k+=bpp)
+         {
+            __m128i b  = _mm_unpacklo_epi8(Load(prev+k),zero);
+            __m128i pa = _mm_sub_epi16(b,c);
+            __m128i pb = _mm_sub_epi16(a,c);
+            __m128i pc = Abs16(_mm_add_epi16(pa,pb));
+            __m128i min,pred;
+            pa  = Abs16(pa);
+            pb  = Abs16(pb);
+            min = _mm_min_epi16(pc,_mm_min_epi16(pa,pb));
+            pred = Select(_mm_cmpeq_epi16(pc,min),c,b);
+            pred = Select(_mm_cmpeq_epi16(pb,min),b,pred);
+            pred = Select(_mm_cmpeq_epi16(pa,min),a,pred);
+            a = _mm_add_epi8(Load(in+k),_mm_packus_epi16(pred,pred));
+            Store(out+k,a);
+            a = _mm_unpacklo_epi8(a,zero);
+            c = b;
+         }
+      }
+#endif
+         for (;k<bpp;k++)
+            out[k] = in[k] + prev[k];
+         for (;k<len;k++)
+            out[k] = in[k] + Paeth(out[k-bpp],prev[k],prev[k-bpp]);
+         break;
+      default:
+         return -1;
+   }
+   return 0;
+}
+
+//  Image data found by Chunks
+typedef struct
+{
+   unsigned int   dx,dy;       //  Image dimensions
+   int            bpp;         //  Bytes per pixel
+   const unsigned char* zdata; //  Compressed image data
+   unsigned char* zbuf;        //  Compressed data gathered from several chunks
+   size_t         zlen;        //  Size of compressed data
+} pnginfo_t;
+
+//
+//  Walk the chunks of a mapped PNG file
+//    png starts zeroed
+//    Returns 0 and sets err if the file cannot be read
+//    The caller frees zbuf either way
+//
+static int Chunks(const char* file,const unsigned char* map,size_t len,pnginfo_t* png,char* err)
+{
+   size_t pos;
+   int nidat=0;   //  Number of data chunks
+   for (pos=8;pos+12<=len;)
+   {
+      unsigned int n = Get32(map+pos);
+      const unsigned char* type = map+pos+4;
+      const unsigned char* data = map+pos+8;
+      if (n>len-pos-12) return ImageError(err,"%s PNG chunk is truncated\n",file);
+      if (!memcmp(type,"IHDR",4))
+      {
+         if (n<13) return ImageError(err,"%s PNG header is truncated\n",file);
+         png->dx = Get32(data);
+         png->dy = Get32(data+4);
+         if (data[8]!=8) return ImageError(err,"%s PNG bit depth is not 8: %d\n",file,data[8]);
+         if (data[9]==2)
+            png->bpp = 3;
+         else if (data[9]==6)
+            png->bpp = 4;
+         else
+            return ImageError(err,"%s PNG color type %d not supported (RGB or RGBA only)\n",file,data[9]);
+         if (data[10] || data[11]) return ImageError(err,"%s PNG compression or filter method not supported\n",file);
+         if (data[12]) return ImageError(err,"%s interlaced PNG files not supported\n",file);
+         if (png->dx<1 || png->dx>0x7FFFFFF/png->bpp) return ImageError(err,"%s image width %d out of range\n",file,png->dx);
+         if (png->dy<1 || png->dy>0x7FFFFFF/png->dx) return ImageError(err,"%s image height %d out of range\n",file,png->dy);
+      }
+      else if (!memcmp(type,"IDAT",4))
+      {
+         //  Data in one chunk is used in place
+         if (!nidat++)
+            png->zdata = data;
+         else
+         {
+            if (nidat==2)
+            {
+               png->zbuf = (unsigned char*)malloc(png->zlen);
+               if (!png->zbuf) Fatal("Cannot allocate memory for image %s\n",file);
+               memcpy(png->zbuf,png->zdata,png->zlen);
+            }
+            png->zbuf = (unsigned char*)realloc(png->zbuf,png->zlen+n);
+            if (!png->zbuf) Fatal("Cannot allocate memory for image %s\n",file);
+            memcpy(png->zbuf+png->zlen,data,n);
+            png->zdata = png->zbuf;
+         }
+         png->zlen += n;
+      }
+      else if (!memcmp(type,"IEND",4))
+         return 1;
+      //  Other critical chunks (upper case first letter) cannot be skipped
+      else if (!(type[0]&32) && memcmp(type,"PLTE",4))
+         return ImageError(err,"%s PNG chunk %.4s not supported\n",file,type);
+      pos += n+12;
+   }
+   return 1;
+}
+
+/*
+ *  Decode PNG file into memory as RGB or RGBA
+ *    Returns 0 and sets err (IMGERR bytes) if the file cannot be read
+ *    Makes no OpenGL calls so it may be used from any thread
+ */
+int DecodePNG(const char* file,image_t* img,char* err)
+{
+   static const unsigned char sig[8] = {137,'P','N','G',13,10,26,10};
+   const unsigned char* map;   //  File contents
+   size_t         len;         //  File size
+   pnginfo_t      png;         //  Header and compressed data
+   unsigned char* raw;         //  Filtered rows
+   unsigned char* image;       //  Image data
+   unsigned char* zero;        //  Row above the first row
+   size_t         row,size;    //  Bytes per row and in filtered image
+   const char*    bad=NULL;    //  Error in the compressed data
+   int            filter=-1;   //  Filter type not supported
+   unsigned int   k;
+
+   //  Map file
+   map = (const unsigned char*)MapFile(file,&len);
+   if (!map) return ImageError(err,"Cannot open file %s\n",file);
+   memset(&png,0,sizeof(pnginfo_t));
+   if (len<8 || memcmp(map,sig,8))
+      bad = "Image magic not PNG in %s\n";
+   else if (!Chunks(file,map,len,&png,err))
+   {
+      free(png.zbuf);
+      UnmapFile(map,len);
+      return 0;
+   }
+   else if (!png.bpp)
+      bad = "%s PNG header missing\n";
+   else if (png.zlen<2)
+      bad = "%s PNG image data missing\n";
+   //  zlib header: deflate without preset dictionary
+   else if ((png.zdata[0]&15)!=8 || (png.zdata[0]*256+png.zdata[1])%31 || (png.zdata[1]&32))
+      bad = "%s PNG image data is not deflate compressed\n";
+   if (bad)
+   {
+      free(png.zbuf);
+      UnmapFile(map,len);
+      return ImageError(err,bad,file);
+   }
+
+   //  Inflate
+   row  = (size_t)png.bpp*png.dx;
+   size = (row+1)*png.dy;
+   raw  = (unsigned char*)malloc(size);
+   image = (unsigned char*)malloc(row*png.dy);
+   zero = (unsigned char*)calloc(row,1);
+   if (!raw || !image || !zero) Fatal("Cannot allocate memory for image %s\n",file);
+   if (Inflate(raw,size,png.zdata+2,png.zlen-2)!=(long)size) bad = "%s PNG image data is damaged\n";
+   free(png.zbuf);
+   UnmapFile(map,len);
+
+   //  Unfilter rows (PNG stores the top row first)
+   for (k=0;k<png.dy && !bad && filter<0;k++)
+   {
+      const unsigned char* in = raw + k*(row+1);
+      unsigned char* out = image + (png.dy-1-k)*row;
+      if (Unfilter(in[0],out,in+1,k ? out+row : zero,row,png.bpp)) filter = in[0];
+   }
+   free(raw);
+   free(zero);
+   if (bad || filter>=0)
+   {
+      free(image);
+      return bad ? ImageError(err,bad,file) : ImageError(err,"%s PNG filter type %d not supported\n",file,filter);
+   }
+
+   img->dx   = png.dx;
+   img->dy   = png.dy;
+   img->n    = png.bpp;
+   img->data = image;
+   return 1;
+}
+
+/*
+ *  Read PNG file into memory as DecodePNG does, exiting on errors
+ */
+void ReadPNG(const char* file,image_t* img)
+{
+   char err[IMGERR];
+   if (!DecodePNG(file,img,err)) Fatal("%s",err);
+}
+
+/*
+ *  Load texture from PNG file
+ *    Textures already loaded are returned from the texture cache
+ */
+unsigned int LoadTexPNG(const char* file)
+{
+   unsigned int  texture;  // Texture name
+   unsigned long bytes;    // Texture size
+   image_t       img;      // Image
+
+   //  Return cached texture if the file was loaded before
+   texture = TexCacheFind(file);
+   if (texture) return texture;
+   //  Block compressed textures are encoded once and kept on disk
+   if (TexCompressMode()!=BC_NONE && TexHasBC())
+      texture = LoadTexBC(file,0,&bytes);
+   //  Decode and copy to texture
+   else
+   {
+      ReadPNG(file,&img);
+      texture = TexImage(file,&img,0,&bytes);
+      free(img.data);
+   }
+   //  Remember texture
+   TexCacheAdd(file,texture,bytes);
+   return texture;
+}
@@ -0,0 +1,234 @@
+/*
+ *  Compact vertex format for meshes
+ *
+ *  A quantized mesh keeps its float vertexes in memory for processing, but
+ *  its vertex buffer holds 16 bit integer positions, 8 bit normals and half
+ *  float texture coordinates, which takes 16 bytes per vertex instead of 32
+ *  and halves the vertex bandwidth of drawing.  (Packed 10:10:10:2 normals
+ *  would be finer, but glNormalPointer only takes packed types with four
+ *  components, so they need a shader attribute.)
+ *
+ *  Positions are stored relative to the center of the bounding box in steps
+ *  of the longest side over 65534, and DrawMeshLOD multiplies the modelview
+ *  matrix by the decode matrix of the mesh to turn them back into object
+ *  coordinates.  The step is the same on every axis so the decode matrix
+ *  only scales uniformly and normals keep their direction.
+ */
+#include "CSCIx229.h"
+
+//
+//  Convert float to half float rounding to nearest even
+//
+static unsigned short Half(float f)
+{
+   union {float f; unsigned int u;} x;
+   unsigned int sign,m,h,rem,tie;
+   int e;
+   x.f  = f;
+   sign = (x.u>>16) & 0x8000;
+   e    = (int)((x.u>>23) & 0xFF);
+   m    = x.u & 0x7FFFFF;
+   //  Infinity and NaN
+   if (e==0xFF) return sign | 0x7C00 | (m ? 0x200 : 0);
+   e += 15-127;
+   //  Too large
+   if (e>=31) return sign | 0x7C00;
+   //  Too small for a normal half float
+   if (e<=0)
+   {
+      int shift = 14-e;
+      if (shift>24) return sign;
+      m  |= 0x800000;
+      h   = m>>shift;
+      rem = m & ((1u<<shift)-1);
+      tie = 1u<<(shift-1);
+   }
+   else
+   {
+      h   = (e<<10) | (m>>13);
+      rem = m & 0x1FFF;
+      tie = 0x1000;
+   }
+   //  A carry into the exponent gives the next power of two or infinity
+   if (rem>tie || (rem==tie && (h&1))) h++;
+   return sign | h;
+}
+
+//
+//  Convert half float to float
+//
+static float Float(unsigned short h)
+{
+   int e = (h>>10) & 0x1F;
+   int m = h & 0x3FF;
+   float f = e==0 ? ldexpf(m,-24) : e==31 ? (m ? NAN : INFINITY) : ldexpf(m|0x400,e-25);
+   return (h & 0x8000) ? -f : f;
+}
+
+//
+//  Convert -1 to 1 to a signed byte
+//
+static signed char PackSnorm(float x)
+{
+   long c = lrintf(127*x);
+   return c>127 ? 127 : c<-127 ? -127 : c;
+}
+
+//
+//  Convert a signed byte to -1 to 1
+//
+static float UnpackSnorm(signed char c)
+{
+   return c<-127 ? -1 : c/127.0;
+}
+
+//
+//  Pack one vertex
+//    s is the step of positions and c the center
+//
+static void Encode(const float v[8],int attr,float s,const float c[3],unsigned char* p)
+{
+   int k;
+   short* q = (short*)p;
+   for (k=0;k<3;k++)
+   {
+      long i = lrintf((v[k]-c[k])/s);
+      q[k] = i>32767 ? 32767 : i<-32767 ? -32767 : i;
+   }
+   q[3] = 0;
+   p += 8;
+   //  Normals are made unit length to fit (drawing normalizes them anyway)
+   if (attr & MESH_NORMAL)
+   {
+      signed char* n = (signed char*)p;
+      double l = sqrt(v[3]*v[3]+v[4]*v[4]+v[5]*v[5]);
+      if (l>0) l = 1/l;
+      for (k=0;k<3;k++)
+         n[k] = PackSnorm(l*v[3+k]);
+      n[3] = 0;
+      p += 4;
+   }
+   if (attr & MESH_TEXTURE)
+   {
+      unsigned short* h = (unsigned short*)p;
+      h[0] = Half(v[6]);
+      h[1] = Half(v[7]);
+   }
+}
+
+//
+//  Unpack one vertex (attributes not stored are zero)
+//
+static void Decode(const unsigned char* p,int attr,float s,const float c[3],float v[8])
+{
+   int k;
+   const short* q = (const short*)p;
+   memset(v,0,8*sizeof(float));
+   for (k=0;k<3;k++)
+      v[k] = c[k] + s*q[k];
+   p += 8;
+   if (attr & MESH_NORMAL)
+   {
+      const signed char* n = (const signed char*)p;
+      for (k=0;k<3;k++)
+         v[3+k] = UnpackSnorm(n[k]);
+      p += 4;
+   }
+   if (attr & MESH_TEXTURE)
+   {
+      const unsigned short* h = (const unsigned short*)p;
+      v[6] = Float(h[0]);
+      v[7] = Float(h[1]);
+   }
+}
+
+//
+//  Angle between two vectors in degrees (0 if either is zero)
+//
+static double Angle(const float a[3],const float b[3])
+{
+   double ab = a[0]*b[0]+a[1]*b[1]+a[2]*b[2];
+   double aa = a[0]*a[0]+a[1]*a[1]+a[2]*a[2];
+   double bb = b[0]*b[0]+b[1]*b[1]+b[2]*b[2];
+   double cs;
+   if (aa==0 || bb==0) return 0;
+   cs = ab/sqrt(aa*bb);
+   return acos(cs>1 ? 1 : cs<-1 ? -1 : cs)*180/M_PI;
+}
+
+/*
+ *  Bytes per vertex in the vertex buffer of a mesh
+ */
+int MeshStride(const mesh_t* mesh)
+{
+   if (mesh->format!=MESH_QUANT) return 8*sizeof(float);
+   return 8 + (mesh->attr & MESH_NORMAL ? 4 : 0) + (mesh->attr & MESH_TEXTURE ? 4 : 0);
+}
+
+/*
+ *  Pack the vertexes of a quantized mesh as they go in its vertex buffer
+ *    buf holds MeshStride() bytes per vertex
+ */
+void PackMesh(const mesh_t* mesh,void* buf)
+{
+   int k;
+   int stride = MeshStride(mesh);
+   const float* c = mesh->decode+12;
+   for (k=0;k<mesh->nvert;k++)
+      Encode(mesh->vert+8*k,mesh->attr,mesh->decode[0],c,(unsigned char*)buf+(size_t)stride*k);
+}
+
+/*
+ *  Switch a mesh to the compact vertex format
+ *    Sets the decode matrix from the bounding box and measures the largest
+ *    error of each attribute against the float vertexes (err may be NULL)
+ *    The vertexes are packed by UploadMesh, so call before it
+ */
+void QuantizeMesh(mesh_t* mesh,meshquant_t* err)
+{
+   int k,i;
+   float s=0;
+   float* c = mesh->decode+12;
+   meshquant_t e;
+   unsigned char p[16];
+   //  Step of positions along the longest side of the box
+   for (k=0;k<3;k++)
+   {
+      float d = mesh->max[k]-mesh->min[k];
+      if (d>s) s = d;
+      c[k] = 0.5*(mesh->min[k]+mesh->max[k]);
+   }
+   s = s>0 ? s/65534 : 1;
+   //  Decode matrix (column major)
+   for (k=0;k<12;k++)
+      mesh->decode[k] = 0;
+   mesh->decode[0] = mesh->decode[5] = mesh->decode[10] = s;
+   mesh->decode[15] = 1;
+   mesh->format = MESH_QUANT;
+   if (!err) return;
+
+   //  Largest errors
+   memset(&e,0,sizeof(e));
+   e.stride[0] = 8*sizeof(float);
+   e.stride[1] = MeshStride(mesh);
+   for (k=0;k<mesh->nvert;k++)
+   {
+      const float* v = mesh->vert+8*k;
+      float w[8];
+      double d=0,a;
+      Encode(v,mesh->attr,s,c,p);
+      Decode(p,mesh->attr,s,c,w);
+      for (i=0;i<3;i++)
+         d += (w[i]-v[i])*(w[i]-v[i]);
+      if (sqrt(d)>e.pos) e.pos = sqrt(d);
+      if (mesh->attr & MESH_NORMAL)
+      {
+         a = Angle(v+3,w+3);
+         if (a>e.normal) e.normal = a;
+      }
+      if (mesh->attr & MESH_TEXTURE)
+         for (i=6;i<8;i++)
+            if (fabs(w[i]-v[i])>e.uv) e.uv = fabs(w[i]-v[i]);
+   }
+   *err = e;
+}
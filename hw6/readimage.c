@@ -0,0 +1,49 @@
+/*
+ *  Read image file of any supported type
+ */
+#include "CSCIx229.h"
+
+/*
+ *  Print an image decoder error message to err (IMGERR bytes)
+ *    Returns 0 so decoders can return it as their result
+ */
+int ImageError(char* err,const char* format,...)
+{
+   va_list args;
+   va_start(args,format);
+   vsnprintf(err,IMGERR,format,args);
+   va_end(args);
+   return 0;
+}
+
+/*
+ *  Decode BMP or PNG file into memory
+ *    The type is taken from the first bytes of the file, not its name
+ *    Returns 0 and sets err (IMGERR bytes) if the file cannot be read
+ *    Makes no OpenGL calls so it may be used from any thread
+ */
+int DecodeImage(const char* file,image_t* img,char* err)
+{
+   unsigned char magic[4]={0,0,0,0};
+   FILE* f = fopen(file,"rb");
+   if (!f) return ImageError(err,"Cannot open file %s\n",file);
+   if (fread(magic,1,4,f)<2)
+   {
+      fclose(f);
+      return ImageError(err,"Cannot read magic from %s\n",file);
+   }
+   fclose(f);
+   if (magic[0]==137 && !memcmp(magic+1,"PNG",3))
+      return DecodePNG(file,img,err);
+   else
+      return DecodeBMP(file,img,err);
+}
+
+/*
+ *  Read BMP or PNG file into memory as DecodeImage does, exiting on errors
+ */
+void ReadImage(const char* file,image_t* img)
+{
+   char err[IMGERR];
+   if (!DecodeImage(file,img,err)) Fatal("%s",err);
+}
@@ -0,0 +1,433 @@
+/*
+ *  Mesh simplification for levels of detail
+ *
+ *  Each level is built from the one before it by collapsing edges in order
+ *  of their quadric error (Garland and Heckbert).  A collapse moves one
+ *  vertex onto the other end of the edge, so every level indexes the
+ *  vertexes of the full mesh and they all share one vertex buffer.
+ *  Vertexes that share a position with another vertex (texture or normal
+ *  seams), that are used by more than one material, or that lie on an open
+ *  border never move, so seams, material borders and outlines are kept.
+ *
+ *  Collapses are made in passes: the edges are sorted by cost, and the
+ *  cheapest collapses whose neighborhoods do not overlap are made until
+ *  the pass is out of edges or the level has few enough triangles.
+ */
+#include "CSCIx229.h"
+
+#define MAXLOD 8  //  Maximum number of simplified levels
+
+//  Plane quadric (xx xy xz xw yy yz yw zz zw ww) and total area
+typedef struct
+{
+   double a[10];
+   double w;
+} quadric_t;
+
+//  Edge collapse
+typedef struct
+{
+   int    u,v;   //  Vertex u moves to v
+   double cost;  //  Mean squared distance
+} collapse_t;
+
+//  Default fraction of triangles kept at each level
+static const float ratios[MAXLOD] = {0.5,0.25,0.125,0.0625,0.03125,0.015625,0.0078125,0.00390625};
+
+//
+//  Add triangle plane to quadric weighted by area
+//
+static void AddPlane(quadric_t* Q,const float* p0,const float* p1,const float* p2)
+{
+   double u[3],v[3],n[3],l,d;
+   int k;
+   for (k=0;k<3;k++)
+   {
+      u[k] = p1[k]-p0[k];
+      v[k] = p2[k]-p0[k];
+   }
+   n[0] = u[1]*v[2]-u[2]*v[1];
+   n[1] = u[2]*v[0]-u[0]*v[2];
+   n[2] = u[0]*v[1]-u[1]*v[0];
+   l = sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+   if (l==0) return;
+   n[0] /= l;
+   n[1] /= l;
+   n[2] /= l;
+   d = -(n[0]*p0[0]+n[1]*p0[1]+n[2]*p0[2]);
+   l *= 0.5;
+   Q->a[0] += l*n[0]*n[0]; Q->a[1] += l*n[0]*n[1]; Q->a[2] += l*n[0]*n[2]; Q->a[3] += l*n[0]*d;
+   Q->a[4] += l*n[1]*n[1]; Q->a[5] += l*n[1]*n[2]; Q->a[6] += l*n[1]*d;
+   Q->a[7] += l*n[2]*n[2]; Q->a[8] += l*n[2]*d;
+   Q->a[9] += l*d*d;
+   Q->w += l;
+}
+
+//
+//  Mean squared distance of a point from the planes of two quadrics
+//
+static double Cost(const quadric_t* A,const quadric_t* B,const float* p)
+{
+   double a[10],e;
+   double x=p[0],y=p[1],z=p[2];
+   int k;
+   for (k=0;k<10;k++)
+      a[k] = A->a[k]+B->a[k];
+   e = a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+     + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+     + a[7]*z*z + 2*a[8]*z
+     + a[9];
+   if (A->w+B->w>0) e /= A->w+B->w;
+   return e>0 ? e : 0;
+}
+
+//
+//  Compare positions of vertexes
+//
+static const float* sortvert;
+static int PosCmp(const void* a,const void* b)
+{
+   const float* p = sortvert+8*(*(const int*)a);
+   const float* q = sortvert+8*(*(const int*)b);
+   int k;
+   for (k=0;k<3;k++)
+      if (p[k]!=q[k]) return p[k]<q[k] ? -1 : +1;
+   return *(const int*)a - *(const int*)b;
+}
+
+//
+//  Compare edges by vertexes
+//
+static int EdgeCmp(const void* a,const void* b)
+{
+   const int* A = (const int*)a;
+   const int* B = (const int*)b;
+   if (A[0]!=B[0]) return A[0]-B[0];
+   return A[1]-B[1];
+}
+
+//
+//  Compare collapses by cost
+//
+static int CollapseCmp(const void* a,const void* b)
+{
+   const collapse_t* A = (const collapse_t*)a;
+   const collapse_t* B = (const collapse_t*)b;
+   if (A->cost!=B->cost) return A->cost<B->cost ? -1 : +1;
+   return A->u-B->u;
+}
+
+//
+//  Unique edges of the triangles, smaller vertex first
+//    Returns the number of edges and sets how many triangles use each
+//
+static int Edges(const unsigned int* ind,int ntri,int* edge,int* count)
+{
+   int k,n=0;
+   for (k=0;k<3*ntri;k++)
+   {
+      int a = ind[k];
+      int b = ind[k%3==2 ? k-2 : k+1];
+      edge[2*k]   = a<b ? a : b;
+      edge[2*k+1] = a<b ? b : a;
+   }
+   qsort(edge,3*ntri,2*sizeof(int),EdgeCmp);
+   for (k=0;k<3*ntri;k++)
+   {
+      if (n && edge[2*n-2]==edge[2*k] && edge[2*n-1]==edge[2*k+1])
+         count[n-1]++;
+      else
+      {
+         edge[2*n]   = edge[2*k];
+         edge[2*n+1] = edge[2*k+1];
+         count[n++]  = 1;
+      }
+   }
+   return n;
+}
+
+//
+//  Check that moving u to v does not flip any remaining triangle of u
+//
+static int Flips(const float* vert,const unsigned int* ind,const int* adj,int nadj,int u,int v)
+{
+   int i,k;
+   for (i=0;i<nadj;i++)
+   {
+      const unsigned int* t = ind+3*adj[i];
+      const float* p[3];
+      double n0[3],n1[3],e0[3],e1[3];
+      if (t[0]==(unsigned int)v || t[1]==(unsigned int)v || t[2]==(unsigned int)v) continue;
+      for (k=0;k<3;k++)
+         p[k] = vert+8*t[k];
+      //  Normal before and after the move
+      for (k=0;k<3;k++)
+      {
+         e0[k] = p[1][k]-p[0][k];
+         e1[k] = p[2][k]-p[0][k];
+      }
+      n0[0] = e0[1]*e1[2]-e0[2]*e1[1];
+      n0[1] = e0[2]*e1[0]-e0[0]*e1[2];
+      n0[2] = e0[0]*e1[1]-e0[1]*e1[0];
+      for (k=0;k<3;k++)
+         if (t[k]==(unsigned int)u) p[k] = vert+8*v;
+      for (k=0;k<3;k++)
+      {
+         e0[k] = p[1][k]-p[0][k];
+         e1[k] = p[2][k]-p[0][k];
+      }
+      n1[0] = e0[1]*e1[2]-e0[2]*e1[1];
+      n1[1] = e0[2]*e1[0]-e0[0]*e1[2];
+      n1[2] = e0[0]*e1[1]-e0[1]*e1[0];
+      if (n0[0]*n1[0]+n0[1]*n1[1]+n0[2]*n1[2]<=0) return 1;
+   }
+   return 0;
+}
+
+//
+//  Simplify triangles to at most target triangles
+//    ind and mtl (draw range of each triangle) are updated in place
+//    Returns the number of triangles left and raises err to the largest
+//    mean squared distance of a collapse
+//
+static int Simplify(const mesh_t* mesh,unsigned int* ind,int* mtl,int ntri,int target,
+                    const char* locked,quadric_t* Q,double* err)
+{
+   int k,t;
+   int nv = mesh->nvert;
+   int* edge   = (int*)malloc(6*sizeof(int)*(ntri+1));
+   int* count  = (int*)malloc(3*sizeof(int)*(ntri+1));
+   int* off    = (int*)malloc(sizeof(int)*(nv+1));
+   int* adj    = (int*)malloc(3*sizeof(int)*(ntri+1));
+   int* remap  = (int*)malloc(sizeof(int)*nv);
+   char* touch = (char*)malloc(nv);
+   collapse_t* col = (collapse_t*)malloc(sizeof(collapse_t)*3*(ntri+1));
+   if (!edge || !count || !off || !adj || !remap || !touch || !col) Fatal("Cannot allocate memory for mesh\n");
+
+   while (ntri>target)
+   {
+      int ne,nc=0,removed=0,n;
+      //  Triangles of each vertex
+      memset(off,0,sizeof(int)*(nv+1));
+      for (k=0;k<3*ntri;k++)
+         off[ind[k]+1]++;
+      for (k=0;k<nv;k++)
+         off[k+1] += off[k];
+      for (k=0;k<3*ntri;k++)
+         adj[off[ind[k]]++] = k/3;
+      for (k=nv;k>0;k--)
+         off[k] = off[k-1];
+      off[0] = 0;
+      //  Cheapest direction of each edge
+      ne = Edges(ind,ntri,edge,count);
+      for (k=0;k<ne;k++)
+      {
+         int a = edge[2*k];
+         int b = edge[2*k+1];
+         double ca = locked[a] ? 1e30 : Cost(Q+a,Q+b,mesh->vert+8*b);
+         double cb = locked[b] ? 1e30 : Cost(Q+a,Q+b,mesh->vert+8*a);
+         if (ca>=1e30 && cb>=1e30) continue;
+         col[nc].u    = ca<=cb ? a : b;
+         col[nc].v    = ca<=cb ? b : a;
+         col[nc].cost = ca<=cb ? ca : cb;
+         nc++;
+      }
+      qsort(col,nc,sizeof(collapse_t),CollapseCmp);
+      //  Collapse edges whose neighborhoods have not changed in this pass
+      memset(touch,0,nv);
+      for (k=0;k<nv;k++)
+         remap[k] = k;
+      for (n=k=0;k<nc && ntri-removed>target;k++)
+      {
+         int u = col[k].u;
+         int v = col[k].v;
+         int i,j;
+         if (touch[u] || touch[v]) continue;
+         if (Flips(mesh->vert,ind,adj+off[u],off[u+1]-off[u],u,v)) continue;
+         remap[u] = v;
+         for (i=off[u];i<off[u+1];i++)
+         {
+            const unsigned int* tri = ind+3*adj[i];
+            for (j=0;j<3;j++)
+               touch[tri[j]] = 1;
+            if (tri[0]==(unsigned int)v || tri[1]==(unsigned int)v || tri[2]==(unsigned int)v) removed++;
+         }
+         for (j=0;j<10;j++)
+            Q[v].a[j] += Q[u].a[j];
+         Q[v].w += Q[u].w;
+         if (col[k].cost>*err) *err = col[k].cost;
+         n++;
+      }
+      if (!n) break;
+      //  Move vertexes and drop triangles that lost an edge
+      for (n=t=0;t<ntri;t++)
+      {
+         unsigned int a = remap[ind[3*t]];
+         unsigned int b = remap[ind[3*t+1]];
+         unsigned int c = remap[ind[3*t+2]];
+         if (a==b || b==c || c==a) continue;
+         ind[3*n]   = a;
+         ind[3*n+1] = b;
+         ind[3*n+2] = c;
+         mtl[n++] = mtl[t];
+      }
+      ntri = n;
+   }
+   free(edge);
+   free(count);
+   free(off);
+   free(adj);
+   free(remap);
+   free(touch);
+   free(col);
+   return ntri;
+}
+
+//
+//  Vertexes that must not move
+//    Shared positions (seams), more than one material, or an open border
+//
+static void Lock(const mesh_t* mesh,const unsigned int* ind,const int* mtl,int ntri,char* locked)
+{
+   int i,k,n;
+   int nv = mesh->nvert;
+   int* order = (int*)malloc(sizeof(int)*(nv+1));
+   int* last  = (int*)malloc(sizeof(int)*(nv+1));
+   int* edge  = (int*)malloc(6*sizeof(int)*(ntri+1));
+   int* count = (int*)malloc(3*sizeof(int)*(ntri+1));
+   if (!order || !last || !edge || !count) Fatal("Cannot allocate memory for mesh\n");
+   memset(locked,0,nv);
+   //  Seams
+   for (k=0;k<nv;k++)
+      order[k] = k;
+   sortvert = mesh->vert;
+   qsort(order,nv,sizeof(int),PosCmp);
+   for (k=1;k<nv;k++)
+      if (!memcmp(mesh->vert+8*order[k],mesh->vert+8*order[k-1],3*sizeof(float)))
+         locked[order[k]] = locked[order[k-1]] = 1;
+   //  Material borders
+   for (k=0;k<nv;k++)
+      last[k] = -1;
+   for (k=0;k<3*ntri;k++)
+   {
+      int v = ind[k];
+      if (last[v]>=0 && last[v]!=mtl[k/3]) locked[v] = 1;
+      last[v] = mtl[k/3];
+   }
+   //  Open borders are edges with one triangle
+   n = Edges(ind,ntri,edge,count);
+   for (i=0;i<n;i++)
+      if (count[i]==1)
+         locked[edge[2*i]] = locked[edge[2*i+1]] = 1;
+   free(order);
+   free(last);
+   free(edge);
+   free(count);
+}
+
+/*
+ *  Build levels of detail for a mesh
+ *    ratio gives the fraction of the triangles of the full mesh to keep at
+ *    each level, or NULL halves the triangles at each level
+ *    Levels that cannot be simplified further are not added
+ *    The index buffer is uploaded again if the mesh has one
+ */
+void BuildMeshLOD(mesh_t* mesh,int n,const float ratio[])
+{
+   int k,r,ntri;
+   unsigned int* ind;   //  Current triangles
+   int*   mtl;          //  Draw range of each triangle
+   char*  locked;       //  Vertexes that must stay in place
+   quadric_t* Q;        //  Quadric of each vertex
+   int*   first;        //  First index of each draw range
+   double err=0;        //  Largest mean squared distance
+
+   //  Discard previous levels
+   for (k=0;k<mesh->nlod;k++)
+   {
+      free(mesh->lod[k].ind);
+      free(mesh->lod[k].range);
+   }
+   free(mesh->lod);
+   mesh->lod  = NULL;
+   mesh->nlod = 0;
+   if (n>MAXLOD) n = MAXLOD;
+   if (n<1 || mesh->nind<3) return;
+   if (!ratio) ratio = ratios;
+
+   //  Copy full mesh
+   ntri = mesh->nind/3;
+   ind    = (unsigned int*)malloc(sizeof(unsigned int)*3*ntri);
+   mtl    = (int*)malloc(sizeof(int)*ntri);
+   locked = (char*)malloc(mesh->nvert+1);
+   Q      = (quadric_t*)calloc(mesh->nvert+1,sizeof(quadric_t));
+   first  = (int*)malloc(sizeof(int)*(mesh->nrange+1));
+   mesh->lod = (meshlod_t*)calloc(n,sizeof(meshlod_t));
+   if (!ind || !mtl || !locked || !Q || !first || !mesh->lod) Fatal("Cannot allocate memory for mesh\n");
+   memcpy(ind,mesh->ind,sizeof(unsigned int)*3*ntri);
+   for (r=0;r<mesh->nrange;r++)
+      for (k=mesh->range[r].first/3;k<(mesh->range[r].first+mesh->range[r].count)/3;k++)
+         mtl[k] = r;
+   //  Quadrics of the planes around each vertex
+   for (k=0;k<ntri;k++)
+   {
+      const float* p0 = mesh->vert+8*ind[3*k];
+      const float* p1 = mesh->vert+8*ind[3*k+1];
+      const float* p2 = mesh->vert+8*ind[3*k+2];
+      quadric_t q;
+      memset(&q,0,sizeof(q));
+      AddPlane(&q,p0,p1,p2);
+      for (r=0;r<3;r++)
+      {
+         int i;
+         for (i=0;i<10;i++)
+            Q[ind[3*k+r]].a[i] += q.a[i];
+         Q[ind[3*k+r]].w += q.w;
+      }
+   }
+   Lock(mesh,ind,mtl,ntri,locked);
+
+   //  Each level continues from the one before
+   for (k=0;k<n;k++)
+   {
+      meshlod_t* lod = mesh->lod+k;
+      int target = ratio[k]*(mesh->nind/3);
+      int m = Simplify(mesh,ind,mtl,ntri,target,locked,Q,&err);
+      int t;
+      //  Stop when nothing changed
+      if (m==ntri) break;
+      ntri = m;
+      //  Sort triangles into draw ranges in mesh order
+      lod->nind  = 3*ntri;
+      lod->ind   = (unsigned int*)malloc(sizeof(unsigned int)*(3*ntri+1));
+      lod->range = (meshrange_t*)malloc(sizeof(meshrange_t)*(mesh->nrange+1));
+      if (!lod->ind || !lod->range) Fatal("Cannot allocate memory for mesh\n");
+      for (r=0;r<mesh->nrange;r++)
+         first[r+1] = 0;
+      for (t=0;t<ntri;t++)
+         first[mtl[t]+1] += 3;
+      for (r=first[0]=0;r<mesh->nrange;r++)
+         first[r+1] += first[r];
+      for (r=0;r<mesh->nrange;r++)
+         if (first[r+1]>first[r])
+         {
+            meshrange_t* R = lod->range + lod->nrange++;
+            R->mtl   = mesh->range[r].mtl;
+            R->first = first[r];
+            R->count = first[r+1]-first[r];
+         }
+      for (t=0;t<ntri;t++)
+      {
+         memcpy(lod->ind+first[mtl[t]],ind+3*t,3*sizeof(unsigned int));
+         first[mtl[t]] += 3;
+      }
+      lod->error = sqrt(err);
+      mesh->nlod++;
+   }
+   free(ind);
+   free(mtl);
+   free(locked);
+   free(Q);
+   free(first);
+   if (mesh->ibo) UploadMesh(mesh);
+}
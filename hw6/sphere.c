@@ -0,0 +1,151 @@
+/*
+ *  Cached sphere meshes
+ *
+ *  Drawing a sphere one glVertex at a time costs a sine and cosine of each
+ *  angle for every vertex of every sphere in every frame.  Instead a unit
+ *  sphere is built once for each pair of angle steps, with the sines and
+ *  cosines of each latitude and longitude worked out once, and kept in a
+ *  vertex buffer.  Each sphere is then one draw of that buffer moved and
+ *  scaled by the modelview matrix.
+ */
+#include "CSCIx229.h"
+
+//  Sphere mesh for a pair of angle steps
+typedef struct
+{
+   int dth,dph;          //  Degrees between meridians and between latitudes
+   int tex;              //  Texture coordinates
+   mesh_t mesh;          //  Unit sphere
+} sphere_t;
+
+//  Sphere meshes built so far
+static int Nsphere=0,Msphere=0;
+static sphere_t** spheres=NULL;
+
+//
+//  Build unit sphere with nth meridians and nph latitude bands
+//    Vertexes are th degrees around the z axis from y and ph degrees up
+//    from the xy plane, with texture coordinates th/360 and (ph+90)/180
+//    when tex is set, and the triangles wind like the quad strips they
+//    replace
+//
+static void Build(mesh_t* mesh,int nth,int nph,int tex)
+{
+   int i,j,k;
+   float* S = (float*)malloc(2*sizeof(float)*(nth+nph+2));
+   float* C = S+nth+nph+2;
+   float* v;
+   if (!S) Fatal("Cannot allocate memory for sphere\n");
+   //  Sines and cosines of the meridians then the latitudes
+   for (i=0;i<=nth;i++)
+   {
+      S[i] = sin(2*M_PI*i/nth);
+      C[i] = cos(2*M_PI*i/nth);
+   }
+   for (j=0;j<=nph;j++)
+   {
+      S[nth+1+j] = sin(M_PI*j/nph-M_PI/2);
+      C[nth+1+j] = cos(M_PI*j/nph-M_PI/2);
+   }
+   //  Vertexes (the seam is repeated for the texture coordinates)
+   memset(mesh,0,sizeof(mesh_t));
+   mesh->nvert = (nth+1)*(nph+1);
+   mesh->vert  = (float*)malloc(8*sizeof(float)*mesh->nvert);
+   if (!mesh->vert) Fatal("Cannot allocate memory for sphere\n");
+   for (v=mesh->vert,j=0;j<=nph;j++)
+      for (i=0;i<=nth;i++,v+=8)
+      {
+         float cph = C[nth+1+j];
+         v[0] = v[3] = S[i]*cph;
+         v[1] = v[4] = C[i]*cph;
+         v[2] = v[5] = S[nth+1+j];
+         v[6] = (float)i/nth;
+         v[7] = (float)j/nph;
+      }
+   free(S);
+   //  Two triangles per quad, except one at the poles
+   mesh->ind = (unsigned int*)malloc(6*sizeof(unsigned int)*nth*nph);
+   if (!mesh->ind) Fatal("Cannot allocate memory for sphere\n");
+   for (k=0,j=0;j<nph;j++)
+      for (i=0;i<nth;i++)
+      {
+         unsigned int a = j*(nth+1)+i;  //  (th,ph)
+         unsigned int b = a+nth+1;      //  (th,ph+d)
+         if (j<nph-1)
+         {
+            mesh->ind[k++] = a;
+            mesh->ind[k++] = b;
+            mesh->ind[k++] = b+1;
+         }
+         if (j>0)
+         {
+            mesh->ind[k++] = a;
+            mesh->ind[k++] = b+1;
+            mesh->ind[k++] = a+1;
+         }
+      }
+   mesh->nind = mesh->ncorner = k;
+   //  One range that keeps the current material
+   mesh->nrange = 1;
+   mesh->range = (meshrange_t*)malloc(sizeof(meshrange_t));
+   if (!mesh->range) Fatal("Cannot allocate memory for sphere\n");
+   mesh->range[0].mtl   = -1;
+   mesh->range[0].first = 0;
+   mesh->range[0].count = k;
+   mesh->attr = tex ? MESH_NORMAL | MESH_TEXTURE : MESH_NORMAL;
+   MeshBounds(mesh);
+}
+
+/*
+ *  Unit sphere with dth degrees between meridians and dph between latitudes
+ *    Texture coordinates are only drawn when tex is set, otherwise the
+ *    current texture coordinate is used for every vertex
+ *    Built and uploaded the first time each pair of steps is asked for
+ *    The mesh belongs to the cache
+ */
+const mesh_t* SphereMesh(int dth,int dph,int tex)
+{
+   int k,nth,nph;
+   sphere_t* s;
+   tex = tex!=0;
+   for (k=0;k<Nsphere;k++)
+      if (spheres[k]->dth==dth && spheres[k]->dph==dph && spheres[k]->tex==tex)
+         return &spheres[k]->mesh;
+   //  Add a mesh
+   if (Nsphere==Msphere)
+   {
+      Msphere = Msphere ? 2*Msphere : 8;
+      spheres = (sphere_t**)realloc(spheres,Msphere*sizeof(sphere_t*));
+      if (!spheres) Fatal("Cannot allocate memory for sphere\n");
+   }
+   s = (sphere_t*)malloc(sizeof(sphere_t));
+   if (!s) Fatal("Cannot allocate memory for sphere\n");
+   spheres[Nsphere++] = s;
+   s->dth = dth;
+   s->dph = dph;
+   s->tex = tex;
+   //  Steps that do not divide the circle are evened out
+   nth = dth>0 ? (360+dth/2)/dth : 0;
+   nph = dph>0 ? (180+dph/2)/dph : 0;
+   Build(&s->mesh,nth<3 ? 3 : nth,nph<2 ? 2 : nph,tex);
+   UploadMesh(&s->mesh);
+   return &s->mesh;
+}
+
+/*
+ *  Draw a sphere
+ *     at (x,y,z)
+ *     radius (r)
+ *     dth degrees between meridians and dph between latitudes
+ *     texture coordinates when tex is set
+ *  The current color and material are used
+ */
+void DrawSphere(double x,double y,double z,double r,int dth,int dph,int tex)
+{
+   const mesh_t* mesh = SphereMesh(dth,dph,tex);
+   glPushMatrix();
+   glTranslated(x,y,z);
+   glScaled(r,r,r);
+   DrawMesh(mesh);
+   glPopMatrix();
+}
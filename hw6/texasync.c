@@ -0,0 +1,246 @@
+/*
+ *  Asynchronous texture loading
+ *
+ *  LoadTexBMPAsync() returns a texture name straight away.  The name holds a
+ *  1x1 placeholder image until a worker thread has decoded the file and
+ *  TexUploadPending() has copied the decoded image into it.  Call
+ *  TexUploadPending() once per frame from display() or idle() so that only a
+ *  bounded amount of image data is uploaded per frame.
+ *
+ *  Decoding runs on a small pool of worker threads.  All OpenGL calls and all
+ *  callbacks happen on the thread that calls TexUploadPending(), which is
+ *  also where a file that cannot be read is reported.
+ */
+#include "CSCIx229.h"
+#include <pthread.h>
+
+#define MAXWORKERS 4  //  Maximum number of worker threads
+
+//  Callback waiting for a texture
+typedef struct texwaiter
+{
+   void (*callback)(const char* file,unsigned int tex);
+   struct texwaiter* next;
+} texwaiter_t;
+
+//  Texture load request
+typedef struct texjob
+{
+   char*          file;     //  File name
+   unsigned int   tex;      //  Texture name
+   image_t        img[MAXMIP]; //  Decoded image and mipmaps
+   int            nimg;     //  Number of mipmap levels
+   char           err[IMGERR]; //  Why the file could not be read
+   texwaiter_t*   waiters;  //  Callbacks to run when the texture lands
+   struct texjob* next;     //  Next job in queue
+   struct texjob* link;     //  Next job in list of jobs in flight
+} texjob_t;
+
+//  Worker pool state
+static pthread_mutex_t lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ready = PTHREAD_COND_INITIALIZER;
+static texjob_t* todo=NULL;     //  Jobs waiting to be decoded (FIFO)
+static texjob_t* todotail=NULL;
+static texjob_t* done=NULL;     //  Jobs waiting to be uploaded (FIFO)
+static texjob_t* donetail=NULL;
+static int nworkers=0;          //  Number of worker threads
+//  Jobs in flight (only used by the main thread)
+static texjob_t* flight=NULL;
+static int       nflight=0;
+
+//
+//  Append job to queue
+//
+static void Push(texjob_t** head,texjob_t** tail,texjob_t* job)
+{
+   job->next = NULL;
+   if (*tail)
+      (*tail)->next = job;
+   else
+      *head = job;
+   *tail = job;
+}
+
+//
+//  Remove job from head of queue
+//
+static texjob_t* Pop(texjob_t** head,texjob_t** tail)
+{
+   texjob_t* job = *head;
+   if (job)
+   {
+      *head = job->next;
+      if (!*head) *tail = NULL;
+   }
+   return job;
+}
+
+//
+//  Worker thread
+//    Decodes files until the program exits
+//
+static void* Worker(void* arg)
+{
+   while (1)
+   {
+      texjob_t* job;
+      //  Wait for a job
+      pthread_mutex_lock(&lock);
+      while (!todo)
+         pthread_cond_wait(&ready,&lock);
+      job = Pop(&todo,&todotail);
+      pthread_mutex_unlock(&lock);
+      //  Decode image and build mipmaps (errors are reported on upload)
+      if (DecodeImage(job->file,job->img,job->err))
+         job->nimg = TexMipmapFilter()==MIP_NONE ? 1 : BuildMipmaps(job->img,TexMipmapFilter(),job->img);
+      //  Hand it back for upload
+      pthread_mutex_lock(&lock);
+      Push(&done,&donetail,job);
+      pthread_mutex_unlock(&lock);
+   }
+   return NULL;
+}
+
+//
+//  Start worker threads
+//
+static void StartWorkers(void)
+{
+   int n = Processors();
+   if (n>MAXWORKERS) n = MAXWORKERS;
+   for (nworkers=0;nworkers<n;nworkers++)
+   {
+      pthread_t thread;
+      if (pthread_create(&thread,NULL,Worker,NULL)) Fatal("Cannot create texture loader thread\n");
+      pthread_detach(thread);
+   }
+}
+
+//
+//  Add a callback to a job
+//
+static void AddWaiter(texjob_t* job,void (*callback)(const char*,unsigned int))
+{
+   texwaiter_t* w;
+   if (!callback) return;
+   w = (texwaiter_t*)malloc(sizeof(texwaiter_t));
+   if (!w) Fatal("Cannot allocate memory for texture loader\n");
+   w->callback = callback;
+   w->next = job->waiters;
+   job->waiters = w;
+}
+
+/*
+ *  Load texture from BMP or PNG file in the background
+ *    Returns a texture name that holds a 1x1 placeholder until the image has
+ *    been uploaded by TexUploadPending()
+ *    callback (may be NULL) is called from TexUploadPending() once the image
+ *    is in place, or straight away if the file was already loaded
+ *    callback gets texture 0 if the placeholder was evicted or deleted before
+ *    the image was ready, since its name may have been reused
+ */
+unsigned int LoadTexBMPAsync(const char* file,void (*callback)(const char* file,unsigned int tex))
+{
+   const unsigned char grey[] = {128,128,128};
+   unsigned int tex;
+   texjob_t* job;
+
+   //  Already loaded or in flight
+   tex = TexCacheFind(file);
+   if (tex)
+   {
+      for (job=flight;job;job=job->link)
+         if (job->tex==tex)
+         {
+            AddWaiter(job,callback);
+            return tex;
+         }
+      if (callback) callback(file,tex);
+      return tex;
+   }
+
+   //  Create texture with placeholder image
+   glGenTextures(1,&tex);
+   TexBindName(tex);
+   glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+   glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+   glTexImage2D(GL_TEXTURE_2D,0,3,1,1,0,GL_RGB,GL_UNSIGNED_BYTE,grey);
+   glPopClientAttrib();
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+   //  Cache it now so later requests share the name
+   TexCacheAdd(file,tex,3);
+
+   //  Create job
+   job = (texjob_t*)malloc(sizeof(texjob_t));
+   if (!job) Fatal("Cannot allocate memory for texture loader\n");
+   job->file = (char*)malloc(strlen(file)+1);
+   if (!job->file) Fatal("Cannot allocate memory for texture loader\n");
+   strcpy(job->file,file);
+   job->tex = tex;
+   job->img[0].data = NULL;
+   job->nimg = 0;
+   job->waiters = NULL;
+   AddWaiter(job,callback);
+   job->link = flight;
+   flight = job;
+   nflight++;
+
+   //  Queue job for the workers
+   if (!nworkers) StartWorkers();
+   pthread_mutex_lock(&lock);
+   Push(&todo,&todotail,job);
+   pthread_cond_signal(&ready);
+   pthread_mutex_unlock(&lock);
+   return tex;
+}
+
+/*
+ *  Upload decoded textures
+ *    budget is the number of bytes to upload in this call, at least one
+ *    texture is uploaded if any are ready
+ *    Returns the number of textures still in flight
+ */
+int TexUploadPending(unsigned long budget)
+{
+   unsigned long bytes=0;
+   while (bytes<budget || !bytes)
+   {
+      texjob_t** p;
+      texwaiter_t* w;
+      unsigned long size;
+      unsigned int tex;    //  Texture uploaded (0 if evicted)
+      //  Get decoded image
+      texjob_t* job;
+      pthread_mutex_lock(&lock);
+      job = Pop(&done,&donetail);
+      pthread_mutex_unlock(&lock);
+      if (!job) break;
+      if (!job->nimg) Fatal("%s",job->err);
+      //  Upload unless the texture was evicted in the meantime
+      size = 0;
+      tex = TexCachePeek(job->file)==job->tex ? job->tex : 0;
+      if (tex)
+      {
+         TexImageMip(job->file,job->img,job->nimg,job->tex,&size);
+         TexCacheAdd(job->file,job->tex,size);
+      }
+      bytes += size ? size : 1;
+      FreeMipmaps(job->img,job->nimg);
+      free(job->img[0].data);
+      //  Remove from jobs in flight
+      for (p=&flight;*p!=job;p=&(*p)->link);
+      *p = job->link;
+      nflight--;
+      //  Run callbacks
+      while ((w = job->waiters))
+      {
+         job->waiters = w->next;
+         w->callback(job->file,tex);
+         free(w);
+      }
+      free(job->file);
+      free(job);
+   }
+   return nflight;
+}
@@ -0,0 +1,533 @@
+/*
+ *  Texture cache
+ *
+ *  Remembers which files have been turned into textures so that asking for
+ *  the same file again returns the existing texture name instead of reading
+ *  the file and uploading the image again.
+ *
+ *  Textures are keyed on the canonical path of the file and its modification
+ *  time when it was loaded.  Lookups by the name the caller used are served
+ *  from a hash table without touching the file system, so a steady state
+ *  frame does no file I/O at all.  Call TexCacheRevalidate() to pick up files
+ *  that changed on disk.
+ *
+ *  The cache also keeps resident texture memory under the budget set with
+ *  TexBudget().  Textures bound with TexBind() move to the front of the list,
+ *  and when the budget is exceeded the storage of the textures bound least
+ *  recently is released.  Their names stay valid and TexBind() reloads them
+ *  from file.  Textures bound while a display list is compiled are pinned,
+ *  since calling the list binds them without asking the cache.  Uploads and
+ *  evictions would be recorded in the list rather than run, so they wait
+ *  until the list is compiled.
+ *
+ *  The texture bound and whether a display list is being compiled are kept
+ *  here rather than asked of OpenGL, so binding the texture that is already
+ *  bound costs nothing.  Lists are compiled with TexNewList() and
+ *  TexEndList() for this.
+ */
+#include "CSCIx229.h"
+#include <sys/stat.h>
+#include <limits.h>
+
+#define NHASH 256  //  Number of hash buckets (power of two)
+
+//  Cached texture
+typedef struct texentry
+{
+   char*            path;   //  Canonical path
+   time_t           mtime;  //  Modification time when loaded
+   unsigned int     tex;    //  Texture name
+   unsigned long    bytes;  //  Texture bytes when resident
+   int              resident;  //  Texture storage is loaded
+   int              pinned;    //  Texture is never evicted
+   int              reload;    //  Reload when the display list is compiled
+   struct texentry* prev;   //  Previous entry (more recently bound)
+   struct texentry* next;   //  Next entry (less recently bound)
+   struct texentry* tnext;  //  Next entry in texture name hash chain
+} texentry_t;
+
+//  Name used to look up a cached texture
+typedef struct texalias
+{
+   char*            file;   //  File name as requested
+   texentry_t*      entry;  //  Cached texture
+   struct texalias* next;   //  Next alias in hash chain
+} texalias_t;
+
+//  Cache state
+static texentry_t* head=NULL;         //  List of cached textures
+static texentry_t* tail=NULL;         //  Least recently bound texture
+static texalias_t* alias[NHASH];      //  Hash table of requested names
+static texentry_t* byname[NHASH];     //  Hash table of texture names
+static unsigned long budget=0;        //  Resident bytes allowed (0=no limit)
+static texstats_t  stats={0,0,0,0,0,0};  //  Counters
+static unsigned int bound=0;          //  Texture bound (0=unknown)
+static int compiling=0;               //  Display list being compiled
+
+//
+//  Hash a string (FNV-1a)
+//
+static unsigned int Hash(const char* str)
+{
+   unsigned int h = 2166136261u;
+   while (*str)
+      h = (h ^ (unsigned char)*str++) * 16777619u;
+   return h & (NHASH-1);
+}
+
+//
+//  Copy a string
+//
+static char* Strdup(const char* str)
+{
+   char* s = (char*)malloc(strlen(str)+1);
+   if (!s) Fatal("Cannot allocate memory for texture cache\n");
+   return strcpy(s,str);
+}
+
+//
+//  Canonical path and modification time of a file
+//    Returns NULL if the file cannot be found
+//
+static char* Canonical(const char* file,time_t* mtime)
+{
+   struct stat st;
+   char* path;
+   if (stat(file,&st)) return NULL;
+   *mtime = st.st_mtime;
+#ifdef _WIN32
+   path = _fullpath(NULL,file,0);
+#else
+   path = realpath(file,NULL);
+#endif
+   //  Fall back to the name as given
+   return path ? path : Strdup(file);
+}
+
+//
+//  Find alias by requested name
+//
+static texalias_t* FindAlias(const char* file)
+{
+   texalias_t* a;
+   for (a=alias[Hash(file)];a;a=a->next)
+      if (!strcmp(a->file,file)) return a;
+   return NULL;
+}
+
+//
+//  Add alias for an entry
+//
+static void AddAlias(const char* file,texentry_t* e)
+{
+   unsigned int h = Hash(file);
+   texalias_t* a = (texalias_t*)malloc(sizeof(texalias_t));
+   if (!a) Fatal("Cannot allocate memory for texture cache\n");
+   a->file  = Strdup(file);
+   a->entry = e;
+   a->next  = alias[h];
+   alias[h] = a;
+}
+
+//
+//  Find entry by texture name
+//
+static texentry_t* FindTex(unsigned int tex)
+{
+   texentry_t* e;
+   for (e=byname[tex&(NHASH-1)];e;e=e->tnext)
+      if (e->tex==tex) return e;
+   return NULL;
+}
+
+//
+//  Add or remove entry in texture name hash table
+//
+static void AddTex(texentry_t* e)
+{
+   unsigned int h = e->tex&(NHASH-1);
+   e->tnext = byname[h];
+   byname[h] = e;
+}
+static void RemoveTex(texentry_t* e)
+{
+   texentry_t** p = &byname[e->tex&(NHASH-1)];
+   while (*p!=e)
+      p = &(*p)->tnext;
+   *p = e->tnext;
+}
+
+//
+//  Link entry at the head of the list
+//
+static void Link(texentry_t* e)
+{
+   e->prev = NULL;
+   e->next = head;
+   if (head)
+      head->prev = e;
+   else
+      tail = e;
+   head = e;
+}
+
+//
+//  Unlink entry from the list
+//
+static void Unlink(texentry_t* e)
+{
+   if (e->prev)
+      e->prev->next = e->next;
+   else
+      head = e->next;
+   if (e->next)
+      e->next->prev = e->prev;
+   else
+      tail = e->prev;
+}
+
+//
+//  Release texture storage but keep the texture name
+//
+static void Release(texentry_t* e)
+{
+   int k,w=1;
+   TexBindName(e->tex);
+   //  Replace each level with an empty image
+   for (k=0;k<MAXMIP && w;k++)
+   {
+      glGetTexLevelParameteriv(GL_TEXTURE_2D,k,GL_TEXTURE_WIDTH,&w);
+      if (w) glTexImage2D(GL_TEXTURE_2D,k,GL_RGB,0,0,0,GL_RGB,GL_UNSIGNED_BYTE,NULL);
+   }
+   e->resident = 0;
+   stats.bytes -= e->bytes;
+   stats.evictions++;
+}
+
+//
+//  Reload texture storage from file into the same texture name
+//
+static void Reload(texentry_t* e)
+{
+   int n = strlen(e->path);
+   if (n>5 && !strcmp(e->path+n-5,".ctex"))
+      TexImageCTEX(e->path,e->tex,&e->bytes);
+   else if (TexCompressMode()!=BC_NONE && TexHasBC())
+      LoadTexBC(e->path,e->tex,&e->bytes);
+   else
+   {
+      image_t img;
+      ReadImage(e->path,&img);
+      TexImage(e->path,&img,e->tex,&e->bytes);
+      free(img.data);
+   }
+   e->resident = 1;
+   stats.bytes += e->bytes;
+   stats.reloads++;
+}
+
+//
+//  Release least recently bound textures until resident bytes fit the budget
+//    keep is not released
+//
+static void Enforce(const texentry_t* keep)
+{
+   int cur = bound;
+   texentry_t* e;
+   if (compiling || !budget || stats.bytes<=budget) return;
+   if (!cur) glGetIntegerv(GL_TEXTURE_BINDING_2D,&cur);
+   for (e=tail;e && stats.bytes>budget;e=e->prev)
+      if (e!=keep && e->resident && !e->pinned)
+         Release(e);
+   TexBindName(cur);
+}
+
+//
+//  Remove an entry and all its aliases
+//
+static void Remove(texentry_t* e)
+{
+   int k;
+   //  Remove aliases pointing at this entry
+   for (k=0;k<NHASH;k++)
+   {
+      texalias_t** p = &alias[k];
+      while (*p)
+      {
+         texalias_t* a = *p;
+         if (a->entry==e)
+         {
+            *p = a->next;
+            free(a->file);
+            free(a);
+         }
+         else
+            p = &a->next;
+      }
+   }
+   //  Unlink entry
+   Unlink(e);
+   RemoveTex(e);
+   //  Release texture
+   if (e->tex==bound) bound = 0;
+   glDeleteTextures(1,&e->tex);
+   if (e->resident) stats.bytes -= e->bytes;
+   stats.count--;
+   free(e->path);
+   free(e);
+}
+
+//
+//  Find entry by file name
+//    A file cached under another name gets this name as an alias
+//
+static texentry_t* Lookup(const char* file)
+{
+   texalias_t* a;
+   texentry_t* e;
+   time_t mtime;
+   char*  path;
+
+   //  Fast path - file name seen before
+   if ((a = FindAlias(file))) return a->entry;
+   //  Same file under a different name
+   path = Canonical(file,&mtime);
+   if (!path) return NULL;
+   for (e=head;e;e=e->next)
+      if (e->mtime==mtime && !strcmp(e->path,path))
+      {
+         AddAlias(file,e);
+         break;
+      }
+   free(path);
+   return e;
+}
+
+/*
+ *  Look up a texture by file name
+ *    Returns the texture name or 0 if the file is not cached
+ */
+unsigned int TexCacheFind(const char* file)
+{
+   texentry_t* e = Lookup(file);
+   if (!e)
+   {
+      stats.misses++;
+      return 0;
+   }
+   stats.hits++;
+   return e->tex;
+}
+
+/*
+ *  Look up a texture by file name as TexCacheFind does without counting a
+ *  hit or miss
+ */
+unsigned int TexCachePeek(const char* file)
+{
+   texentry_t* e = Lookup(file);
+   return e ? e->tex : 0;
+}
+
+/*
+ *  Add a texture to the cache
+ *    file is the name used to load it
+ *    tex is the texture name
+ *    bytes is the size of the texture
+ *    If the file is already cached its entry is updated
+ */
+void TexCacheAdd(const char* file,unsigned int tex,unsigned long bytes)
+{
+   texentry_t* e;
+   texalias_t* a = FindAlias(file);
+   //  Update existing entry
+   if (a)
+   {
+      e = a->entry;
+      if (e->tex!=tex)
+      {
+         RemoveTex(e);
+         if (e->tex==bound) bound = 0;
+         glDeleteTextures(1,&e->tex);
+         e->tex = tex;
+         AddTex(e);
+      }
+      if (e->resident) stats.bytes -= e->bytes;
+      stats.bytes += bytes;
+      e->bytes = bytes;
+      e->resident = 1;
+      Enforce(e);
+      return;
+   }
+   //  New entry
+   e = (texentry_t*)malloc(sizeof(texentry_t));
+   if (!e) Fatal("Cannot allocate memory for texture cache\n");
+   e->path = Canonical(file,&e->mtime);
+   if (!e->path)
+   {
+      e->path  = Strdup(file);
+      e->mtime = 0;
+   }
+   e->tex   = tex;
+   e->bytes = bytes;
+   e->resident = 1;
+   e->pinned   = 0;
+   e->reload   = 0;
+   //  Link at head of list
+   Link(e);
+   AddTex(e);
+   AddAlias(file,e);
+   //  Update counters
+   stats.bytes += bytes;
+   stats.count++;
+   //  Make room
+   Enforce(e);
+}
+
+/*
+ *  Bind texture
+ *    Cached textures are marked as used, reloaded if they were evicted, and
+ *    pinned if a display list is being compiled.  Other textures are just
+ *    bound.
+ */
+void TexBind(unsigned int tex)
+{
+   texentry_t* e = FindTex(tex);
+   if (e)
+   {
+      //  Move to head of list
+      if (e!=head)
+      {
+         Unlink(e);
+         Link(e);
+      }
+      //  Wait for the list to be compiled before uploading
+      if (!e->resident && compiling)
+         e->reload = 1;
+      else if (!e->resident)
+      {
+         Reload(e);
+         Enforce(e);
+      }
+      if (compiling) e->pinned = 1;
+   }
+   TexBindName(tex);
+}
+
+/*
+ *  Bind texture without the cache
+ *    Skipped when the texture is already bound, except while a display list
+ *    is compiled since the list has to bind it itself
+ */
+void TexBindName(unsigned int tex)
+{
+   if (compiling)
+      glBindTexture(GL_TEXTURE_2D,tex);
+   else if (!tex || tex!=bound)
+   {
+      glBindTexture(GL_TEXTURE_2D,tex);
+      bound = tex;
+   }
+}
+
+/*
+ *  Forget which texture is bound
+ *    Call after deleting textures, popping GL_TEXTURE_BIT or binding
+ *    textures with glBindTexture
+ */
+void TexBindReset(void)
+{
+   bound = 0;
+}
+
+/*
+ *  Start compiling a display list
+ *    Use instead of glNewList so TexBind pins the textures the list binds
+ */
+void TexNewList(unsigned int list)
+{
+   glNewList(list,GL_COMPILE);
+   compiling = 1;
+}
+
+/*
+ *  End compiling a display list
+ *    Reloads evicted textures the list binds and makes up evictions put off
+ *    while it was compiled
+ */
+void TexEndList(void)
+{
+   texentry_t* e;
+   glEndList();
+   compiling = 0;
+   for (e=head;e;e=e->next)
+      if (e->reload)
+      {
+         if (!e->resident) Reload(e);
+         e->reload = 0;
+      }
+   Enforce(NULL);
+}
+
+/*
+ *  Set budget for resident texture bytes
+ *    0 means no limit
+ *    Textures are evicted right away if the budget is exceeded
+ */
+void TexBudget(unsigned long bytes)
+{
+   budget = bytes;
+   Enforce(NULL);
+}
+
+/*
+ *  Evict a texture from the cache and delete it
+ *    The file may be named differently than when it was cached
+ *    Returns 1 if the file was cached
+ */
+int TexCacheEvict(const char* file)
+{
+   texentry_t* e = Lookup(file);
+   if (!e) return 0;
+   Remove(e);
+   return 1;
+}
+
+/*
+ *  Evict and delete all cached textures
+ */
+void TexCacheFlush(void)
+{
+   while (head)
+      Remove(head);
+}
+
+/*
+ *  Evict textures whose file changed on disk since they were loaded
+ *    Returns the number of textures evicted
+ */
+int TexCacheRevalidate(void)
+{
+   int n=0;
+   texentry_t* e=head;
+   while (e)
+   {
+      texentry_t* next = e->next;
+      struct stat st;
+      if (stat(e->path,&st) || st.st_mtime!=e->mtime)
+      {
+         Remove(e);
+         n++;
+      }
+      e = next;
+   }
+   return n;
+}
+
+/*
+ *  Get cache counters
+ */
+void TexCacheStats(texstats_t* s)
+{
+   *s = stats;
+}
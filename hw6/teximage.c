@@ -0,0 +1,206 @@
+/*
+ *  Create texture from image in memory
+ */
+#include "CSCIx229.h"
+
+//  OpenGL headers may lack S3TC
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+//  OpenGL 1.1 headers lack BGR
+#ifndef GL_BGR
+#define GL_BGR 0x80E0
+#endif
+//  OpenGL 1.1 headers lack the mipmap level range
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+
+//
+//  Set filtering for a texture with n levels
+//
+static void TexParams(int n)
+{
+   //  Scale linearly when image size doesn't match
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+   //  Blend between mipmap levels when shrinking
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,n-1);
+   glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,n>1?GL_LINEAR_MIPMAP_LINEAR:GL_LINEAR);
+}
+
+//
+//  Check that an image fits in a texture
+//
+static void CheckSize(const char* file,const image_t* img)
+{
+   int max;  //  Maximum texture dimensions
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE,&max);
+   if (img->dx<1 || img->dx>max) Fatal("%s image width %d out of range 1-%d\n",file,img->dx,max);
+   if (img->dy<1 || img->dy>max) Fatal("%s image height %d out of range 1-%d\n",file,img->dy,max);
+}
+
+//
+//  Copy uncompressed mipmap chain to texture
+//    fmt is the order of the pixels and align the row alignment of level 0
+//    (other levels are tightly packed)
+//
+static unsigned int Upload(const char* file,const image_t levels[],int n,int fmt,int align,unsigned int texture,unsigned long* bytes)
+{
+   int k;
+   //  Sanity check
+   ErrCheck("TexImage");
+   //  Generate 2D texture
+   if (!texture) glGenTextures(1,&texture);
+   TexBindName(texture);
+   //  Copy images
+   if (bytes) *bytes = 0;
+   glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+   glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+   glPixelStorei(GL_UNPACK_SKIP_ROWS,0);
+   glPixelStorei(GL_UNPACK_SKIP_PIXELS,0);
+   for (k=0;k<n;k++)
+   {
+      glPixelStorei(GL_UNPACK_ALIGNMENT,k ? 1 : align);
+      glTexImage2D(GL_TEXTURE_2D,k,levels[k].n,levels[k].dx,levels[k].dy,0,fmt,GL_UNSIGNED_BYTE,levels[k].data);
+      if (bytes) *bytes += (unsigned long)levels[k].n*levels[k].dx*levels[k].dy;
+   }
+   glPopClientAttrib();
+   if (glGetError()) Fatal("Error in glTexImage2D %s %dx%d\n",file,levels[0].dx,levels[0].dy);
+   TexParams(n);
+   return texture;
+}
+
+/*
+ *  Check whether OpenGL accepts BC1 and BC3 (S3TC) textures
+ */
+int TexHasBC(void)
+{
+#ifdef GL_VERSION_1_3
+   const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+   return ext && strstr(ext,"GL_EXT_texture_compression_s3tc");
+#else
+   return 0;
+#endif
+}
+
+/*
+ *  Copy BC1 or BC3 encoded mipmap chain to texture
+ *    levels hold the blocks for levels 0 to n-1 (n=3 is BC1, n=4 is BC3)
+ *    Without S3TC support the blocks are decoded and copied uncompressed
+ *    Other arguments as for TexImageMip
+ */
+unsigned int TexImageBC(const char* file,const image_t levels[],int n,unsigned int texture,unsigned long* bytes)
+{
+   int k;
+#ifdef GL_VERSION_1_3
+   if (TexHasBC())
+   {
+      int fmt = levels[0].n==4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+      //  Sanity check
+      ErrCheck("TexImageBC");
+      //  Generate 2D texture
+      if (!texture) glGenTextures(1,&texture);
+      TexBindName(texture);
+      //  Copy blocks
+      if (bytes) *bytes = 0;
+      for (k=0;k<n;k++)
+      {
+         unsigned long size = BCSize(levels[k].dx,levels[k].dy,levels[k].n);
+         glCompressedTexImage2D(GL_TEXTURE_2D,k,fmt,levels[k].dx,levels[k].dy,0,size,levels[k].data);
+         if (bytes) *bytes += size;
+      }
+      if (glGetError()) Fatal("Error in glCompressedTexImage2D %s %dx%d\n",file,levels[0].dx,levels[0].dy);
+      TexParams(n);
+      return texture;
+   }
+#endif
+   //  Decode and copy uncompressed
+   {
+      image_t img[MAXMIP];
+      for (k=0;k<n;k++)
+      {
+         img[k] = levels[k];
+         img[k].data = (unsigned char*)malloc((size_t)img[k].n*img[k].dx*img[k].dy);
+         if (!img[k].data) Fatal("Cannot allocate memory for image %s\n",file);
+         DecodeBC(levels[k].data,img+k);
+      }
+      texture = TexImageMip(file,img,n,texture,bytes);
+      for (k=0;k<n;k++)
+         free(img[k].data);
+   }
+   return texture;
+}
+
+/*
+ *  Copy mipmap chain to texture
+ *    Levels are BC1/BC3 compressed when selected with TexCompress
+ *    file is used in error messages
+ *    levels are the images for levels 0 to n-1
+ *    texture is the texture name to use or 0 to create a new one
+ *    bytes (may be NULL) is set to the size of the texture
+ *    Returns the texture name
+ */
+unsigned int TexImageMip(const char* file,const image_t levels[],int n,unsigned int texture,unsigned long* bytes)
+{
+   int k;
+
+   //  Check image parameters
+   CheckSize(file,levels);
+
+   //  Compress if selected and supported
+   if (TexCompressMode()!=BC_NONE && TexHasBC())
+   {
+      image_t bc[MAXMIP];
+      unsigned char* buf;
+      unsigned long size=0;
+      for (k=0;k<n;k++)
+         size += BCSize(levels[k].dx,levels[k].dy,levels[k].n);
+      buf = (unsigned char*)malloc(size);
+      if (!buf) Fatal("Cannot allocate memory for image %s\n",file);
+      for (size=0,k=0;k<n;k++)
+      {
+         bc[k] = levels[k];
+         bc[k].data = buf+size;
+         size += EncodeBC(levels+k,TexCompressMode(),bc[k].data);
+      }
+      texture = TexImageBC(file,bc,n,texture,bytes);
+      free(buf);
+      return texture;
+   }
+
+   return Upload(file,levels,n,levels[0].n==4 ? GL_RGBA : GL_RGB,1,texture,bytes);
+}
+
+/*
+ *  Copy mipmap chain of BGR pixels to texture
+ *    As TexImageMip for 3 byte pixels stored blue first as in BMP files,
+ *    which OpenGL swizzles as it copies them (they are never compressed)
+ *    Rows of level 0 are padded to a multiple of align bytes, so a BMP
+ *    file can be copied straight from its mapping
+ */
+unsigned int TexImageMipBGR(const char* file,const image_t levels[],int n,int align,unsigned int texture,unsigned long* bytes)
+{
+   CheckSize(file,levels);
+   return Upload(file,levels,n,GL_BGR,align,texture,bytes);
+}
+
+/*
+ *  Copy image to texture
+ *    Builds and copies mipmaps when selected with TexMipmap
+ *    Arguments as for TexImageMip
+ */
+unsigned int TexImage(const char* file,const image_t* img,unsigned int texture,unsigned long* bytes)
+{
+   image_t levels[MAXMIP];
+   int n = 1;
+   if (TexMipmapFilter()!=MIP_NONE)
+      n = BuildMipmaps(img,TexMipmapFilter(),levels);
+   else
+      levels[0] = *img;
+   texture = TexImageMip(file,levels,n,texture,bytes);
+   FreeMipmaps(levels,n);
+   return texture;
+}
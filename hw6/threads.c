@@ -0,0 +1,59 @@
+/*
+ *  Threads for parallel work
+ *
+ *  The OBJ parser, normal generation, BVH builds, block compression and the
+ *  texture loaders all size their threads by the number of processors.
+ *  Systems without sysconf() (MinGW) count as one processor.
+ *
+ *  Parallel() runs a function on an array of jobs, one thread each.  The
+ *  first job runs on the calling thread, and so does any job whose thread
+ *  cannot be created, so the work gets done either way.
+ */
+#include "CSCIx229.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ *  Number of processors online (at least 1)
+ */
+int Processors(void)
+{
+   long n=1;
+#ifdef _SC_NPROCESSORS_ONLN
+   n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   return n<1 ? 1 : n;
+}
+
+/*
+ *  Number of threads for n items when each thread should get at least min
+ *    One per processor up to MAXTHREADS, and at least 1
+ */
+int Threads(long long n,long long min)
+{
+   int k = Processors();
+   if (k>MAXTHREADS) k = MAXTHREADS;
+   if (k>n/min) k = n/min;
+   return k<1 ? 1 : k;
+}
+
+/*
+ *  Run fn on n jobs of size bytes each and wait for them
+ *    n is at most MAXTHREADS
+ */
+void Parallel(void* (*fn)(void*),void* job,size_t size,int n)
+{
+   pthread_t thread[MAXTHREADS];
+   int started[MAXTHREADS];
+   int k;
+   char* p = (char*)job;
+   if (n>MAXTHREADS) Fatal("Parallel: %d jobs exceed %d threads\n",n,MAXTHREADS);
+   for (k=1;k<n;k++)
+      started[k] = !pthread_create(thread+k,NULL,fn,p+k*size);
+   fn(p);
+   for (k=1;k<n;k++)
+      if (started[k])
+         pthread_join(thread[k],NULL);
+      else
+         fn(p+k*size);
+}